@@ -0,0 +1,113 @@
+#include "BatchPathFinder.h"
+
+namespace Hierarchy
+{
+	BatchPathFinder::BatchPathFinder(const Hierarchy* hierarchy, int numThreads)
+		: mHierarchy(hierarchy),
+		mPathFinder(hierarchy),
+		mBatchIndex(0),
+		mNumBusyWorkers(0),
+		mQuit(false),
+		mQueries(nullptr),
+		mResults(nullptr),
+		mNumQueries(0),
+		mNextQuery(0)
+	{
+		DIDA_ASSERT(numThreads >= 1);
+
+		for(int i = 1; i < numThreads; i++)
+			mThreads.emplace_back(&BatchPathFinder::workerMain, this);
+	}
+
+	BatchPathFinder::~BatchPathFinder()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mQuit = true;
+		}
+
+		mBatchStarted.notify_all();
+
+		for(std::thread& thread : mThreads)
+			thread.join();
+	}
+
+	void BatchPathFinder::run(const Query* queries, int numQueries, Result* results)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mQueries = queries;
+			mResults = results;
+			mNumQueries = numQueries;
+			mNextQuery = 0;
+			mNumBusyWorkers = (int)mThreads.size();
+			mBatchIndex++;
+		}
+
+		mBatchStarted.notify_all();
+
+		runQueries(mPathFinder);
+
+		std::unique_lock<std::mutex> lock(mMutex);
+		mBatchFinished.wait(lock, [this] { return mNumBusyWorkers == 0; });
+	}
+
+	void BatchPathFinder::workerMain()
+	{
+		PathFinder pathFinder(mHierarchy);
+
+		uint32_t lastBatchIndex = 0;
+		while(true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mMutex);
+				mBatchStarted.wait(lock, [&] { return mQuit || mBatchIndex != lastBatchIndex; });
+				if(mQuit)
+					return;
+
+				lastBatchIndex = mBatchIndex;
+			}
+
+			runQueries(pathFinder);
+
+			bool lastWorker;
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mNumBusyWorkers--;
+				lastWorker = mNumBusyWorkers == 0;
+			}
+
+			if(lastWorker)
+				mBatchFinished.notify_one();
+		}
+	}
+
+	void BatchPathFinder::runQueries(PathFinder& pathFinder)
+	{
+		while(true)
+		{
+			int queryIndex = mNextQuery++;
+			if(queryIndex >= mNumQueries)
+				break;
+
+			const Query& query = mQueries[queryIndex];
+			Result& result = mResults[queryIndex];
+
+			PathFinder::IterationRes res = pathFinder.begin(query.mStartPoint, query.mEndPoint, nullptr);
+			while(res == PathFinder::IterationRes::IN_PROGRESS)
+				res = pathFinder.iteration(nullptr);
+
+			result.mRes = res;
+			if(res == PathFinder::IterationRes::END_REACHED)
+			{
+				result.mCost = pathFinder.endCost();
+				result.mWaypoints.resize(pathFinder.path(nullptr, 0));
+				pathFinder.path(result.mWaypoints.data(), (int)result.mWaypoints.size());
+			}
+			else
+			{
+				result.mWaypoints.clear();
+			}
+		}
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "Obj.h"
+#include "Hierarchy.h"
+#include "HierarchyPathFinder.h"
+
+namespace Hierarchy
+{
+	// Runs batches of point to point queries against one Hierarchy on a pool
+	// of worker threads. Each thread owns a PathFinder, whose storage is
+	// reused from query to query, and claims queries one at a time from a
+	// shared counter, so threads which get short queries take over the rest
+	// of the batch.
+	class BatchPathFinder
+	{
+	public:
+		struct Query
+		{
+			Point mStartPoint;
+			Point mEndPoint;
+		};
+
+		struct Result
+		{
+			PathFinder::IterationRes mRes;
+
+			// Only valid if mRes is END_REACHED.
+			Cost mCost;
+			std::vector<Point> mWaypoints;
+		};
+
+		// numThreads includes the thread calling run, so numThreads - 1
+		// worker threads are started.
+		BatchPathFinder(const Hierarchy* hierarchy, int numThreads);
+		~BatchPathFinder();
+
+		BatchPathFinder(const BatchPathFinder&) = delete;
+		BatchPathFinder& operator = (const BatchPathFinder&) = delete;
+
+		// Runs all queries and blocks until they're done. results[i] receives
+		// the result of queries[i]. Passing the same results array to every
+		// call lets the waypoint vectors keep their storage.
+		void run(const Query* queries, int numQueries, Result* results);
+
+	private:
+		void workerMain();
+		void runQueries(PathFinder& pathFinder);
+
+		RefPtr<const Hierarchy> mHierarchy;
+
+		PathFinder mPathFinder;
+		std::vector<std::thread> mThreads;
+
+		std::mutex mMutex;
+		std::condition_variable mBatchStarted;
+		std::condition_variable mBatchFinished;
+		uint32_t mBatchIndex;
+		int mNumBusyWorkers;
+		bool mQuit;
+
+		const Query* mQueries;
+		Result* mResults;
+		int mNumQueries;
+		std::atomic<int> mNextQuery;
+	};
+}
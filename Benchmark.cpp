@@ -0,0 +1,171 @@
+#include "TestCase.h"
+#include "HierarchyPathFinder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <png.h>
+
+// Runs every root of every test case in a directory to completion, in all 4
+// orientations, and prints one JSON object per line:
+//
+// {"type":"build", ...} with the time to build the hierarchy of a test case,
+// {"type":"root", ...} with the time per iteration and the path finder
+// counters of one root in one orientation.
+//
+// Usage: GridPathFindingBenchmark [testCaseDir] [numRuns]
+
+using namespace Hierarchy;
+
+typedef std::chrono::steady_clock Clock;
+
+static int64_t nanosecondsSince(Clock::time_point start)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+// Reads a PNG as 0xAARRGGBB pixels, the format TestCase::fromImage takes.
+static bool loadPng(const char* fileName, int& width, int& height, std::vector<uint32_t>& pixels)
+{
+	png_image image;
+	memset(&image, 0, sizeof(image));
+	image.version = PNG_IMAGE_VERSION;
+	if(!png_image_begin_read_from_file(&image, fileName))
+		return false;
+
+	// 0xAARRGGBB is stored as B, G, R, A on little endian machines.
+	uint32_t one = 1;
+	bool littleEndian = *(uint8_t*)&one == 1;
+	image.format = littleEndian ? PNG_FORMAT_BGRA : PNG_FORMAT_ARGB;
+
+	width = image.width;
+	height = image.height;
+	pixels.resize(width * height);
+	if(!png_image_finish_read(&image, nullptr, pixels.data(), 0, nullptr))
+	{
+		png_image_free(&image);
+		return false;
+	}
+
+	return true;
+}
+
+static void benchmarkBuild(const std::string& name, int width, int height, const std::vector<uint32_t>& pixels, int numRuns)
+{
+	std::vector<uint8_t> elevation(width * height);
+	for(int i = 0; i < width * height; i++)
+		elevation[i] = pixels[i] == TestCase::BLOCKED_COLOR ? 0 : 255;
+
+	int64_t totalNs = 0;
+	int64_t minNs = INT64_MAX;
+	for(int run = 0; run < numRuns; run++)
+	{
+		Clock::time_point start = Clock::now();
+		RefPtr<::Hierarchy::Hierarchy> hierarchy;
+		hierarchy.setNew(new ::Hierarchy::Hierarchy(width, height, elevation.data()));
+		int64_t ns = nanosecondsSince(start);
+
+		totalNs += ns;
+		minNs = std::min(minNs, ns);
+	}
+
+	printf("{\"type\":\"build\",\"map\":\"%s\",\"width\":%d,\"height\":%d,\"runs\":%d,\"mean_ns\":%lld,\"min_ns\":%lld}\n",
+		name.c_str(), width, height, numRuns, (long long)(totalNs / numRuns), (long long)minNs);
+}
+
+static void benchmarkRoots(const std::string& name, const TestCase& testCase, int rotation, int numRuns)
+{
+	PathFinder pathFinder(testCase.hierarchy());
+	for(int rootIndex = 0; rootIndex < testCase.numRoots(); rootIndex++)
+	{
+		const CellAndCorner& root = testCase.rootsBegin()[rootIndex];
+
+		int64_t totalNs = 0;
+		int64_t minNs = INT64_MAX;
+		int64_t numIterations = 0;
+		for(int run = 0; run < numRuns; run++)
+		{
+			numIterations = 0;
+
+			Clock::time_point start = Clock::now();
+			PathFinder::IterationRes res = pathFinder.begin(root);
+			while(res == PathFinder::IterationRes::IN_PROGRESS)
+			{
+				res = pathFinder.iteration(nullptr);
+				numIterations++;
+			}
+			int64_t ns = nanosecondsSince(start);
+
+			totalNs += ns;
+			minNs = std::min(minNs, ns);
+		}
+
+		PathFinder::Stats stats = pathFinder.stats();
+		double nsPerIteration = numIterations ? (double)totalNs / ((double)numIterations * numRuns) : 0.0;
+		printf("{\"type\":\"root\",\"map\":\"%s\",\"rotation\":%d,\"root\":%d,\"runs\":%d,\"iterations\":%lld,"
+			"\"mean_ns\":%lld,\"min_ns\":%lld,\"ns_per_iteration\":%.2f,"
+			"\"pushed\":%llu,\"popped\":%llu,\"peak_open\":%zu,\"closed\":%zu}\n",
+			name.c_str(), rotation, rootIndex, numRuns, (long long)numIterations,
+			(long long)(totalNs / numRuns), (long long)minNs, nsPerIteration,
+			(unsigned long long)stats.mNumPushed, (unsigned long long)stats.mNumPopped,
+			stats.mPeakOpenSize, stats.mClosedSetSize);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	std::string testCaseDir = argc > 1 ? argv[1] : "TestCases";
+	int numRuns = argc > 2 ? std::max(atoi(argv[2]), 1) : 100;
+
+	std::vector<std::filesystem::path> fileNames;
+	std::error_code error;
+	for(const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(testCaseDir, error))
+	{
+		if(entry.path().extension() == ".png")
+			fileNames.push_back(entry.path());
+	}
+
+	if(error || fileNames.empty())
+	{
+		fprintf(stderr, "No test cases found in %s\n", testCaseDir.c_str());
+		return 1;
+	}
+
+	std::sort(fileNames.begin(), fileNames.end());
+
+	int numFailed = 0;
+	for(const std::filesystem::path& fileName : fileNames)
+	{
+		std::string name = fileName.stem().string();
+
+		int width;
+		int height;
+		std::vector<uint32_t> pixels;
+		RefPtr<TestCase> testCase;
+		if(loadPng(fileName.string().c_str(), width, height, pixels))
+			testCase = TestCase::fromImage(width, height, pixels.data());
+
+		if(!testCase)
+		{
+			fprintf(stderr, "Failed to load %s\n", fileName.string().c_str());
+			numFailed++;
+			continue;
+		}
+
+		benchmarkBuild(name, width, height, pixels, numRuns);
+
+		for(int rotation = 0; rotation < 4; rotation++)
+		{
+			if(rotation != 0)
+				testCase->rotate90DegCcw();
+
+			benchmarkRoots(name, *testCase, rotation, numRuns);
+		}
+	}
+
+	return numFailed == 0 ? 0 : 1;
+}
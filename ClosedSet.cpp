@@ -1,10 +1,30 @@
+#include <algorithm>
+#include <iterator>
+
 #include "ClosedSet.h"
 
 namespace Hierarchy
 {
 	ClosedSet::ClosedSet(const Hierarchy* hierarchy)
-		: mHierarchy(hierarchy)
+		: mHierarchy(hierarchy),
+		mEdgesCellKey(CellKey::invalidCellKey()),
+		mEdges(0),
+		mGeneration(1),
+		mNumPoints(0),
+		mNumExpandedCorners(0)
 	{
+		ParentEntry emptyEntry;
+		emptyEntry.mGeneration = 0;
+		emptyEntry.mPackedPoint = 0;
+		emptyEntry.mParent = Point::invalidPoint();
+		emptyEntry.mVia = Point::invalidPoint();
+		emptyEntry.mCost = 0;
+
+		int numPixels = hierarchy->width() * hierarchy->height();
+		mDirectParentTable = numPixels <= MAX_DIRECT_PARENT_TABLE_SIZE;
+		mPointToParent.resize(mDirectParentTable ? numPixels : INITIAL_PARENT_HASH_TABLE_SIZE, emptyEntry);
+
+		mExpandedCorners.resize(INITIAL_PARENT_HASH_TABLE_SIZE, CornerEntry{ 0, 0, { 0, 0, 0 } });
 	}
 
 	bool ClosedSet::pointTraversed(CellKey cellKey, Point pt) const
@@ -12,8 +32,10 @@ namespace Hierarchy
 		Point min = cellKey.corner(CornerIndex::MIN_X_MIN_Y);
 		Point max = cellKey.corner(CornerIndex::MAX_X_MAX_Y);
 
-		auto it = mTraversedEdges.find(cellKey);
-		uint8_t mask = it != mTraversedEdges.end() ? it->second : 0;
+		if(cellKey != mEdgesCellKey)
+			return false;
+
+		uint8_t mask = mEdges;
 
 		if(pt.mX == min.mX)
 		{
@@ -40,28 +62,199 @@ namespace Hierarchy
 		return false;
 	}
 
-	bool ClosedSet::tryAddPoint(Point pt, Point parentPt)
+	bool ClosedSet::tryAddPoint(Point pt, Point parentPt, Point viaPt, uint64_t cost)
 	{
-		auto it = mPointToParent.find(pt);
-		if(it != mPointToParent.end())
+		ParentEntry* entry = findParentEntry(pt);
+		if(entry->mGeneration == mGeneration)
 		{
-			return false;
+			if(entry->mCost <= cost)
+				return false;
+		}
+		else
+		{
+			if(!mDirectParentTable)
+			{
+				// Keep the load factor at or below 1/2, so probe sequences stay
+				// short.
+				if((mNumPoints + 1) * 2 > (int)mPointToParent.size())
+				{
+					growParentHashTable();
+					entry = findParentEntry(pt);
+				}
+			}
+
+			mNumPoints++;
 		}
 
-		mPointToParent.insert(std::make_pair(pt, parentPt));
+		entry->mGeneration = mGeneration;
+		entry->mPackedPoint = packPoint(pt);
+		entry->mParent = parentPt;
+		entry->mVia = viaPt;
+		entry->mCost = cost;
 		return true;
 	}
 
-	void ClosedSet::addEdges(CellKey cellKey, uint8_t edges)
+	Point ClosedSet::parentOf(Point pt) const
+	{
+		const ParentEntry* entry = findParentEntry(pt);
+		if(entry->mGeneration != mGeneration)
+			return Point::invalidPoint();
+
+		return entry->mParent;
+	}
+
+	Point ClosedSet::viaPointOf(Point pt) const
+	{
+		const ParentEntry* entry = findParentEntry(pt);
+		if(entry->mGeneration != mGeneration)
+			return Point::invalidPoint();
+
+		return entry->mVia;
+	}
+
+	bool ClosedSet::tryExpandCorner(Point pt, CornerIndex cornerIndex, uint64_t cost)
 	{
-		auto it = mTraversedEdges.find(cellKey);
-		if(it != mTraversedEdges.end())
+		return tryImproveCorner(pt, cornerIndex, 0, cost);
+	}
+
+	bool ClosedSet::tryExpandBeamPoint(Point pt, CornerIndex cornerIndex, Axis2 axis, uint64_t cost)
+	{
+		return tryImproveCorner(pt, cornerIndex, 1 + (int)axis, cost);
+	}
+
+	bool ClosedSet::tryImproveCorner(Point pt, CornerIndex cornerIndex, int costIndex, uint64_t cost)
+	{
+		uint32_t packedCorner = packCorner(pt, cornerIndex);
+		CornerEntry* entry = const_cast<CornerEntry*>(findCornerEntry(packedCorner));
+		if(entry->mGeneration == mGeneration)
 		{
-			it->second |= edges;
+			// The expansion itself also covers the beams.
+			if(entry->mCosts[costIndex] <= cost || entry->mCosts[0] <= cost)
+				return false;
 		}
 		else
 		{
-			mTraversedEdges.insert(std::make_pair(cellKey, edges));
+			if((mNumExpandedCorners + 1) * 2 > (int)mExpandedCorners.size())
+			{
+				growCornerHashTable();
+				entry = const_cast<CornerEntry*>(findCornerEntry(packedCorner));
+			}
+
+			mNumExpandedCorners++;
+
+			entry->mGeneration = mGeneration;
+			entry->mPackedCorner = packedCorner;
+			std::fill(std::begin(entry->mCosts), std::end(entry->mCosts), UINT64_MAX);
+		}
+
+		entry->mCosts[costIndex] = cost;
+		return true;
+	}
+
+	const ClosedSet::CornerEntry* ClosedSet::findCornerEntry(uint32_t packedCorner) const
+	{
+		// The same hashing as for the parent hash table.
+		uint32_t mask = (uint32_t)mExpandedCorners.size() - 1;
+		uint32_t index = (uint32_t)(((uint64_t)(packedCorner * 0x9e3779b1u) * mExpandedCorners.size()) >> 32);
+		while(true)
+		{
+			const CornerEntry* entry = &mExpandedCorners[index];
+			if(entry->mGeneration != mGeneration || entry->mPackedCorner == packedCorner)
+				return entry;
+
+			index = (index + 1) & mask;
 		}
 	}
-}
\ No newline at end of file
+
+	void ClosedSet::growCornerHashTable()
+	{
+		std::vector<CornerEntry> oldTable;
+		oldTable.swap(mExpandedCorners);
+		mExpandedCorners.resize(oldTable.size() * 2, CornerEntry{ 0, 0, { 0, 0, 0 } });
+
+		for(const CornerEntry& oldEntry : oldTable)
+		{
+			if(oldEntry.mGeneration == mGeneration)
+				*const_cast<CornerEntry*>(findCornerEntry(oldEntry.mPackedCorner)) = oldEntry;
+		}
+	}
+
+	const ClosedSet::ParentEntry* ClosedSet::findParentEntry(Point pt) const
+	{
+		if(mDirectParentTable)
+		{
+			DIDA_ASSERT(pt.mX >= 0 && pt.mX < mHierarchy->width() && pt.mY >= 0 && pt.mY < mHierarchy->height());
+			return &mPointToParent[pt.mX + pt.mY * mHierarchy->width()];
+		}
+
+		// Fibonacci hashing. The low bits of the product only depend on the
+		// low bits of the x coordinate, so the index is taken from the high
+		// bits. The table size is a power of 2, so the mask replaces the
+		// modulo when probing.
+		uint32_t packedPoint = packPoint(pt);
+		uint32_t mask = (uint32_t)mPointToParent.size() - 1;
+		uint32_t index = (uint32_t)(((uint64_t)(packedPoint * 0x9e3779b1u) * mPointToParent.size()) >> 32);
+		while(true)
+		{
+			const ParentEntry* entry = &mPointToParent[index];
+			if(entry->mGeneration != mGeneration || entry->mPackedPoint == packedPoint)
+				return entry;
+
+			index = (index + 1) & mask;
+		}
+	}
+
+	void ClosedSet::growParentHashTable()
+	{
+		std::vector<ParentEntry> oldTable;
+		oldTable.swap(mPointToParent);
+
+		ParentEntry emptyEntry;
+		emptyEntry.mGeneration = 0;
+		emptyEntry.mPackedPoint = 0;
+		emptyEntry.mParent = Point::invalidPoint();
+		emptyEntry.mVia = Point::invalidPoint();
+		emptyEntry.mCost = 0;
+		mPointToParent.resize(oldTable.size() * 2, emptyEntry);
+
+		for(const ParentEntry& oldEntry : oldTable)
+		{
+			if(oldEntry.mGeneration != mGeneration)
+				continue;
+
+			Point pt((int16_t)(oldEntry.mPackedPoint & 0xffff), (int16_t)(oldEntry.mPackedPoint >> 16));
+			*findParentEntry(pt) = oldEntry;
+		}
+	}
+
+	void ClosedSet::addEdges(CellKey cellKey, uint8_t edges)
+	{
+		DIDA_ASSERT((edges & ~(uint8_t)EdgeFlags::ALL) == 0);
+		DIDA_ASSERT(mEdges == 0 || cellKey == mEdgesCellKey);
+
+		mEdgesCellKey = cellKey;
+		mEdges |= edges;
+	}
+
+	void ClosedSet::clear()
+	{
+		mGeneration++;
+		if(mGeneration == 0)
+		{
+			// The generation wrapped around, so stamps from 2^32 generations
+			// ago would look current again.
+			for(ParentEntry& entry : mPointToParent)
+				entry.mGeneration = 0;
+
+			for(CornerEntry& entry : mExpandedCorners)
+				entry.mGeneration = 0;
+
+			mGeneration = 1;
+		}
+
+		mEdgesCellKey = CellKey::invalidCellKey();
+		mEdges = 0;
+		mNumPoints = 0;
+		mNumExpandedCorners = 0;
+	}
+}
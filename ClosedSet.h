@@ -1,6 +1,6 @@
 #pragma once
 
-#include <map>
+#include <vector>
 
 #include "Hierarchy.h"
 
@@ -13,7 +13,30 @@ namespace Hierarchy
 
 		bool pointTraversed(CellKey cellKey, Point pt) const;
 		
-		bool tryAddPoint(Point pt, Point parentPt);
+		// Records parentPt as the parent of pt, unless pt was already added
+		// with a cost of at most cost, in which case false is returned. viaPt
+		// is the point the path from parentPt to pt bends at, or
+		// Point::invalidPoint() if it's straight. Costs are in the fixed point
+		// format of Cost::toFixedPoint.
+		bool tryAddPoint(Point pt, Point parentPt, Point viaPt, uint64_t cost);
+
+		// The parent and via point pt was last added with, or
+		// Point::invalidPoint() if pt isn't in the closed set.
+		Point parentOf(Point pt) const;
+		Point viaPointOf(Point pt) const;
+
+		// Records that pt is expanded towards cornerIndex at cost, unless it
+		// already was at a cost of at most cost, in which case false is
+		// returned. The steps leaving a point depend on the corner it's
+		// expanded towards, so a point is only done for one corner once it's
+		// been expanded towards it through a shortest path.
+		bool tryExpandCorner(Point pt, CornerIndex cornerIndex, uint64_t cost);
+
+		// A beam narrowed down to pt goes on straight along axis from it, so
+		// what follows only depends on pt, cornerIndex, axis and the cost.
+		// Like tryExpandCorner, but the beam is also redundant once pt was
+		// expanded towards cornerIndex at a cost of at most cost.
+		bool tryExpandBeamPoint(Point pt, CornerIndex cornerIndex, Axis2 axis, uint64_t cost);
 
 		enum class EdgeFlags : uint8_t
 		{
@@ -24,12 +47,94 @@ namespace Hierarchy
 			ALL = MIN_X | MIN_Y | MAX_X | MAX_Y,
 		};
 
+		// Marks edges of cellKey as traversed, so pointTraversed reports the
+		// points on them. Only the start cell's edges are ever closed this
+		// way, so a single cell is kept per query.
 		void addEdges(CellKey cellKey, uint8_t edges);
+
+		// The number of points added since the last clear.
+		int numPoints() const { return mNumPoints; }
+
+		// Empties the closed set in O(1), by starting a new generation. The
+		// storage stays allocated, so it's reused by the next query.
+		void clear();
 		
 	private:
 		RefPtr<const Hierarchy> mHierarchy;
 		
-		std::map<CellKey, uint8_t> mTraversedEdges;
-		std::map<Point, Point> mPointToParent;
+		// The cell addEdges was called for since the last clear, and its
+		// EdgeFlags.
+		CellKey mEdgesCellKey;
+		uint8_t mEdges;
+
+		uint32_t mGeneration;
+
+		// The parents of the points in the closed set. When the map is small
+		// enough, mPointToParent is indexed directly by the point's pixel
+		// index, otherwise it's an open addressing hash table with linear
+		// probing, keyed on the packed point. Entries of older generations
+		// are treated as empty.
+		struct ParentEntry
+		{
+			uint32_t mGeneration;
+			uint32_t mPackedPoint;
+			Point mParent;
+			Point mVia;
+			uint64_t mCost;
+		};
+
+		static_assert(sizeof(ParentEntry) == 24, "ParentEntry should stay 24 bytes");
+
+		// The cheapest expansion of each point towards each corner, always in
+		// an open addressing hash table keyed on the packed point, with the
+		// corner index in the sign bits of its coordinates, which are unused
+		// since points lie inside the map. mCosts holds the cost of the
+		// expansion itself, followed by those of the beams narrowed down to
+		// the point along each axis.
+		struct CornerEntry
+		{
+			uint32_t mGeneration;
+			uint32_t mPackedCorner;
+			uint64_t mCosts[3];
+		};
+
+		// Every PathFinder owns a closed set, so these tables are paid for
+		// per BatchPathFinder worker and per cached TiledPathFinder tile. The
+		// direct table is capped at 1.5 MB per closed set. Beyond that, the
+		// hash tables only grow with the points and corners one query
+		// reaches, at 48 and 64 bytes per entry at their maximum load.
+		static const int MAX_DIRECT_PARENT_TABLE_SIZE = 1 << 16;
+		static const int INITIAL_PARENT_HASH_TABLE_SIZE = 1 << 12;
+
+		static uint32_t packPoint(Point pt)
+		{
+			return (uint32_t)(uint16_t)pt.mX | ((uint32_t)(uint16_t)pt.mY << 16);
+		}
+
+		static uint32_t packCorner(Point pt, CornerIndex cornerIndex)
+		{
+			DIDA_ASSERT(pt.mX >= 0 && pt.mY >= 0);
+			return packPoint(pt) | (((uint32_t)cornerIndex & 1) << 15) | (((uint32_t)cornerIndex >> 1) << 31);
+		}
+
+		const ParentEntry* findParentEntry(Point pt) const;
+		ParentEntry* findParentEntry(Point pt)
+		{
+			return const_cast<ParentEntry*>(static_cast<const ClosedSet*>(this)->findParentEntry(pt));
+		}
+
+		void growParentHashTable();
+
+		bool mDirectParentTable;
+		std::vector<ParentEntry> mPointToParent;
+		int mNumPoints;
+
+		const CornerEntry* findCornerEntry(uint32_t packedCorner) const;
+		void growCornerHashTable();
+
+		bool tryImproveCorner(Point pt, CornerIndex cornerIndex, int costIndex, uint64_t cost);
+
+		std::vector<CornerEntry> mExpandedCorners;
+		int mNumExpandedCorners;
 	};
 }
\ No newline at end of file
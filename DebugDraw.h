@@ -1,12 +1,14 @@
 #pragma once
 
-#include <QPainter>
+#include <vector>
 
 #include "Utils.h"
 #include "Hierarchy.h"
 
 namespace Hierarchy
 {
+	// Records the lines a PathFinder draws while searching, for the viewer to
+	// paint, see drawDebugDraw.
 	class DebugDraw
 	{
 	public:
@@ -14,23 +16,25 @@ namespace Hierarchy
 
 		void drawLine(Point from, Point to);
 
-		void drawToPainter(QPainter& painter, float scale) const;
-
-	private:
-		const Hierarchy* mHierarchy;
-
 		struct Line
 		{
 			Point mFrom;
 			Point mTo;
 		};
-		std::vector<Line> mLines;
 
 		struct Beam
 		{
 			Point mMin;
 			Point mMax;
 		};
+
+		const std::vector<Line>& lines() const { return mLines; }
+		const std::vector<Beam>& beams() const { return mBeams; }
+
+	private:
+		const Hierarchy* mHierarchy;
+
+		std::vector<Line> mLines;
 		std::vector<Beam> mBeams;
 	};
 }
\ No newline at end of file
@@ -1,49 +1,126 @@
-#include "pch.h"
 #include "Hierarchy.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
 namespace Hierarchy
 {
-	void HierarchyLevel::initLevel0(int width, int height, const uint8_t* elevation)
+	void HierarchyLevel::setSize(int width, int height, int numPlanes)
 	{
 		mWidth = width;
 		mHeight = height;
-		int size = width * height;
-		
-		mCells.resize(size);
-		const uint8_t* curElevation = elevation;
-		Cell* curCell = mCells.data();
-		for(int i = 0; i < size; i++)
+		if(mLayout == CellLayout::MORTON)
 		{
-			if(*curElevation != 0)
-				*curCell = Cell::FULL;
-			else
-				*curCell = Cell::EMPTY;
+			mWordsPerRow = (width + TILE_SIZE - 1) >> TILE_SHIFT;
+			mNumWordRows = (height + TILE_SIZE - 1) >> TILE_SHIFT;
+		}
+		else
+		{
+			mWordsPerRow = (width + 63) >> 6;
+			mNumWordRows = height;
+		}
+
+		mNumPlanes = numPlanes;
+	}
+
+	void HierarchyLevel::resize(int width, int height, int numPlanes)
+	{
+		setSize(width, height, numPlanes);
+		mBits.assign(mWordsPerRow * mNumWordRows * numPlanes, 0);
+	}
+
+	void HierarchyLevel::setCell(Point pt, Cell cell)
+	{
+		DIDA_ASSERT(pt.mX >= 0 && pt.mX < mWidth &&
+			pt.mY >= 0 && pt.mY < mHeight);
+		DIDA_ASSERT(cell != Cell::PARTIAL || mNumPlanes > PARTIAL_PLANE);
+
+		int bitIndex;
+		uint64_t* words = mBits.data() + cellWordsOffset(pt, bitIndex);
+		uint64_t bit = 1ull << bitIndex;
+
+		words[FULL_PLANE] &= ~bit;
+		words[LEVEL_UP_PLANE] &= ~bit;
+		if(isFullCell(cell))
+			words[FULL_PLANE] |= bit;
+		if(isLevelUpCell(cell))
+			words[LEVEL_UP_PLANE] |= bit;
 
-			curElevation++;
-			curCell++;
+		if(mNumPlanes > PARTIAL_PLANE)
+		{
+			words[PARTIAL_PLANE] &= ~bit;
+			if(cell == Cell::PARTIAL)
+				words[PARTIAL_PLANE] |= bit;
+		}
+	}
+
+	void HierarchyLevel::initLevel0(int width, int height, const uint8_t* elevation)
+	{
+		resize(width, height, 2);
+		convertRows(elevation, 0, height);
+	}
+
+	void HierarchyLevel::convertRows(const uint8_t* elevation, int beginY, int endY)
+	{
+		DIDA_ASSERT(beginY % rowAlignment() == 0);
+
+		if(mLayout == CellLayout::MORTON)
+		{
+			const uint8_t* curElevation = elevation;
+			for(int y = beginY; y < endY; y++)
+			{
+				for(int x = 0; x < mWidth; x++)
+				{
+					if(*(curElevation++) != 0)
+						wordsAt(x >> TILE_SHIFT, y >> TILE_SHIFT)[FULL_PLANE] |= 1ull << mortonBit(x & (TILE_SIZE - 1), y & (TILE_SIZE - 1));
+				}
+			}
+
+			return;
+		}
+
+		for(int y = beginY; y < endY; y++)
+		{
+			const uint8_t* curElevation = elevation + (y - beginY) * mWidth;
+			for(int x = 0; x < mWidth; x += 64)
+			{
+				int numBits = std::min(mWidth - x, 64);
+				uint64_t fullBits = 0;
+				for(int i = 0; i < numBits; i++)
+				{
+					if(curElevation[i] != 0)
+						fullBits |= 1ull << i;
+				}
+
+				wordsAt(x >> 6, y)[FULL_PLANE] = fullBits;
+				curElevation += numBits;
+			}
 		}
 	}
 
 	void HierarchyLevel::initLevel0(int width, int height, const uint8_t* elevation, const uint8_t* overrides)
 	{
-		mWidth = width;
-		mHeight = height;
-		int size = width * height;
+		resize(width, height, 2);
 
-		mCells.resize(size);
 		const uint8_t* curElevation = elevation;
 		const uint8_t* curOverrides = overrides;
-		Cell* curCell = mCells.data();
-		for(int i = 0; i < size; i++)
+		for(int y = 0; y < height; y++)
 		{
-			if(*curOverrides == 0 && *curElevation != 0)
-				*curCell = Cell::FULL;
-			else
-				*curCell = Cell::EMPTY;
+			for(int x = 0; x < width; x++)
+			{
+				if(*curOverrides == 0 && *curElevation != 0)
+					setCell(Point(x, y), Cell::FULL);
 
-			curElevation++;
-			curOverrides++;
-			curCell++;
+				curElevation++;
+				curOverrides++;
+			}
 		}
 	}
 
@@ -52,205 +129,1412 @@ namespace Hierarchy
 		uint8_t merged = 0;
 		for(int i = 0; i < 4; i++)
 		{
-			merged |= (uint8_t)cells[i];
+			merged |= (uint8_t)cells[i];
+		}
+
+		if(merged == (uint8_t)Cell::EMPTY)
+			return Cell::EMPTY;
+		else if(merged == (uint8_t)Cell::FULL)
+			return Cell::FULL;
+		else
+			return Cell::PARTIAL;
+	}
+
+	void HierarchyLevel::remergeCell(HierarchyLevel& srcLevel, int x, int y)
+	{
+		// Children outside of srcLevel count as empty, like in
+		// initWithLowerLevel.
+		bool srcExists[4];
+		Cell mergeSrc[4];
+		for(int i = 0; i < 4; i++)
+		{
+			Point srcPt(2 * x + (i & 1), 2 * y + (i >> 1));
+			srcExists[i] = srcPt.mX < srcLevel.mWidth && srcPt.mY < srcLevel.mHeight;
+			if(srcExists[i])
+				mergeSrc[i] = (Cell)((uint8_t)srcLevel.cellAt(srcPt) & ~(uint8_t)Cell::LEVEL_UP_MASK);
+			else
+				mergeSrc[i] = Cell::EMPTY;
+		}
+
+		Cell merged = mergeCells(mergeSrc);
+		setCell(Point(x, y), merged);
+
+		for(int i = 0; i < 4; i++)
+		{
+			if(!srcExists[i])
+				continue;
+
+			Point srcPt(2 * x + (i & 1), 2 * y + (i >> 1));
+			if(merged == Cell::PARTIAL)
+				srcLevel.setCell(srcPt, mergeSrc[i]);
+			else
+				srcLevel.setCell(srcPt, (Cell)((uint8_t)mergeSrc[i] | (uint8_t)Cell::LEVEL_UP_MASK));
+		}
+	}
+
+	// Packs the even bits of bits into the low 32 bits of the result.
+	static inline uint64_t compressEvenBits(uint64_t bits)
+	{
+		bits &= 0x5555555555555555ull;
+		bits = (bits | (bits >> 1)) & 0x3333333333333333ull;
+		bits = (bits | (bits >> 2)) & 0x0f0f0f0f0f0f0f0full;
+		bits = (bits | (bits >> 4)) & 0x00ff00ff00ff00ffull;
+		bits = (bits | (bits >> 8)) & 0x0000ffff0000ffffull;
+		bits = (bits | (bits >> 16)) & 0x00000000ffffffffull;
+		return bits;
+	}
+
+	// The inverse of compressEvenBits, but with every bit duplicated into the
+	// odd bit after it.
+	static inline uint64_t expandToBitPairs(uint64_t bits)
+	{
+		bits &= 0x00000000ffffffffull;
+		bits = (bits | (bits << 16)) & 0x0000ffff0000ffffull;
+		bits = (bits | (bits << 8)) & 0x00ff00ff00ff00ffull;
+		bits = (bits | (bits << 4)) & 0x0f0f0f0f0f0f0f0full;
+		bits = (bits | (bits << 2)) & 0x3333333333333333ull;
+		bits = (bits | (bits << 1)) & 0x5555555555555555ull;
+		return bits | (bits << 1);
+	}
+
+	void HierarchyLevel::initWithLowerLevel(HierarchyLevel& srcLevel)
+	{
+		mLayout = srcLevel.mLayout;
+		resize((srcLevel.mWidth + 1) / 2, (srcLevel.mHeight + 1) / 2, 3);
+		mergeRows(srcLevel, 0, mHeight);
+	}
+
+	void HierarchyLevel::mergeRows(HierarchyLevel& srcLevel, int beginY, int endY)
+	{
+		if(mLayout == CellLayout::MORTON)
+		{
+			mergeMortonRows(srcLevel, beginY, endY);
+			return;
+		}
+
+		// Every destination word covers 2 source words of 2 source rows. Cells
+		// outside of srcLevel have all their bits cleared, so they count as
+		// empty.
+		for(int y = beginY; y < endY; y++)
+		{
+			int srcY0 = 2 * y;
+			int srcY1 = 2 * y + 1;
+			bool hasSrcRow1 = srcY1 < srcLevel.mHeight;
+
+			for(int wordX = 0; wordX < mWordsPerRow; wordX++)
+			{
+				uint64_t destFull = 0;
+				uint64_t destNonEmpty = 0;
+				for(int half = 0; half < 2; half++)
+				{
+					int srcWordX = 2 * wordX + half;
+					if(srcWordX >= srcLevel.mWordsPerRow)
+						break;
+
+					const uint64_t* src0 = srcLevel.wordsAt(srcWordX, srcY0);
+					uint64_t allFull = src0[FULL_PLANE];
+					uint64_t anyNonEmpty = src0[FULL_PLANE];
+					if(srcLevel.mNumPlanes > PARTIAL_PLANE)
+						anyNonEmpty |= src0[PARTIAL_PLANE];
+
+					if(hasSrcRow1)
+					{
+						const uint64_t* src1 = srcLevel.wordsAt(srcWordX, srcY1);
+						allFull &= src1[FULL_PLANE];
+						anyNonEmpty |= src1[FULL_PLANE];
+						if(srcLevel.mNumPlanes > PARTIAL_PLANE)
+							anyNonEmpty |= src1[PARTIAL_PLANE];
+					}
+					else
+					{
+						allFull = 0;
+					}
+
+					destFull |= compressEvenBits(allFull & (allFull >> 1)) << (32 * half);
+					destNonEmpty |= compressEvenBits(anyNonEmpty | (anyNonEmpty >> 1)) << (32 * half);
+				}
+
+				uint64_t* dest = wordsAt(wordX, y);
+				dest[FULL_PLANE] = destFull;
+				dest[LEVEL_UP_PLANE] = 0;
+				dest[PARTIAL_PLANE] = destNonEmpty & ~destFull;
+
+				// The source cells of uniform cells are level up cells.
+				uint64_t uniform = ~dest[PARTIAL_PLANE];
+				for(int half = 0; half < 2; half++)
+				{
+					int srcWordX = 2 * wordX + half;
+					if(srcWordX >= srcLevel.mWordsPerRow)
+						break;
+
+					uint64_t levelUp = expandToBitPairs(uniform >> (32 * half));
+					int numSrcBits = srcLevel.mWidth - (srcWordX << 6);
+					if(numSrcBits < 64)
+						levelUp &= (1ull << numSrcBits) - 1;
+
+					srcLevel.wordsAt(srcWordX, srcY0)[LEVEL_UP_PLANE] = levelUp;
+					if(hasSrcRow1)
+						srcLevel.wordsAt(srcWordX, srcY1)[LEVEL_UP_PLANE] = levelUp;
+				}
+			}
+		}
+	}
+
+	// Packs every 4th bit of bits into the low 16 bits of the result.
+	static inline uint64_t compressEvery4thBit(uint64_t bits)
+	{
+		bits &= 0x1111111111111111ull;
+		bits = (bits | (bits >> 3)) & 0x0303030303030303ull;
+		bits = (bits | (bits >> 6)) & 0x000f000f000f000full;
+		bits = (bits | (bits >> 12)) & 0x000000ff000000ffull;
+		bits = (bits | (bits >> 24)) & 0x000000000000ffffull;
+		return bits;
+	}
+
+	// The inverse of compressEvery4thBit, but with every bit duplicated into
+	// the 3 bits after it.
+	static inline uint64_t expandToBitQuads(uint64_t bits)
+	{
+		bits &= 0x000000000000ffffull;
+		bits = (bits | (bits << 24)) & 0x000000ff000000ffull;
+		bits = (bits | (bits << 12)) & 0x000f000f000f000full;
+		bits = (bits | (bits << 6)) & 0x0303030303030303ull;
+		bits = (bits | (bits << 3)) & 0x1111111111111111ull;
+		return bits * 0xf;
+	}
+
+	void HierarchyLevel::mergeMortonRows(HierarchyLevel& srcLevel, int beginY, int endY)
+	{
+		// In Z-order, the 4 children of a cell are 4 consecutive bits of a
+		// source tile, and the 4 source tiles of a tile map to its 4
+		// quarters, in Z-order as well.
+		DIDA_ASSERT(beginY % TILE_SIZE == 0);
+
+		int endWordY = (endY + TILE_SIZE - 1) >> TILE_SHIFT;
+		for(int wordY = beginY >> TILE_SHIFT; wordY < endWordY; wordY++)
+		{
+			for(int wordX = 0; wordX < mWordsPerRow; wordX++)
+			{
+				uint64_t destFull = 0;
+				uint64_t destNonEmpty = 0;
+				for(int quarter = 0; quarter < 4; quarter++)
+				{
+					int srcWordX = 2 * wordX + (quarter & 1);
+					int srcWordY = 2 * wordY + (quarter >> 1);
+					if(srcWordX >= srcLevel.mWordsPerRow || srcWordY >= srcLevel.mNumWordRows)
+						continue;
+
+					const uint64_t* src = srcLevel.wordsAt(srcWordX, srcWordY);
+					uint64_t allFull = src[FULL_PLANE];
+					uint64_t anyNonEmpty = src[FULL_PLANE];
+					if(srcLevel.mNumPlanes > PARTIAL_PLANE)
+						anyNonEmpty |= src[PARTIAL_PLANE];
+
+					allFull &= allFull >> 1;
+					allFull &= allFull >> 2;
+					anyNonEmpty |= anyNonEmpty >> 1;
+					anyNonEmpty |= anyNonEmpty >> 2;
+
+					destFull |= compressEvery4thBit(allFull) << (16 * quarter);
+					destNonEmpty |= compressEvery4thBit(anyNonEmpty) << (16 * quarter);
+				}
+
+				uint64_t* dest = wordsAt(wordX, wordY);
+				dest[FULL_PLANE] = destFull;
+				dest[LEVEL_UP_PLANE] = 0;
+				dest[PARTIAL_PLANE] = destNonEmpty & ~destFull;
+
+				uint64_t uniform = ~dest[PARTIAL_PLANE];
+				for(int quarter = 0; quarter < 4; quarter++)
+				{
+					int srcWordX = 2 * wordX + (quarter & 1);
+					int srcWordY = 2 * wordY + (quarter >> 1);
+					if(srcWordX >= srcLevel.mWordsPerRow || srcWordY >= srcLevel.mNumWordRows)
+						continue;
+
+					uint64_t levelUp = expandToBitQuads(uniform >> (16 * quarter));
+
+					// Clear the bits of cells outside of srcLevel.
+					int numSrcX = std::min(srcLevel.mWidth - (srcWordX << TILE_SHIFT), TILE_SIZE);
+					int numSrcY = std::min(srcLevel.mHeight - (srcWordY << TILE_SHIFT), TILE_SIZE);
+					if(numSrcX < TILE_SIZE || numSrcY < TILE_SIZE)
+					{
+						uint64_t inside = 0;
+						for(int y = 0; y < numSrcY; y++)
+						{
+							for(int x = 0; x < numSrcX; x++)
+								inside |= 1ull << mortonBit(x, y);
+						}
+
+						levelUp &= inside;
+					}
+
+					srcLevel.wordsAt(srcWordX, srcWordY)[LEVEL_UP_PLANE] = levelUp;
+				}
+			}
+		}
+	}
+
+	void HierarchyLevel::rotate90DegCcw()
+	{
+		HierarchyLevel rotated;
+		rotated.mLayout = mLayout;
+		rotated.resize(mHeight, mWidth, mNumPlanes);
+
+		for(int y = 0; y < mHeight; y++)
+		{
+			for(int x = 0; x < mWidth; x++)
+			{
+				rotated.setCell(Point(mHeight - y - 1, x), cellAt(Point(x, y)));
+			}
+		}
+
+		*this = std::move(rotated);
+	}
+
+	// Levels with fewer cells than this are merged on the calling thread, the
+	// cost of handing bands to the workers would outweigh the work.
+	static const int MIN_PARALLEL_LEVEL_SIZE = 1 << 16;
+
+	// The threads a build splits its levels over. The workers are started
+	// once per build and wait for the bands of each level in turn, rather
+	// than being started again for every level.
+	class BandThreads
+	{
+	public:
+		// numThreads includes the calling thread, so numThreads - 1 worker
+		// threads are started.
+		BandThreads(int numThreads)
+			: mBandIndex(0),
+			mNumBusyWorkers(0),
+			mQuit(false),
+			mFunc(nullptr),
+			mNumRows(0),
+			mRowAlignment(1),
+			mNumBands(0)
+		{
+			DIDA_ASSERT(numThreads >= 1);
+
+			for(int i = 1; i < numThreads; i++)
+				mThreads.emplace_back(&BandThreads::workerMain, this, i);
+		}
+
+		~BandThreads()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mQuit = true;
+			}
+
+			mBandsStarted.notify_all();
+
+			for(std::thread& thread : mThreads)
+				thread.join();
+		}
+
+		BandThreads(const BandThreads&) = delete;
+		BandThreads& operator = (const BandThreads&) = delete;
+
+		// Calls func(beginY, endY) for one band of rows per thread in
+		// parallel. The bands start at multiples of rowAlignment. Levels of
+		// fewer than MIN_PARALLEL_LEVEL_SIZE cells are a single band, done on
+		// the calling thread.
+		void forEachBand(int numRows, int rowAlignment, int numCells, const std::function<void(int, int)>& func)
+		{
+			int numUnits = (numRows + rowAlignment - 1) / rowAlignment;
+			int numThreads = numCells < MIN_PARALLEL_LEVEL_SIZE ? 1 : (int)mThreads.size() + 1;
+			int numBands = std::min(numThreads, numUnits);
+			if(numBands <= 1)
+			{
+				func(0, numRows);
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mFunc = &func;
+				mNumRows = numRows;
+				mRowAlignment = rowAlignment;
+				mNumBands = numBands;
+				mNumBusyWorkers = (int)mThreads.size();
+				mBandIndex++;
+			}
+
+			mBandsStarted.notify_all();
+
+			func(0, bandBegin(1));
+
+			std::unique_lock<std::mutex> lock(mMutex);
+			mBandsFinished.wait(lock, [this] { return mNumBusyWorkers == 0; });
+		}
+
+	private:
+		int bandBegin(int band) const
+		{
+			int numUnits = (mNumRows + mRowAlignment - 1) / mRowAlignment;
+			return std::min((int)((int64_t)numUnits * band / mNumBands) * mRowAlignment, mNumRows);
+		}
+
+		void workerMain(int band)
+		{
+			uint32_t lastBandIndex = 0;
+			while(true)
+			{
+				{
+					std::unique_lock<std::mutex> lock(mMutex);
+					mBandsStarted.wait(lock, [&] { return mQuit || mBandIndex != lastBandIndex; });
+					if(mQuit)
+						return;
+
+					lastBandIndex = mBandIndex;
+				}
+
+				// Workers past the number of bands of a small level sit it
+				// out.
+				if(band < mNumBands)
+					(*mFunc)(bandBegin(band), bandBegin(band + 1));
+
+				bool lastWorker;
+				{
+					std::lock_guard<std::mutex> lock(mMutex);
+					mNumBusyWorkers--;
+					lastWorker = mNumBusyWorkers == 0;
+				}
+
+				if(lastWorker)
+					mBandsFinished.notify_one();
+			}
+		}
+
+		std::vector<std::thread> mThreads;
+
+		std::mutex mMutex;
+		std::condition_variable mBandsStarted;
+		std::condition_variable mBandsFinished;
+		uint32_t mBandIndex;
+		int mNumBusyWorkers;
+		bool mQuit;
+
+		const std::function<void(int, int)>* mFunc;
+		int mNumRows;
+		int mRowAlignment;
+		int mNumBands;
+	};
+
+	Hierarchy::Hierarchy(int width, int height, const uint8_t* elevation)
+		: Hierarchy(width, height, elevation, BuildOptions())
+	{
+	}
+
+	Hierarchy::Hierarchy(int width, int height, const uint8_t* elevation, const BuildOptions& options)
+	{
+		initLevels(width, height, options);
+
+		// No level is large enough to be split when level 0 isn't.
+		BandThreads threads(width * height < MIN_PARALLEL_LEVEL_SIZE ? 1 : options.mNumThreads);
+
+		HierarchyLevel& level0 = mLevels[0];
+		threads.forEachBand(height, level0.rowAlignment(), width * height, [&](int beginY, int endY)
+		{
+			level0.convertRows(elevation + beginY * width, beginY, endY);
+		});
+
+		buildUpperLevels(options, threads);
+	}
+
+	RefPtr<Hierarchy> Hierarchy::buildFromSource(int width, int height, ElevationSource& source, const BuildOptions& options)
+	{
+		RefPtr<Hierarchy> ret;
+		ret.setNew(new Hierarchy());
+		ret->initLevels(width, height, options);
+
+		// The rows are converted as they're read, so only one band of the
+		// elevation is held in memory at a time. Bands are a multiple of the
+		// tile size, so every band starts on a new row of words.
+		HierarchyLevel& level0 = ret->mLevels[0];
+		int bandHeight = std::min(height, SOURCE_BAND_HEIGHT);
+		std::vector<uint8_t> band(width * bandHeight);
+		for(int beginY = 0; beginY < height; beginY += bandHeight)
+		{
+			int endY = std::min(beginY + bandHeight, height);
+			if(!source.readRows(band.data(), endY - beginY))
+				return nullptr;
+
+			level0.convertRows(band.data(), beginY, endY);
+		}
+
+		// Only the upper levels are split, the largest of which is level 1.
+		BandThreads threads(width * height < 4 * MIN_PARALLEL_LEVEL_SIZE ? 1 : options.mNumThreads);
+		ret->buildUpperLevels(options, threads);
+		return ret;
+	}
+
+	void Hierarchy::initLevels(int width, int height, const BuildOptions& options)
+	{
+		DIDA_ASSERT(options.mNumThreads > 0);
+		DIDA_ASSERT(width > 0 && height > 0);
+
+		mWidth = width;
+		mHeight = height;
+		mBuildAdjacency = options.mAdjacency;
+
+		int numLevels = highestSetBit(2 * std::max(width, height) - 1) + 1;
+
+		DIDA_ON_DEBUG(int fullSize = 1 << (numLevels - 1));
+		DIDA_ASSERT(width <= fullSize && width);
+		DIDA_ASSERT(height <= fullSize);
+		DIDA_ASSERT(fullSize < 2 * std::max(width, height));
+
+		mLevels.resize(numLevels);
+		HierarchyLevel& level0 = mLevels[0];
+		level0.mLayout = options.mCellLayout;
+		level0.resize(width, height, 2);
+	}
+
+	void Hierarchy::buildUpperLevels(const BuildOptions& options, BandThreads& threads)
+	{
+		// Every band of a level reads and tags its own rows of the level
+		// below it, so the bands of a level are independent.
+		for(int i = 1; i < numLevels(); i++)
+		{
+			HierarchyLevel& level = mLevels[i];
+			HierarchyLevel& srcLevel = mLevels[i - 1];
+			level.mLayout = options.mCellLayout;
+			level.resize((srcLevel.mWidth + 1) / 2, (srcLevel.mHeight + 1) / 2, 3);
+
+			threads.forEachBand(level.mHeight, level.rowAlignment(), level.mWidth * level.mHeight, [&](int beginY, int endY)
+			{
+				level.mergeRows(srcLevel, beginY, endY);
+			});
+		}
+
+		if(options.mTopLevelLookup)
+		{
+			mTopLevels.assign(mWidth * mHeight, 0);
+			fillTopLevels(Point(0, 0), Point(mWidth - 1, mHeight - 1));
+		}
+
+		buildComponents(threads);
+	}
+
+	int Hierarchy::updateRegion(int x, int y, int width, int height, const uint8_t* elevation)
+	{
+		DIDA_ASSERT(x >= 0 && y >= 0 && width > 0 && height > 0);
+		DIDA_ASSERT(x + width <= mWidth && y + height <= mHeight);
+
+		// The top level cells which change contain a pixel of the region,
+		// either before or after the update, so only the lookup entries,
+		// components and adjacency within those cells have to be updated.
+		Point dirtyMin(x, y);
+		Point dirtyMax(x + width - 1, y + height - 1);
+		auto addTopLevelCellsToDirtyRect = [&]()
+		{
+			for(int pixelY = y; pixelY < y + height; pixelY++)
+			{
+				int pixelX = x;
+				while(pixelX < x + width)
+				{
+					CellKey cellKey = climbLevelUpCells(CellKey(Point(pixelX, pixelY), 0));
+					int size = 1 << cellKey.mLevel;
+					int cellX = cellKey.mCoords.mX << cellKey.mLevel;
+					int cellY = cellKey.mCoords.mY << cellKey.mLevel;
+					dirtyMin.mX = std::min(dirtyMin.mX, (int16_t)cellX);
+					dirtyMin.mY = std::min(dirtyMin.mY, (int16_t)cellY);
+					dirtyMax.mX = std::max(dirtyMax.mX, (int16_t)std::min(cellX + size - 1, mWidth - 1));
+					dirtyMax.mY = std::max(dirtyMax.mY, (int16_t)std::min(cellY + size - 1, mHeight - 1));
+					pixelX = cellX + size;
+				}
+			}
+		};
+
+		const HierarchyLevel& level0 = mLevels[0];
+		std::vector<uint8_t> oldElevation(width * height);
+		for(int srcY = 0; srcY < height; srcY++)
+		{
+			for(int srcX = 0; srcX < width; srcX++)
+				oldElevation[srcY * width + srcX] = isFullCell(level0.cellAt(Point(x + srcX, y + srcY))) ? 255 : 0;
+		}
+
+		addTopLevelCellsToDirtyRect();
+		setRegion(x, y, width, height, elevation);
+		addTopLevelCellsToDirtyRect();
+
+		// The new cells can extend the rectangle past the old ones, so the
+		// old pixels are put back to find the old cells within all of it.
+		std::vector<CellKey> oldCells;
+		std::vector<CellKey> newCells;
+		setRegion(x, y, width, height, oldElevation.data());
+		collectTopLevelFullCells(dirtyMin, dirtyMax, oldCells);
+		setRegion(x, y, width, height, elevation);
+		collectTopLevelFullCells(dirtyMin, dirtyMax, newCells);
+
+		if(!mTopLevels.empty())
+			fillTopLevels(dirtyMin, dirtyMax);
+
+		return updateComponents(dirtyMin, dirtyMax, oldCells, newCells);
+	}
+
+	void Hierarchy::setRegion(int x, int y, int width, int height, const uint8_t* elevation)
+	{
+		HierarchyLevel& level0 = mLevels[0];
+		for(int srcY = 0; srcY < height; srcY++)
+		{
+			for(int srcX = 0; srcX < width; srcX++)
+			{
+				level0.setCell(Point(x + srcX, y + srcY), *(elevation++) != 0 ? Cell::FULL : Cell::EMPTY);
+			}
+		}
+
+		// The LEVEL_UP bits of a level are only final once the level above it
+		// is merged, so this also runs for the top level, which always has a
+		// single cell.
+		int minX = x;
+		int minY = y;
+		int maxX = x + width - 1;
+		int maxY = y + height - 1;
+		for(int levelIndex = 1; levelIndex < (int)mLevels.size(); levelIndex++)
+		{
+			minX >>= 1;
+			minY >>= 1;
+			maxX >>= 1;
+			maxY >>= 1;
+
+			for(int cellY = minY; cellY <= maxY; cellY++)
+			{
+				for(int cellX = minX; cellX <= maxX; cellX++)
+				{
+					mLevels[levelIndex].remergeCell(mLevels[levelIndex - 1], cellX, cellY);
+				}
+			}
+		}
+	}
+
+	void Hierarchy::collectTopLevelFullCells(Point minPt, Point maxPt, std::vector<CellKey>& fullCells) const
+	{
+		// The top level has a single cell, and the children of partial cells
+		// are never level up cells.
+		std::vector<CellKey> stack;
+		stack.push_back(CellKey(Point(0, 0), (uint8_t)(numLevels() - 1)));
+		while(!stack.empty())
+		{
+			CellKey cellKey = stack.back();
+			stack.pop_back();
+
+			Point cellMin = cellKey.corner(CornerIndex::MIN_X_MIN_Y);
+			Point cellMax = cellKey.corner(CornerIndex::MAX_X_MAX_Y);
+			if(cellMax.mX < minPt.mX || cellMin.mX > maxPt.mX || cellMax.mY < minPt.mY || cellMin.mY > maxPt.mY)
+				continue;
+
+			Cell cell = cellAt(cellKey);
+			if(cell == Cell::FULL)
+			{
+				fullCells.push_back(cellKey);
+			}
+			else if(cell == Cell::PARTIAL)
+			{
+				for(int child = 0; child < 4; child++)
+				{
+					CellKey childKey = cellKey;
+					childKey.mCoords <<= 1;
+					childKey.mCoords.mX += child & 1;
+					childKey.mCoords.mY += child >> 1;
+					childKey.mLevel--;
+					stack.push_back(childKey);
+				}
+			}
+		}
+	}
+
+	int Hierarchy::updateComponents(Point minPt, Point maxPt, std::vector<CellKey>& oldCells, std::vector<CellKey>& newCells)
+	{
+		auto packedLess = [](CellKey a, CellKey b)
+		{
+			return a.packed() < b.packed();
+		};
+
+		std::sort(oldCells.begin(), oldCells.end(), packedLess);
+		std::sort(newCells.begin(), newCells.end(), packedLess);
+
+		// Cells which are in both lists haven't changed.
+		std::vector<CellKey> removedCells;
+		std::vector<CellKey> addedCells;
+		std::set_difference(oldCells.begin(), oldCells.end(), newCells.begin(), newCells.end(), std::back_inserter(removedCells), packedLess);
+		std::set_difference(newCells.begin(), newCells.end(), oldCells.begin(), oldCells.end(), std::back_inserter(addedCells), packedLess);
+
+		int numCellsLookedAt = (int)(oldCells.size() + newCells.size());
+
+		std::vector<uint32_t> splitComponents;
+		for(CellKey cellKey : removedCells)
+		{
+			ComponentEntry* entry = findComponentEntry(cellKey.packed());
+			splitComponents.push_back(entry->mComponent);
+			removeComponentEntry(entry);
+		}
+
+		for(CellKey cellKey : addedCells)
+			insertComponentEntry(cellKey);
+
+		// Every pair of connected cells is seen by whichever of them is
+		// given its component last, which merges their components.
+		for(CellKey cellKey : addedCells)
+		{
+			uint32_t component = NO_COMPONENT;
+			forEachConnectedCell(cellKey, [&](CellKey connectedCellKey)
+			{
+				numCellsLookedAt++;
+
+				uint32_t connectedComponent = findComponentEntry(connectedCellKey.packed())->mComponent;
+				if(connectedComponent == NO_COMPONENT)
+					return;
+
+				connectedComponent = rootComponent(connectedComponent);
+				if(component == NO_COMPONENT)
+				{
+					component = connectedComponent;
+				}
+				else if(component != connectedComponent)
+				{
+					mComponentParents[std::max(component, connectedComponent)] = std::min(component, connectedComponent);
+					component = std::min(component, connectedComponent);
+				}
+			});
+
+			findComponentEntry(cellKey.packed())->mComponent = component != NO_COMPONENT ? component : newComponent();
+		}
+
+		for(uint32_t& component : splitComponents)
+			component = rootComponent(component);
+
+		std::sort(splitComponents.begin(), splitComponents.end());
+		splitComponents.erase(std::unique(splitComponents.begin(), splitComponents.end()), splitComponents.end());
+
+		// Every cell which used to be connected to a removed cell is in the
+		// rectangle or around it, so each piece a component can be split into
+		// contains one of those cells.
+		std::vector<CellKey> boundaryCells = newCells;
+		forEachCellAroundRect(minPt, maxPt, [&](CellKey cellKey)
+		{
+			numCellsLookedAt++;
+			if(cellAt(cellKey) == Cell::FULL)
+				boundaryCells.push_back(cellKey);
+		});
+
+		std::sort(boundaryCells.begin(), boundaryCells.end(), packedLess);
+		boundaryCells.erase(std::unique(boundaryCells.begin(), boundaryCells.end()), boundaryCells.end());
+
+		// A search is started from each of the boundary cells of a component
+		// which may be split, and they take turns visiting a cell each.
+		// Searches which meet are merged, and a search which runs out of
+		// cells has found a whole piece, which is given a new component. Once
+		// a single search is left, its piece keeps the component, so only the
+		// smaller pieces are walked in full.
+		struct Search
+		{
+			uint32_t mMergedInto;
+			size_t mNumVisited;
+			std::vector<CellKey> mCells;
+		};
+
+		for(uint32_t splitComponent : splitComponents)
+		{
+			std::vector<Search> searches;
+			std::unordered_map<uint64_t, uint32_t> searchOfCell;
+			for(CellKey cellKey : boundaryCells)
+			{
+				if(rootComponent(findComponentEntry(cellKey.packed())->mComponent) != splitComponent)
+					continue;
+
+				searchOfCell.emplace(cellKey.packed(), (uint32_t)searches.size());
+				searches.push_back(Search{ (uint32_t)searches.size(), 0, { cellKey } });
+			}
+
+			auto rootSearch = [&](uint32_t search)
+			{
+				while(searches[search].mMergedInto != search)
+					search = searches[search].mMergedInto;
+
+				return search;
+			};
+
+			int numActive = (int)searches.size();
+			while(numActive > 1)
+			{
+				for(uint32_t searchIndex = 0; searchIndex < (uint32_t)searches.size() && numActive > 1; searchIndex++)
+				{
+					Search& search = searches[searchIndex];
+					if(search.mMergedInto != searchIndex || search.mNumVisited == search.mCells.size())
+						continue;
+
+					CellKey cellKey = search.mCells[search.mNumVisited++];
+					forEachConnectedCell(cellKey, [&](CellKey connectedCellKey)
+					{
+						numCellsLookedAt++;
+
+						auto inserted = searchOfCell.emplace(connectedCellKey.packed(), searchIndex);
+						if(inserted.second)
+						{
+							search.mCells.push_back(connectedCellKey);
+							return;
+						}
+
+						// The cells visited by the merged search stay at the
+						// front, so they aren't visited again.
+						uint32_t otherIndex = rootSearch(inserted.first->second);
+						if(otherIndex == searchIndex)
+							return;
+
+						Search& other = searches[otherIndex];
+						std::vector<CellKey> cells(other.mCells.begin(), other.mCells.begin() + other.mNumVisited);
+						cells.insert(cells.end(), search.mCells.begin(), search.mCells.begin() + search.mNumVisited);
+						cells.insert(cells.end(), other.mCells.begin() + other.mNumVisited, other.mCells.end());
+						cells.insert(cells.end(), search.mCells.begin() + search.mNumVisited, search.mCells.end());
+						search.mNumVisited += other.mNumVisited;
+						search.mCells.swap(cells);
+
+						other.mMergedInto = searchIndex;
+						other.mCells.clear();
+						other.mCells.shrink_to_fit();
+						numActive--;
+					});
+
+					if(search.mNumVisited == search.mCells.size())
+					{
+						uint32_t component = newComponent();
+						for(CellKey pieceCellKey : search.mCells)
+							findComponentEntry(pieceCellKey.packed())->mComponent = component;
+
+						numActive--;
+					}
+				}
+			}
+		}
+
+		if(mBuildAdjacency)
+		{
+			// The cells in the rectangle, and those around it which have an
+			// edge along it, are given new adjacent cells.
+			for(CellKey cellKey : boundaryCells)
+				appendAdjacency(cellKey);
+
+			numCellsLookedAt += (int)boundaryCells.size();
+
+			size_t numIndices = (mAdjacencyOffsets.size() - 1) / 4;
+			if(numIndices > 2 * (size_t)mNumFullCells + 1024)
+				compactAdjacency();
+		}
+
+		return numCellsLookedAt;
+	}
+
+	uint32_t Hierarchy::componentOf(CellKey topLevelCellKey) const
+	{
+		DIDA_ASSERT(cellAt(topLevelCellKey) == Cell::FULL);
+
+		const ComponentEntry* entry = findComponentEntry(topLevelCellKey.packed());
+		DIDA_ASSERT(entry->mPackedCellKey != EMPTY_COMPONENT_KEY);
+
+		uint32_t component = entry->mComponent;
+		while(mComponentParents[component] != component)
+			component = mComponentParents[component];
+
+		return component;
+	}
+
+	uint32_t Hierarchy::rootComponent(uint32_t component)
+	{
+		// Path halving, as in findComponentRoot.
+		while(mComponentParents[component] != component)
+		{
+			mComponentParents[component] = mComponentParents[mComponentParents[component]];
+			component = mComponentParents[component];
+		}
+
+		return component;
+	}
+
+	uint32_t Hierarchy::newComponent()
+	{
+		uint32_t component = (uint32_t)mComponentParents.size();
+		mComponentParents.push_back(component);
+		return component;
+	}
+
+	const Hierarchy::ComponentEntry* Hierarchy::findComponentEntry(uint64_t packedCellKey) const
+	{
+		// Fibonacci hashing, taking the index from the high bits of the
+		// product.
+		size_t mask = mComponents.size() - 1;
+		size_t index = (size_t)((packedCellKey * 0x9e3779b97f4a7c15ull) >> mComponentTableShift);
+		while(true)
+		{
+			const ComponentEntry* entry = &mComponents[index];
+			if(entry->mPackedCellKey == packedCellKey || entry->mPackedCellKey == EMPTY_COMPONENT_KEY)
+				return entry;
+
+			index = (index + 1) & mask;
+		}
+	}
+
+	Hierarchy::ComponentEntry* Hierarchy::insertComponentEntry(CellKey cellKey)
+	{
+		// Keep the load factor at or below 1/2, like buildComponents does.
+		if(2 * ((size_t)mNumFullCells + 1) > mComponents.size())
+		{
+			MappableArray<ComponentEntry> oldTable = std::move(mComponents);
+
+			ComponentEntry emptyEntry;
+			emptyEntry.mPackedCellKey = EMPTY_COMPONENT_KEY;
+			emptyEntry.mComponent = 0;
+			emptyEntry.mCellIndex = 0;
+
+			mComponents.assign(oldTable.size() * 2, emptyEntry);
+			mComponentTableShift--;
+
+			for(size_t i = 0; i < oldTable.size(); i++)
+			{
+				const ComponentEntry& oldEntry = static_cast<const MappableArray<ComponentEntry>&>(oldTable)[i];
+				if(oldEntry.mPackedCellKey != EMPTY_COMPONENT_KEY)
+					*findComponentEntry(oldEntry.mPackedCellKey) = oldEntry;
+			}
+		}
+
+		ComponentEntry* entry = findComponentEntry(cellKey.packed());
+		DIDA_ASSERT(entry->mPackedCellKey == EMPTY_COMPONENT_KEY);
+		entry->mPackedCellKey = cellKey.packed();
+		entry->mComponent = NO_COMPONENT;
+		entry->mCellIndex = 0;
+		mNumFullCells++;
+		return entry;
+	}
+
+	void Hierarchy::removeComponentEntry(ComponentEntry* entry)
+	{
+		// Backward shift deletion. The entries after the hole move into it,
+		// unless they'd move in front of the slot they hash to, so the probe
+		// sequences don't need tombstones.
+		ComponentEntry* entries = mComponents.data();
+		size_t mask = mComponents.size() - 1;
+		size_t hole = entry - entries;
+		size_t index = hole;
+		while(true)
+		{
+			index = (index + 1) & mask;
+			if(entries[index].mPackedCellKey == EMPTY_COMPONENT_KEY)
+				break;
+
+			size_t home = (size_t)((entries[index].mPackedCellKey * 0x9e3779b97f4a7c15ull) >> mComponentTableShift);
+			if(((index - home) & mask) >= ((index - hole) & mask))
+			{
+				entries[hole] = entries[index];
+				hole = index;
+			}
+		}
+
+		entries[hole].mPackedCellKey = EMPTY_COMPONENT_KEY;
+		mNumFullCells--;
+	}
+
+	static uint32_t findComponentRoot(std::vector<uint32_t>& parents, uint32_t i)
+	{
+		while(parents[i] != i)
+		{
+			parents[i] = parents[parents[i]];
+			i = parents[i];
 		}
 
-		if(merged == (uint8_t)Cell::EMPTY)
-			return Cell::EMPTY;
-		else if(merged == (uint8_t)Cell::FULL)
-			return Cell::FULL;
-		else
-			return Cell::PARTIAL;
+		return i;
 	}
 
-	void HierarchyLevel::initWithLowerLevel(HierarchyLevel& srcLevel)
+	// The full cells found by scanning a band of rows of level 0, with
+	// their own union-find. Cells which start above the band are found again
+	// on its first row, so the cells of its first and last row are kept to
+	// unite them across the seams with the neighboring bands.
+	struct ComponentBand
+	{
+		static const uint32_t NO_CELL = ~0u;
+
+		int mBeginY;
+		std::vector<CellKey> mCells;
+		std::vector<uint8_t> mStartsInBand;
+		std::vector<uint32_t> mParents;
+		std::vector<uint32_t> mFirstRow;
+		std::vector<uint32_t> mLastRow;
+	};
+
+	// Scans the band row by row, finding the top level cell of every run of
+	// pixels, and unions the full cells of pixels which are 8-connected to a
+	// pixel of the previous row or the previous run. A cell is numbered when
+	// the first of its rows in the band is scanned, and the number is kept in
+	// rowCellIndices of its level until the scan moves past its bottom row,
+	// so no cell lookup is needed.
+	static void scanComponentBand(const Hierarchy& hierarchy, int beginY, int endY, ComponentBand& band)
 	{
-		mWidth = (srcLevel.mWidth + 1) / 2;
-		mHeight = (srcLevel.mHeight + 1) / 2;
-		int size = mWidth * mHeight;
+		static const uint32_t NO_CELL = ComponentBand::NO_CELL;
+
+		int width = hierarchy.width();
+		band.mBeginY = beginY;
+
+		std::vector<std::vector<uint32_t>> rowCellIndices(hierarchy.numLevels());
+		for(int levelIndex = 0; levelIndex < hierarchy.numLevels(); levelIndex++)
+			rowCellIndices[levelIndex].resize(hierarchy.level(levelIndex).width());
+
+		std::vector<uint32_t> prevRow(width, NO_CELL);
+		std::vector<uint32_t> curRow(width);
+
+		auto unite = [&](uint32_t a, uint32_t b)
+		{
+			if(a == NO_CELL || b == NO_CELL || a == b)
+				return;
 
-		int roundedDownWidth = srcLevel.mWidth / 2;
-		int roundedDownHeight = srcLevel.mHeight / 2;
+			a = findComponentRoot(band.mParents, a);
+			b = findComponentRoot(band.mParents, b);
+			if(a != b)
+				band.mParents[std::max(a, b)] = std::min(a, b);
+		};
 
-		mCells.resize(size);
-		Cell* curCell = mCells.data();
-		Cell* srcCellsOrig = srcLevel.mCells.data();
-		for(int y = 0; y < roundedDownHeight; y++)
+		for(int y = beginY; y < endY; y++)
 		{
-			for(int x = 0; x < roundedDownWidth; x++)
+			int x = 0;
+			while(x < width)
 			{
-				Cell* srcCells[] = 
+				CellKey cellKey = hierarchy.topLevelCellContainingPoint(Point(x, y));
+				int runEnd = std::min((cellKey.mCoords.mX + 1) << cellKey.mLevel, width);
+
+				uint32_t cellIndex = NO_CELL;
+				if(hierarchy.cellAt(cellKey) == Cell::FULL)
 				{
-					srcCellsOrig,
-					(srcCellsOrig + 1),
-					(srcCellsOrig + srcLevel.mWidth),
-					(srcCellsOrig + srcLevel.mWidth + 1),
-				};
+					uint32_t& rowCellIndex = rowCellIndices[cellKey.mLevel][cellKey.mCoords.mX];
+					bool topRow = (y & ((1 << cellKey.mLevel) - 1)) == 0;
+					if(topRow || y == beginY)
+					{
+						rowCellIndex = (uint32_t)band.mCells.size();
+						band.mCells.push_back(cellKey);
+						band.mStartsInBand.push_back(topRow);
+						band.mParents.push_back(rowCellIndex);
+					}
 
-				uint8_t merged = 0;
-				for(Cell* srcCell : srcCells)
-					merged |= (uint8_t)*srcCell;
+					cellIndex = rowCellIndex;
 
-				if(merged == (uint8_t)Cell::EMPTY)
-				{
-					*curCell = Cell::EMPTY;
+					if(x > 0)
+						unite(cellIndex, curRow[x - 1]);
 
-					for(Cell* srcCell : srcCells)
-						*srcCell = Cell::LEVEL_UP_EMPTY;
+					if(y > beginY)
+					{
+						// Below the top row of a cell, the pixels above the
+						// run belong to the cell itself.
+						int prevBegin = std::max(x - 1, 0);
+						int prevEnd = std::min(runEnd + 1, width);
+						if(topRow)
+						{
+							for(int prevX = prevBegin; prevX < prevEnd; prevX++)
+								unite(cellIndex, prevRow[prevX]);
+						}
+						else
+						{
+							unite(cellIndex, prevRow[prevBegin]);
+							unite(cellIndex, prevRow[prevEnd - 1]);
+						}
+					}
 				}
-				else if(merged == (uint8_t)Cell::FULL)
-				{
-					*curCell = Cell::FULL;
 
-					for(Cell* srcCell : srcCells)
-						*srcCell = Cell::LEVEL_UP_FULL;
-				}
-				else
-				{
-					*curCell = Cell::PARTIAL;
-				}
-				
-				curCell++;
-				srcCellsOrig += 2;
+				std::fill(curRow.begin() + x, curRow.begin() + runEnd, cellIndex);
+				x = runEnd;
 			}
 
-			if(roundedDownWidth != mWidth)
-			{
-				Cell* srcCells[] = 
-				{
-					srcCellsOrig,
-					(srcCellsOrig + srcLevel.mWidth),
-				};
-
-				uint8_t merged = (uint8_t)Cell::EMPTY;
-				for(Cell* srcCell : srcCells)
-					merged |= (uint8_t)*srcCell;
-				
-				if(merged == (uint8_t)Cell::EMPTY)
-				{
-					*curCell = Cell::EMPTY;
-					for(Cell* srcCell : srcCells)
-						*srcCell = Cell::LEVEL_UP_EMPTY;
-				}
-				else
-				{
-					*curCell = Cell::PARTIAL;
-				}
+			if(y == beginY)
+				band.mFirstRow = curRow;
 
-				curCell++;
-				srcCellsOrig++;
-			}
+			prevRow.swap(curRow);
+		}
+
+		band.mLastRow.swap(prevRow);
+	}
+
+	void Hierarchy::buildComponents(BandThreads& threads)
+	{
+		// The bands are scanned in parallel, and then merged into a single
+		// union-find, in which the cells of a band follow those of the band
+		// above it.
+		std::vector<ComponentBand> bands;
+		std::mutex bandsMutex;
+		threads.forEachBand(mHeight, 1, mWidth * mHeight, [&](int beginY, int endY)
+		{
+			ComponentBand band;
+			scanComponentBand(*this, beginY, endY, band);
+
+			std::lock_guard<std::mutex> lock(bandsMutex);
+			bands.push_back(std::move(band));
+		});
+
+		std::sort(bands.begin(), bands.end(), [](const ComponentBand& a, const ComponentBand& b)
+		{
+			return a.mBeginY < b.mBeginY;
+		});
 
-			srcCellsOrig += srcLevel.mWidth;
+		std::vector<uint32_t> parents;
+		std::vector<uint32_t> bandOffsets;
+		for(const ComponentBand& band : bands)
+		{
+			uint32_t offset = (uint32_t)parents.size();
+			bandOffsets.push_back(offset);
+			for(uint32_t parent : band.mParents)
+				parents.push_back(parent + offset);
 		}
 
-		if(roundedDownHeight != mHeight)
+		auto unite = [&](uint32_t a, uint32_t b)
 		{
-			for(int x = 0; x < roundedDownWidth; x++)
-			{
-				Cell* srcCells[] = 
-				{
-					srcCellsOrig,
-					srcCellsOrig + 1,
-				};
+			a = findComponentRoot(parents, a);
+			b = findComponentRoot(parents, b);
+			if(a != b)
+				parents[std::max(a, b)] = std::min(a, b);
+		};
 
-				uint8_t merged = (uint8_t)Cell::EMPTY;
-				for(Cell* srcCell : srcCells)
-					merged |= (uint8_t)*srcCell;
+		// A cell crossing a seam is numbered in both bands, and its two
+		// numbers are united like those of any other 8-connected pixels.
+		for(size_t bandIndex = 1; bandIndex < bands.size(); bandIndex++)
+		{
+			const std::vector<uint32_t>& aboveRow = bands[bandIndex - 1].mLastRow;
+			const std::vector<uint32_t>& row = bands[bandIndex].mFirstRow;
+			uint32_t aboveOffset = bandOffsets[bandIndex - 1];
+			uint32_t offset = bandOffsets[bandIndex];
+			for(int x = 0; x < mWidth; x++)
+			{
+				if(row[x] == ComponentBand::NO_CELL)
+					continue;
 
-				if(merged == (uint8_t)Cell::EMPTY)
-				{
-					*curCell = Cell::EMPTY;
-					for(Cell* srcCell : srcCells)
-						*srcCell = Cell::LEVEL_UP_EMPTY;
-				}
-				else
+				for(int aboveX = std::max(x - 1, 0); aboveX < std::min(x + 2, mWidth); aboveX++)
 				{
-					*curCell = Cell::PARTIAL;
+					if(aboveRow[aboveX] != ComponentBand::NO_CELL)
+						unite(row[x] + offset, aboveRow[aboveX] + aboveOffset);
 				}
+			}
+		}
 
-				curCell++;
-				srcCellsOrig += 2;
+		std::vector<CellKey> fullCells;
+		for(const ComponentBand& band : bands)
+		{
+			for(size_t i = 0; i < band.mCells.size(); i++)
+			{
+				if(band.mStartsInBand[i])
+					fullCells.push_back(band.mCells[i]);
 			}
+		}
+
+		// Roots always have the smallest index of their component, so labels
+		// can be assigned in a single pass.
+		int tableBits = 4;
+		while(((size_t)1 << tableBits) < 2 * fullCells.size())
+			tableBits++;
 
-			if(roundedDownWidth != mWidth)
+		ComponentEntry emptyEntry;
+		emptyEntry.mPackedCellKey = EMPTY_COMPONENT_KEY;
+		emptyEntry.mComponent = 0;
+		emptyEntry.mCellIndex = 0;
+
+		mComponents.assign((size_t)1 << tableBits, emptyEntry);
+		mComponentTableShift = 64 - tableBits;
+
+		std::vector<uint32_t> labels(parents.size());
+		uint32_t numComponents = 0;
+		uint32_t cellIndex = 0;
+		for(size_t bandIndex = 0; bandIndex < bands.size(); bandIndex++)
+		{
+			const ComponentBand& band = bands[bandIndex];
+			for(uint32_t i = 0; i < (uint32_t)band.mCells.size(); i++)
 			{
-				if(*srcCellsOrig == Cell::EMPTY)
-				{
-					*curCell = Cell::EMPTY;
-					*srcCellsOrig = Cell::LEVEL_UP_EMPTY;
-				}
+				uint32_t index = bandOffsets[bandIndex] + i;
+				uint32_t root = findComponentRoot(parents, index);
+				if(root == index)
+					labels[index] = numComponents++;
 				else
-				{
-					*curCell = Cell::PARTIAL;
-				}
+					labels[index] = labels[root];
+
+				if(!band.mStartsInBand[i])
+					continue;
+
+				CellKey cellKey = band.mCells[i];
+				ComponentEntry* entry = findComponentEntry(cellKey.packed());
+				entry->mPackedCellKey = cellKey.packed();
+				entry->mComponent = labels[index];
+				entry->mCellIndex = cellIndex++;
 			}
 		}
+
+		mNumFullCells = (uint32_t)fullCells.size();
+
+		std::vector<uint32_t> componentParents(numComponents);
+		for(uint32_t i = 0; i < numComponents; i++)
+			componentParents[i] = i;
+
+		mComponentParents.assign(std::move(componentParents));
+
+		// The adjacency is indexed like the component table, so it's rebuilt
+		// along with it.
+		if(mBuildAdjacency)
+			buildAdjacency(fullCells);
 	}
 
-	void HierarchyLevel::rotate90DegCcw()
+	bool Hierarchy::adjacentCells(CellKey cellKey, EdgeIndex edge, const AdjacentCell*& begin, const AdjacentCell*& end) const
 	{
-		std::vector<Cell> rotatedCells;
-		rotatedCells.resize(mWidth * mHeight);
+		if(mAdjacencyOffsets.empty())
+			return false;
 
-		const Cell* src = mCells.data();
-		for(int y = 0; y < mHeight; y++)
+		const ComponentEntry* entry = findComponentEntry(cellKey.packed());
+		if(entry->mPackedCellKey == EMPTY_COMPONENT_KEY)
+			return false;
+
+		const uint32_t* offsets = mAdjacencyOffsets.data() + 4 * entry->mCellIndex + (int)edge;
+		begin = mAdjacentCells.data() + offsets[0];
+		end = mAdjacentCells.data() + offsets[1];
+		return true;
+	}
+
+	size_t Hierarchy::memoryUsage() const
+	{
+		size_t ret = mTopLevels.size() * sizeof(uint8_t);
+		for(const HierarchyLevel& level : mLevels)
+			ret += level.mBits.size() * sizeof(uint64_t);
+
+		ret += mComponents.size() * sizeof(ComponentEntry);
+		ret += mComponentParents.size() * sizeof(uint32_t);
+		ret += mAdjacencyOffsets.size() * sizeof(uint32_t);
+		ret += mAdjacentCells.size() * sizeof(AdjacentCell);
+		return ret;
+	}
+
+	void Hierarchy::buildAdjacency(const std::vector<CellKey>& fullCells)
+	{
+		// Leaves room for the indices and cells updateRegion appends, so its
+		// first edits don't copy the whole arrays.
+		std::vector<uint32_t> offsets;
+		offsets.reserve(4 * (fullCells.size() + fullCells.size() / 8) + 1);
+		std::vector<AdjacentCell> adjCells;
+
+		for(CellKey cellKey : fullCells)
 		{
-			Cell* dest = rotatedCells.data() + mHeight - y - 1;
-			for(int x = 0; x < mWidth; x++)
-			{
-				*dest = *(src++);
-				dest += mHeight;
-			}
+			offsets.push_back((uint32_t)adjCells.size());
+			appendAdjacentCells<EdgeIndex::MIN_X>(cellKey, adjCells);
+			offsets.push_back((uint32_t)adjCells.size());
+			appendAdjacentCells<EdgeIndex::MIN_Y>(cellKey, adjCells);
+			offsets.push_back((uint32_t)adjCells.size());
+			appendAdjacentCells<EdgeIndex::MAX_X>(cellKey, adjCells);
+			offsets.push_back((uint32_t)adjCells.size());
+			appendAdjacentCells<EdgeIndex::MAX_Y>(cellKey, adjCells);
 		}
 
-		mCells = std::move(rotatedCells);
-		std::swap(mWidth, mHeight);
+		offsets.push_back((uint32_t)adjCells.size());
+
+		std::vector<AdjacentCell> reservedAdjCells;
+		reservedAdjCells.reserve(adjCells.size() + adjCells.size() / 8);
+		reservedAdjCells.assign(adjCells.begin(), adjCells.end());
+		adjCells.swap(reservedAdjCells);
+
+		mAdjacencyOffsets.assign(std::move(offsets));
+		mAdjacentCells.assign(std::move(adjCells));
 	}
 
-	Hierarchy::Hierarchy(int width, int height, const uint8_t* elevation)
-		: mWidth(width),
-		mHeight(height)
+	void Hierarchy::appendAdjacency(CellKey cellKey)
 	{
-		DIDA_ASSERT(width > 0 && height > 0);
+		std::vector<AdjacentCell> adjCells;
+		appendAdjacentCells<EdgeIndex::MIN_X>(cellKey, adjCells);
+		uint32_t minYOffset = (uint32_t)adjCells.size();
+		appendAdjacentCells<EdgeIndex::MIN_Y>(cellKey, adjCells);
+		uint32_t maxXOffset = (uint32_t)adjCells.size();
+		appendAdjacentCells<EdgeIndex::MAX_X>(cellKey, adjCells);
+		uint32_t maxYOffset = (uint32_t)adjCells.size();
+		appendAdjacentCells<EdgeIndex::MAX_Y>(cellKey, adjCells);
+
+		// The last offset already is where the new index starts.
+		uint32_t begin = (uint32_t)mAdjacentCells.size();
+		findComponentEntry(cellKey.packed())->mCellIndex = (uint32_t)(mAdjacencyOffsets.size() - 1) / 4;
+		mAdjacencyOffsets.push_back(begin + minYOffset);
+		mAdjacencyOffsets.push_back(begin + maxXOffset);
+		mAdjacencyOffsets.push_back(begin + maxYOffset);
+		mAdjacencyOffsets.push_back(begin + (uint32_t)adjCells.size());
+
+		for(const AdjacentCell& adjCell : adjCells)
+			mAdjacentCells.push_back(adjCell);
+	}
+
+	void Hierarchy::compactAdjacency()
+	{
+		std::vector<std::pair<uint32_t, CellKey>> cells;
+		cells.reserve(mNumFullCells);
+		for(size_t i = 0; i < mComponents.size(); i++)
+		{
+			const ComponentEntry& entry = static_cast<const MappableArray<ComponentEntry>&>(mComponents)[i];
+			if(entry.mPackedCellKey == EMPTY_COMPONENT_KEY)
+				continue;
+
+			CellKey cellKey(Point((int16_t)(entry.mPackedCellKey & 0xffff), (int16_t)((entry.mPackedCellKey >> 16) & 0xffff)), (uint8_t)(entry.mPackedCellKey >> 32));
+			cells.emplace_back(entry.mCellIndex, cellKey);
+		}
+
+		// Kept in the order of their old indices, which is mostly the order
+		// buildComponents found them in.
+		std::sort(cells.begin(), cells.end(), [](const std::pair<uint32_t, CellKey>& a, const std::pair<uint32_t, CellKey>& b)
+		{
+			return a.first < b.first;
+		});
+
+		std::vector<CellKey> fullCells;
+		fullCells.reserve(cells.size());
+		for(const std::pair<uint32_t, CellKey>& cell : cells)
+		{
+			findComponentEntry(cell.second.packed())->mCellIndex = (uint32_t)fullCells.size();
+			fullCells.push_back(cell.second);
+		}
+
+		buildAdjacency(fullCells);
+	}
 
-		unsigned long numLevels;
-		if(width > height)
+	template <EdgeIndex edge, class Func>
+	void Hierarchy::forEachAdjacentCell(CellKey cellKey, Func func) const
+	{
+		constexpr Axis2 normalAxis = (Axis2)((int8_t)edge & 1);
+		constexpr Axis2 parallelAxis = otherAxis(normalAxis);
+		constexpr int8_t edgeSide = (int8_t)edge >> 1;
+
+		// The boundary of the neighbor facing the edge, walked towards the
+		// positive side of parallelAxis.
+		constexpr CornerIndex startCorner = (CornerIndex)((1 - edgeSide) << (int8_t)normalAxis);
+
+		CellKey neighborCellKey = cellKey;
+		neighborCellKey.mCoords[normalAxis] += 2 * edgeSide - 1;
+
+		const HierarchyLevel& level = mLevels[cellKey.mLevel];
+		int16_t neighborCoord = neighborCellKey.mCoords[normalAxis];
+		int16_t levelSize = normalAxis == Axis2::X ? level.mWidth : level.mHeight;
+		if(neighborCoord < 0 || neighborCoord >= levelSize)
+			return;
+
+		if(cellAt(neighborCellKey) == Cell::PARTIAL)
 		{
-			_BitScanReverse(&numLevels, 2 * width - 1);
+			BoundaryCellIterator<startCorner, parallelAxis> it(this, neighborCellKey);
+			while(it.moveNext())
+				func(it.cell());
 		}
 		else
 		{
-			_BitScanReverse(&numLevels, 2 * height - 1);
+			func(topLevelCellContaining(neighborCellKey));
 		}
-		numLevels++;
+	}
 
-		DIDA_ON_DEBUG(int fullSize = 1 << (numLevels - 1));
-		DIDA_ASSERT(width <= fullSize && width);
-		DIDA_ASSERT(height <= fullSize);
-		DIDA_ASSERT(fullSize < 2 * std::max(width, height));
+	template <class Func>
+	void Hierarchy::forEachConnectedCell(CellKey cellKey, Func func) const
+	{
+		auto funcIfFull = [&](CellKey adjCellKey)
+		{
+			if(cellAt(adjCellKey) == Cell::FULL)
+				func(adjCellKey);
+		};
 
-		mLevels.resize(numLevels);
-		mLevels[0].initLevel0(width, height, elevation);
-		for(int i = 1; i < numLevels; i++)
+		forEachAdjacentCell<EdgeIndex::MIN_X>(cellKey, funcIfFull);
+		forEachAdjacentCell<EdgeIndex::MIN_Y>(cellKey, funcIfFull);
+		forEachAdjacentCell<EdgeIndex::MAX_X>(cellKey, funcIfFull);
+		forEachAdjacentCell<EdgeIndex::MAX_Y>(cellKey, funcIfFull);
+
+		// The pixels only connected through a corner.
+		Point min = cellKey.corner(CornerIndex::MIN_X_MIN_Y);
+		Point max = cellKey.corner(CornerIndex::MAX_X_MAX_Y);
+		for(int corner = 0; corner < 4; corner++)
+		{
+			int cornerX = (corner & 1) ? max.mX + 1 : min.mX - 1;
+			int cornerY = (corner >> 1) ? max.mY + 1 : min.mY - 1;
+			if(cornerX >= 0 && cornerX < mWidth && cornerY >= 0 && cornerY < mHeight)
+				funcIfFull(topLevelCellContainingPoint(Point(cornerX, cornerY)));
+		}
+	}
+
+	template <class Func>
+	void Hierarchy::forEachCellAroundRect(Point minPt, Point maxPt, Func func) const
+	{
+		// The rows above and below include the corners.
+		int rowMinX = std::max(minPt.mX - 1, 0);
+		int rowMaxX = std::min(maxPt.mX + 1, mWidth - 1);
+		for(int y : { minPt.mY - 1, maxPt.mY + 1 })
+		{
+			if(y < 0 || y >= mHeight)
+				continue;
+
+			int x = rowMinX;
+			while(x <= rowMaxX)
+			{
+				CellKey cellKey = topLevelCellContainingPoint(Point(x, y));
+				func(cellKey);
+				x = (cellKey.mCoords.mX + 1) << cellKey.mLevel;
+			}
+		}
+
+		for(int x : { minPt.mX - 1, maxPt.mX + 1 })
 		{
-			mLevels[i].initWithLowerLevel(mLevels[i - 1]);
+			if(x < 0 || x >= mWidth)
+				continue;
+
+			int y = minPt.mY;
+			while(y <= maxPt.mY)
+			{
+				CellKey cellKey = topLevelCellContainingPoint(Point(x, y));
+				func(cellKey);
+				y = (cellKey.mCoords.mY + 1) << cellKey.mLevel;
+			}
 		}
 	}
 
+	template <EdgeIndex edge>
+	void Hierarchy::appendAdjacentCells(CellKey cellKey, std::vector<AdjacentCell>& adjCells)
+	{
+		constexpr Axis2 parallelAxis = otherAxis((Axis2)((int8_t)edge & 1));
+
+		int16_t edgeMin = cellKey.mCoords[parallelAxis] << cellKey.mLevel;
+		int16_t edgeMax = edgeMin + (1 << cellKey.mLevel) - 1;
+
+		forEachAdjacentCell<edge>(cellKey, [&](CellKey adjCellKey)
+		{
+			int16_t adjMin = adjCellKey.mCoords[parallelAxis] << adjCellKey.mLevel;
+			int16_t adjMax = adjMin + (1 << adjCellKey.mLevel) - 1;
+
+			AdjacentCell adjCell;
+			adjCell.mCoords = adjCellKey.mCoords;
+			adjCell.mLevel = adjCellKey.mLevel;
+			adjCell.mFull = cellAt(adjCellKey) == Cell::FULL;
+			adjCell.mMin = std::max(adjMin, edgeMin);
+			adjCell.mMax = std::min(adjMax, edgeMax);
+			adjCells.push_back(adjCell);
+		});
+	}
+
 	CellKey Hierarchy::topLevelCellContainingPoint(Point pt) const
 	{
-		CellKey ret;
-		ret.mCoords = pt;
-		ret.mLevel = 0;
+		return topLevelCellContaining(CellKey(pt, 0));
+	}
 
-		while(isLevelUpCell(cellAt(ret)))
+	CellKey Hierarchy::climbLevelUpCells(CellKey cellKey) const
+	{
+		while(isLevelUpCell(cellAt(cellKey)))
 		{
-			ret.mCoords >>= 1;
-			ret.mLevel++;
+			cellKey.mCoords >>= 1;
+			cellKey.mLevel++;
 		}
 
-		return ret;
+		return cellKey;
+	}
+
+	void Hierarchy::fillTopLevels(Point minPt, Point maxPt)
+	{
+		for(int y = minPt.mY; y <= maxPt.mY; y++)
+		{
+			uint8_t* row = mTopLevels.data() + y * mWidth;
+
+			int x = minPt.mX;
+			while(x <= maxPt.mX)
+			{
+				CellKey cellKey = climbLevelUpCells(CellKey(Point(x, y), 0));
+				int runEnd = std::min((cellKey.mCoords.mX + 1) << cellKey.mLevel, maxPt.mX + 1);
+				std::fill(row + x, row + runEnd, cellKey.mLevel);
+				x = runEnd;
+			}
+		}
 	}
 
 	CellKey Hierarchy::topLevelCellContainingCorner(CellKey cellKey, CornerIndex cornerIndex) const
@@ -272,13 +1556,7 @@ namespace Hierarchy
 		}
 		else
 		{
-			while(isLevelUpCell(cellAt(cellKey)))
-			{
-				cellKey.mCoords >>= 1;
-				cellKey.mLevel++;
-			}
-
-			return cellKey;
+			return topLevelCellContaining(cellKey);
 		}
 	}
 
@@ -304,12 +1582,7 @@ namespace Hierarchy
 		}
 		else if(isLevelUpCell(cell))
 		{
-			do
-			{
-				ret.mCoords >>= 1;
-				ret.mLevel++;
-			}
-			while(isLevelUpCell(cellAt(ret)));
+			ret = topLevelCellContaining(ret);
 		}
 		
 		return ret;
@@ -325,91 +1598,313 @@ namespace Hierarchy
 		return topLevelCellContainingCorner(cellKey, cornerIndex);
 	}
 
-	void Hierarchy::drawLevel0AsBase(QPainter& painter, const QRect& rect) const
-	{
-		QVector<QRgb> palette(256, 0);
-		palette[(int)Cell::EMPTY] = qRgb(128, 128, 128);
-		palette[(int)Cell::FULL] = qRgb(255, 255, 255);
-		palette[(int)Cell::PARTIAL] = qRgb(255, 255, 255);
-		palette[(int)Cell::LEVEL_UP_EMPTY] = qRgb(128, 128, 128);
-		palette[(int)Cell::LEVEL_UP_FULL] = qRgb(255, 255, 255);
-		drawLevelWithPalette(painter, 0, rect, palette);
+	void Hierarchy::rotate90DegCcw()
+	{	
+		mLevels[0].rotate90DegCcw();
+
+		int levelWidth = mWidth;
+		int levelHeight = mHeight;
+		int level = 1;
+
+		while(((levelWidth | levelHeight) & 1) == 0)
+		{
+			levelWidth /= 2;
+			levelHeight /= 2;
+			mLevels[level].rotate90DegCcw();
+			level++;
+		}
+
+		if(level < numLevels())
+		{
+			HierarchyLevel& lastRotated = mLevels[level - 1];
+			for(size_t i = HierarchyLevel::LEVEL_UP_PLANE; i < lastRotated.mBits.size(); i += lastRotated.mNumPlanes)
+				lastRotated.mBits[i] = 0;
+
+			do
+			{
+				mLevels[level].initWithLowerLevel(mLevels[level - 1]);
+				level++;
+			}
+			while(level < numLevels());
+		}
+
+		std::swap(mWidth, mHeight);
+
+		if(!mTopLevels.empty())
+			fillTopLevels(Point(0, 0), Point(mWidth - 1, mHeight - 1));
+
+		BandThreads threads(1);
+		buildComponents(threads);
 	}
 
-	void Hierarchy::drawLevel(QPainter& painter, int levelIndex, const QRect& rect) const
+	// The binary hierarchy format. A FileHeader is followed by a FileLevel
+	// per level, and then by the arrays, each aligned to FILE_ALIGNMENT
+	// bytes. Everything is stored in native byte order and in the in memory
+	// layout, so the arrays can be used from the mapped file directly.
+	static const char FILE_MAGIC[4] = { 'H', 'I', 'E', 'R' };
+	static const uint32_t FILE_VERSION = 2;
+	static const uint64_t FILE_ALIGNMENT = 64;
+
+	struct FileArray
+	{
+		uint64_t mOffset;
+		uint64_t mCount;
+	};
+
+	struct FileHeader
 	{
-		QVector<QRgb> palette(256, 0);
-		palette[(int)Cell::EMPTY] = qRgb(32, 128, 255);
-		palette[(int)Cell::FULL] = qRgb(128, 255, 32);
-		palette[(int)Cell::PARTIAL] = qRgb(185, 122, 87);
-		palette[(int)Cell::LEVEL_UP_EMPTY] = qRgb(53, 160, 198);
-		palette[(int)Cell::LEVEL_UP_FULL] = qRgb(64, 196, 16);
-		drawLevelWithPalette(painter, levelIndex, rect, palette);
-	}	
+		char mMagic[4];
+		uint32_t mVersion;
+		int32_t mWidth;
+		int32_t mHeight;
+		int32_t mNumLevels;
+		int32_t mComponentTableShift;
+		uint8_t mCellLayout;
+		uint8_t mHasAdjacency;
+		uint8_t mPadding[2];
+		uint32_t mNumFullCells;
+		FileArray mComponents;
+		FileArray mComponentParents;
+		FileArray mTopLevels;
+		FileArray mAdjacencyOffsets;
+		FileArray mAdjacentCells;
+	};
 
-	void Hierarchy::drawLevelWithPalette(QPainter& painter, int levelIndex, const QRect& rect, const QVector<QRgb>& palette) const
+	struct FileLevel
 	{
-		const HierarchyLevel& level = mLevels[levelIndex];
+		int32_t mWidth;
+		int32_t mHeight;
+		int32_t mNumPlanes;
+		int32_t mPadding;
+		FileArray mBits;
+	};
 
-		QRectF srcRect(0, 0,
-			(float)mWidth / (float)(1 << levelIndex),
-			(float)mHeight / (float)(1 << levelIndex));
+	bool Hierarchy::saveToFile(const char* fileName) const
+	{
+		FileHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.mMagic, FILE_MAGIC, sizeof(FILE_MAGIC));
+		header.mVersion = FILE_VERSION;
+		header.mWidth = mWidth;
+		header.mHeight = mHeight;
+		header.mNumLevels = (int32_t)mLevels.size();
+		header.mComponentTableShift = mComponentTableShift;
+		header.mCellLayout = (uint8_t)mLevels[0].mLayout;
+		header.mHasAdjacency = mBuildAdjacency ? 1 : 0;
+		header.mNumFullCells = mNumFullCells;
 
-		if(level.mWidth % 4 == 0)
+		uint64_t offset = sizeof(FileHeader) + mLevels.size() * sizeof(FileLevel);
+		auto placeArray = [&](FileArray& fileArray, size_t count, size_t elementSize)
 		{
-			// Properly aligned, so we can draw the mCells data immediately.
-			QImage image((uchar*)level.mCells.data(), level.mWidth, level.mHeight, QImage::Format_Indexed8);
-			image.setColorTable(palette);
+			offset = (offset + FILE_ALIGNMENT - 1) & ~(FILE_ALIGNMENT - 1);
+			fileArray.mOffset = offset;
+			fileArray.mCount = count;
+			offset += count * elementSize;
+		};
 
-			painter.drawImage(rect, image, srcRect);
+		std::vector<FileLevel> fileLevels(mLevels.size());
+		for(size_t i = 0; i < mLevels.size(); i++)
+		{
+			const HierarchyLevel& level = mLevels[i];
+			FileLevel& fileLevel = fileLevels[i];
+			memset(&fileLevel, 0, sizeof(fileLevel));
+			fileLevel.mWidth = level.mWidth;
+			fileLevel.mHeight = level.mHeight;
+			fileLevel.mNumPlanes = level.mNumPlanes;
+			placeArray(fileLevel.mBits, level.mBits.size(), sizeof(uint64_t));
 		}
-		else
+
+		placeArray(header.mComponents, mComponents.size(), sizeof(ComponentEntry));
+		placeArray(header.mComponentParents, mComponentParents.size(), sizeof(uint32_t));
+		placeArray(header.mTopLevels, mTopLevels.size(), sizeof(uint8_t));
+		placeArray(header.mAdjacencyOffsets, mAdjacencyOffsets.size(), sizeof(uint32_t));
+		placeArray(header.mAdjacentCells, mAdjacentCells.size(), sizeof(AdjacentCell));
+
+		std::ofstream file(fileName, std::ios::binary);
+		if(!file)
+			return false;
+
+		uint64_t written = 0;
+		auto write = [&](const void* data, uint64_t size)
+		{
+			file.write((const char*)data, (std::streamsize)size);
+			written += size;
+		};
+
+		auto writeArray = [&](const FileArray& fileArray, const void* data, size_t elementSize)
+		{
+			static const char padding[FILE_ALIGNMENT] = { };
+			write(padding, fileArray.mOffset - written);
+			write(data, fileArray.mCount * elementSize);
+		};
+
+		write(&header, sizeof(header));
+		write(fileLevels.data(), fileLevels.size() * sizeof(FileLevel));
+
+		for(size_t i = 0; i < mLevels.size(); i++)
+			writeArray(fileLevels[i].mBits, mLevels[i].mBits.data(), sizeof(uint64_t));
+
+		writeArray(header.mComponents, mComponents.data(), sizeof(ComponentEntry));
+		writeArray(header.mComponentParents, mComponentParents.data(), sizeof(uint32_t));
+		writeArray(header.mTopLevels, mTopLevels.data(), sizeof(uint8_t));
+		writeArray(header.mAdjacencyOffsets, mAdjacencyOffsets.data(), sizeof(uint32_t));
+		writeArray(header.mAdjacentCells, mAdjacentCells.data(), sizeof(AdjacentCell));
+
+		return (bool)file;
+	}
+
+	RefPtr<Hierarchy> Hierarchy::loadFromFile(const char* fileName)
+	{
+		std::shared_ptr<MappedFile> mappedFile = std::make_shared<MappedFile>();
+		if(!mappedFile->open(fileName))
+			return nullptr;
+
+		const uint8_t* data = mappedFile->data();
+		size_t size = mappedFile->size();
+
+		const FileHeader* header = (const FileHeader*)data;
+		if(size < sizeof(FileHeader) ||
+			memcmp(header->mMagic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 ||
+			header->mVersion != FILE_VERSION ||
+			header->mWidth <= 0 || header->mHeight <= 0 ||
+			header->mWidth > INT16_MAX || header->mHeight > INT16_MAX ||
+			header->mNumLevels <= 0 || header->mNumLevels > 16 ||
+			header->mCellLayout > (uint8_t)CellLayout::MORTON ||
+			size < sizeof(FileHeader) + header->mNumLevels * sizeof(FileLevel))
+		{
+			return nullptr;
+		}
+
+		auto referArray = [&](auto& array, const FileArray& fileArray)
 		{
-			// Scanline width isn't a multiple of 4, so create of the data which
-			// does have this property.
-			QImage image(level.mWidth, level.mHeight, QImage::Format_Indexed8);
+			using Element = typename std::remove_reference<decltype(array[0])>::type;
+			if(fileArray.mOffset % FILE_ALIGNMENT != 0 || fileArray.mOffset > size ||
+				fileArray.mCount > (size - fileArray.mOffset) / sizeof(Element))
+			{
+				return false;
+			}
 
-			const Cell* src = level.mCells.data();
-			for(int y = 0; y < level.mHeight; y++)
+			array.refer((const Element*)(data + fileArray.mOffset), (size_t)fileArray.mCount);
+			return true;
+		};
+
+		RefPtr<Hierarchy> ret;
+		ret.setNew(new Hierarchy());
+		ret->mWidth = header->mWidth;
+		ret->mHeight = header->mHeight;
+
+		// The level sizes are derived the same way as when building, so the
+		// array sizes in the file only have to be checked against them.
+		ret->mLevels.resize(header->mNumLevels);
+		const FileLevel* fileLevels = (const FileLevel*)(header + 1);
+		for(int i = 0; i < header->mNumLevels; i++)
+		{
+			HierarchyLevel& level = ret->mLevels[i];
+			const FileLevel& fileLevel = fileLevels[i];
+			int expectedWidth = i == 0 ? header->mWidth : (ret->mLevels[i - 1].mWidth + 1) / 2;
+			int expectedHeight = i == 0 ? header->mHeight : (ret->mLevels[i - 1].mHeight + 1) / 2;
+			if(fileLevel.mWidth != expectedWidth || fileLevel.mHeight != expectedHeight ||
+				fileLevel.mNumPlanes != (i == 0 ? 2 : 3))
 			{
-				std::copy(src, src + level.mWidth, (Cell*)image.scanLine(y));
-				src += level.mWidth;
+				return nullptr;
 			}
 
-			image.setColorTable(palette);
-			painter.drawImage(rect, image, srcRect);
+			level.mLayout = (CellLayout)header->mCellLayout;
+			level.setSize(fileLevel.mWidth, fileLevel.mHeight, fileLevel.mNumPlanes);
+			if(fileLevel.mBits.mCount != (uint64_t)level.mWordsPerRow * level.mNumWordRows * level.mNumPlanes ||
+				!referArray(level.mBits, fileLevel.mBits))
+			{
+				return nullptr;
+			}
 		}
-	}
 
-	void Hierarchy::rotate90DegCcw()
-	{	
-		mLevels[0].rotate90DegCcw();
+		if(ret->mLevels.back().mWidth != 1 || ret->mLevels.back().mHeight != 1)
+			return nullptr;
 
-		int levelWidth = mWidth;
-		int levelHeight = mHeight;
-		int level = 1;
+		uint64_t numComponentEntries = header->mComponents.mCount;
+		if(numComponentEntries == 0 || (numComponentEntries & (numComponentEntries - 1)) != 0 ||
+			header->mComponentTableShift != 64 - highestSetBit(numComponentEntries) ||
+			!referArray(ret->mComponents, header->mComponents))
+		{
+			return nullptr;
+		}
 
-		while(((levelWidth | levelHeight) & 1) == 0)
+		ret->mComponentTableShift = header->mComponentTableShift;
+		ret->mNumFullCells = header->mNumFullCells;
+
+		if(header->mNumFullCells >= numComponentEntries ||
+			!referArray(ret->mComponentParents, header->mComponentParents))
 		{
-			levelWidth /= 2;
-			levelHeight /= 2;
-			mLevels[level].rotate90DegCcw();
-			level++;
+			return nullptr;
 		}
 
-		if(level < mLevels.size())
+		if(header->mTopLevels.mCount != 0 &&
+			(header->mTopLevels.mCount != (uint64_t)header->mWidth * header->mHeight ||
+			!referArray(ret->mTopLevels, header->mTopLevels)))
 		{
-			for(Cell& cell : mLevels[level - 1].mCells)
-				cell = (Cell)((uint8_t)cell & ~(uint8_t)Cell::LEVEL_UP_MASK);
+			return nullptr;
+		}
 
-			do
+		ret->mBuildAdjacency = header->mHasAdjacency != 0;
+		if(ret->mBuildAdjacency)
+		{
+			// Read through a const reference, so the offsets aren't copied.
+			const MappableArray<uint32_t>& offsets = ret->mAdjacencyOffsets;
+			if(!referArray(ret->mAdjacencyOffsets, header->mAdjacencyOffsets) ||
+				!referArray(ret->mAdjacentCells, header->mAdjacentCells) ||
+				offsets.size() % 4 != 1 || offsets[0] != 0 ||
+				offsets[offsets.size() - 1] != ret->mAdjacentCells.size())
 			{
-				mLevels[level].initWithLowerLevel(mLevels[level - 1]);
-				level++;
+				return nullptr;
+			}
+
+			for(size_t i = 1; i < offsets.size(); i++)
+			{
+				if(offsets[i] < offsets[i - 1])
+					return nullptr;
+			}
+
+			const MappableArray<AdjacentCell>& adjCells = ret->mAdjacentCells;
+			for(size_t i = 0; i < adjCells.size(); i++)
+			{
+				if(adjCells[i].mLevel >= header->mNumLevels)
+					return nullptr;
 			}
-			while(level < mLevels.size());
 		}
 
-		std::swap(mWidth, mHeight);
+		// The lookups probe the component table until they find an empty
+		// slot, and follow the parents and cell indices of its entries
+		// without checking them, so those are checked once here.
+		const MappableArray<ComponentEntry>& components = ret->mComponents;
+		const MappableArray<uint32_t>& parents = ret->mComponentParents;
+		uint32_t numCellIndices = ret->mBuildAdjacency ? (uint32_t)(ret->mAdjacencyOffsets.size() - 1) / 4 : 0;
+		uint64_t numFullCells = 0;
+		for(size_t i = 0; i < components.size(); i++)
+		{
+			const ComponentEntry& entry = components[i];
+			if(entry.mPackedCellKey == EMPTY_COMPONENT_KEY)
+				continue;
+
+			if((entry.mPackedCellKey >> 32) >= (uint64_t)header->mNumLevels ||
+				entry.mComponent >= parents.size() ||
+				(ret->mBuildAdjacency && entry.mCellIndex >= numCellIndices))
+			{
+				return nullptr;
+			}
+
+			numFullCells++;
+		}
+
+		if(numFullCells != header->mNumFullCells)
+			return nullptr;
+
+		for(size_t i = 0; i < parents.size(); i++)
+		{
+			if(parents[i] > i)
+				return nullptr;
+		}
+
+		ret->mMappedFile = std::move(mappedFile);
+		return ret;
 	}
 }
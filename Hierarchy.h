@@ -1,10 +1,12 @@
 #pragma once
 
+#include <memory>
 #include <vector>
-#include <QPainter>
 
 #include "Utils.h"
 #include "Obj.h"
+#include "MappableArray.h"
+#include "MappedFile.h"
 
 namespace Hierarchy
 {
@@ -41,6 +43,16 @@ namespace Hierarchy
 		TOWARDS_POSITIVE = 1,
 	};
 
+	enum class CellLayout : uint8_t
+	{
+		// Every word holds 64 cells of a row.
+		ROW_MAJOR,
+
+		// Every word holds a tile of 8x8 cells in Z-order, so the children
+		// of a cell, and most of its neighbors, share a word.
+		MORTON,
+	};
+
 	static constexpr inline bool isEmptyCell(Cell cell)
 	{
 		return ((uint8_t)cell & (uint8_t)Cell::EMPTY) != 0;
@@ -56,6 +68,11 @@ namespace Hierarchy
 		return ((uint8_t)cell & (uint8_t)Cell::LEVEL_UP_MASK) != 0;
 	}
 
+	static constexpr inline OnEdgeDir oppositeDir(OnEdgeDir dir)
+	{
+		return (OnEdgeDir)(-(int8_t)dir);
+	}
+
 	static constexpr inline int8_t cornerOnAxis(CornerIndex cornerIndex, Axis2 axis)
 	{
 		return ((int8_t)cornerIndex >> (int8_t)axis) & 1;
@@ -139,6 +156,11 @@ namespace Hierarchy
 			ret.mLevel = -1;
 			return ret;
 		}
+
+		uint64_t packed() const
+		{
+			return (uint64_t)(uint16_t)mCoords.mX | ((uint64_t)(uint16_t)mCoords.mY << 16) | ((uint64_t)mLevel << 32);
+		}
 	};
 
 	class HierarchyLevel
@@ -150,20 +172,157 @@ namespace Hierarchy
 		void initLevel0(int width, int height, const uint8_t* elevation, const uint8_t* overrides);
 		void initWithLowerLevel(HierarchyLevel& deeperLevel);
 
+		// Recomputes the cell at (x, y) from its children in deeperLevel, and
+		// updates the LEVEL_UP bits of those children accordingly.
+		void remergeCell(HierarchyLevel& deeperLevel, int x, int y);
+
+		// pt must lie within the level, see Hierarchy::cellAt for the bounds
+		// checked version.
 		inline Cell cellAt(Point pt) const;
 
+		int width() const { return mWidth; }
+		int height() const { return mHeight; }
+
 		void rotate90DegCcw();
 
 	private:
+		// The cells are stored as bitplanes, with one bit per cell per plane.
+		// The planes are interleaved per word, and every row (or row of
+		// tiles) starts at a new word, so cells can be merged a word at a
+		// time. Level 0 can't have partial cells, so it only has the first
+		// 2 planes. Bits of cells outside of the level are always 0.
+		static constexpr int FULL_PLANE = 0;
+		static constexpr int LEVEL_UP_PLANE = 1;
+		static constexpr int PARTIAL_PLANE = 2;
+
+		static constexpr int TILE_SHIFT = 3;
+		static constexpr int TILE_SIZE = 1 << TILE_SHIFT;
+
+		void setSize(int width, int height, int numPlanes);
+		void resize(int width, int height, int numPlanes);
+
+		// The number of rows which share words, bands of rows processed in
+		// parallel have to be aligned to this.
+		int rowAlignment() const
+		{
+			return mLayout == CellLayout::MORTON ? TILE_SIZE : 1;
+		}
+
+		const uint64_t* wordsAt(int wordX, int wordY) const
+		{
+			return mBits.data() + (wordY * mWordsPerRow + wordX) * mNumPlanes;
+		}
+
+		uint64_t* wordsAt(int wordX, int wordY)
+		{
+			return mBits.data() + (wordY * mWordsPerRow + wordX) * mNumPlanes;
+		}
+
+		static int mortonBit(int x, int y)
+		{
+			return (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2) | ((x & 4) << 2) | ((y & 4) << 3);
+		}
+
+		// Returns the offset of the words containing the cell at pt, and sets
+		// bit to the index of its bit within them.
+		int cellWordsOffset(Point pt, int& bit) const
+		{
+			if(mLayout == CellLayout::MORTON)
+			{
+				bit = mortonBit(pt.mX & (TILE_SIZE - 1), pt.mY & (TILE_SIZE - 1));
+				return ((pt.mY >> TILE_SHIFT) * mWordsPerRow + (pt.mX >> TILE_SHIFT)) * mNumPlanes;
+			}
+			else
+			{
+				bit = pt.mX & 63;
+				return (pt.mY * mWordsPerRow + (pt.mX >> 6)) * mNumPlanes;
+			}
+		}
+
+		void setCell(Point pt, Cell cell);
+
+		// Sets the FULL bits of the rows beginY up to endY, where elevation
+		// starts at row beginY.
+		void convertRows(const uint8_t* elevation, int beginY, int endY);
+		void mergeRows(HierarchyLevel& srcLevel, int beginY, int endY);
+		void mergeMortonRows(HierarchyLevel& srcLevel, int beginY, int endY);
+
 		int mWidth;
 		int mHeight;
-		std::vector<Cell> mCells;
+		CellLayout mLayout = CellLayout::ROW_MAJOR;
+		int mWordsPerRow;
+		int mNumWordRows;
+		int mNumPlanes;
+		MappableArray<uint64_t> mBits;
+	};
+
+	struct BuildOptions
+	{
+		// The levels are built in horizontal bands on this many threads.
+		// Small levels are always built on the calling thread.
+		int mNumThreads = 1;
+
+		CellLayout mCellLayout = CellLayout::ROW_MAJOR;
+
+		// Stores the level of the top level cell containing each pixel, so
+		// top level cells are found without climbing the levels. Costs a
+		// byte per pixel.
+		bool mTopLevelLookup = false;
+
+		// Precomputes the top level cells along every edge of every top
+		// level full cell, see Hierarchy::adjacentCells.
+		bool mAdjacency = false;
 	};
 
+	// A top level cell along an edge of a top level full cell, with its
+	// extent along that edge clipped to the edge.
+	struct AdjacentCell
+	{
+		Point mCoords;
+		uint8_t mLevel;
+		bool mFull;
+		int16_t mMin;
+		int16_t mMax;
+
+		CellKey cellKey() const
+		{
+			return CellKey(mCoords, mLevel);
+		}
+	};
+
+	// Produces the elevation of a map band by band, so a Hierarchy can be
+	// built without holding the whole map in memory.
+	class ElevationSource
+	{
+	public:
+		virtual ~ElevationSource() { }
+
+		// Writes the elevation of the next numRows rows into elevation, row
+		// by row. Returns false if they can't be read.
+		virtual bool readRows(uint8_t* elevation, int numRows) = 0;
+	};
+
+	class BandThreads;
+
 	class Hierarchy : public Obj
 	{
 	public:
 		Hierarchy(int width, int height, const uint8_t* elevation);
+		Hierarchy(int width, int height, const uint8_t* elevation, const BuildOptions& options);
+
+		// Maps a file written by saveToFile. The levels and tables refer to
+		// the mapped file instead of being copied, until they're modified.
+		// Returns null if the file can't be mapped or isn't a valid
+		// hierarchy file. The sizes, component table and adjacency are
+		// checked, which reads them once, but the cells of the levels are
+		// trusted to be consistent, so files should only come from
+		// saveToFile.
+		static RefPtr<Hierarchy> loadFromFile(const char* fileName);
+		bool saveToFile(const char* fileName) const;
+
+		// Builds a hierarchy from the rows read from source, converting level
+		// 0 one band of rows at a time. Returns null if source fails.
+		static RefPtr<Hierarchy> buildFromSource(int width, int height, ElevationSource& source, const BuildOptions& options);
 
 		int numLevels() const
 		{
@@ -173,12 +332,49 @@ namespace Hierarchy
 		int width() const { return mWidth; }
 		int height() const { return mHeight; }
 
+		const HierarchyLevel& level(int levelIndex) const
+		{
+			return mLevels[levelIndex];
+		}
+
+		// Cells outside of the map are EMPTY, and never level up cells, like
+		// the cells of the upper levels which extend past its edges. Path
+		// finders rely on this to look across the map edge next to walkable
+		// border pixels without checking bounds. The functions below which
+		// go from a cell to the top level cell containing it keep to the
+		// same contract, and return cells outside of the map unchanged.
 		Cell cellAt(CellKey cellKey) const
 		{
-			return mLevels[cellKey.mLevel].cellAt(cellKey.mCoords);
+			const HierarchyLevel& level = mLevels[cellKey.mLevel];
+			if((uint16_t)cellKey.mCoords.mX >= (uint16_t)level.width() ||
+				(uint16_t)cellKey.mCoords.mY >= (uint16_t)level.height())
+			{
+				return Cell::EMPTY;
+			}
+
+			return level.cellAt(cellKey.mCoords);
 		}
 
 		CellKey topLevelCellContainingPoint(Point pt) const;
+
+		// The top level cell containing the given cell, which must not be a
+		// partial cell. Cells outside of the map are returned unchanged.
+		inline CellKey topLevelCellContaining(CellKey cellKey) const;
+
+		// The label of the 8-connected component of full cells the given top
+		// level full cell belongs to. Two points are connected if and only if
+		// their top level cells are full and have the same component.
+		uint32_t componentOf(CellKey topLevelCellKey) const;
+
+		// Sets begin and end to the cells along the given edge of a top level
+		// full cell, ordered by their coordinate along the edge. Returns
+		// false if the adjacency wasn't built, or cellKey isn't a top level
+		// full cell.
+		bool adjacentCells(CellKey cellKey, EdgeIndex edge, const AdjacentCell*& begin, const AdjacentCell*& end) const;
+
+		// Like topLevelCellContaining, but partial cells are descended into,
+		// towards the given corner or edge point. Cells outside of the map
+		// are returned unchanged.
 		CellKey topLevelCellContainingCorner(CellKey cellKey, CornerIndex cornerIndex) const;
 		
 		template <EdgeIndex edgeIndex, OnEdgeDir tieResolve>
@@ -213,14 +409,122 @@ namespace Hierarchy
 		template <EdgeIndex edge, OnEdgeDir dir>
 		CellKey nextBoundaryCell(CellKey cellKey) const;
 
-		void drawLevel0AsBase(QPainter& painter, const QRect& rect) const;
-		void drawLevel(QPainter& painter, int levelIndex, const QRect& rect) const;
-		void drawLevelWithPalette(QPainter& painter, int levelIndex, const QRect& rect, const QVector<QRgb>& palette) const;
+		// The number of bytes of the levels and tables, whether they're
+		// mapped from a file or not.
+		size_t memoryUsage() const;
 
 		void rotate90DegCcw();
+
+		// Replaces the elevation of the pixels in the given rectangle, where
+		// elevation holds width * height values, row by row. Only the cells
+		// above the rectangle are merged again, on every level, and only the
+		// components and adjacency of the top level cells in and next to the
+		// changed ones are updated. Returns the number of top level cells it
+		// looked at for that, which doesn't grow with the size of the map
+		// unless the edit splits a component into large pieces.
+		int updateRegion(int x, int y, int width, int height, const uint8_t* elevation);
 		
 	private:
+		Hierarchy() { }
+
+		// The number of rows buildFromSource reads at a time.
+		static constexpr int SOURCE_BAND_HEIGHT = 256;
+
+		void initLevels(int width, int height, const BuildOptions& options);
+		void buildUpperLevels(const BuildOptions& options, BandThreads& threads);
+
+		void buildComponents(BandThreads& threads);
+		void buildAdjacency(const std::vector<CellKey>& fullCells);
+
+		// Sets the pixels of the rectangle and merges the cells above them
+		// again, without updating anything else.
+		void setRegion(int x, int y, int width, int height, const uint8_t* elevation);
+
+		// The top level full cells overlapping the rectangle from minPt to
+		// maxPt, found by descending into the partial cells.
+		void collectTopLevelFullCells(Point minPt, Point maxPt, std::vector<CellKey>& fullCells) const;
+
+		int updateComponents(Point minPt, Point maxPt, std::vector<CellKey>& oldCells, std::vector<CellKey>& newCells);
+
+		// Calls func with each top level cell along the given edge of a top
+		// level cell, full or not, ordered by their coordinate along it.
+		template <EdgeIndex edge, class Func>
+		void forEachAdjacentCell(CellKey cellKey, Func func) const;
+
+		// Calls func with the top level full cells with a pixel which is
+		// 8-connected to a pixel of the given top level full cell. Cells can
+		// be passed more than once.
+		template <class Func>
+		void forEachConnectedCell(CellKey cellKey, Func func) const;
+
+		// Calls func with the top level cells containing the pixels just
+		// outside of the rectangle from minPt to maxPt, within the map.
+		template <class Func>
+		void forEachCellAroundRect(Point minPt, Point maxPt, Func func) const;
+
+		template <EdgeIndex edge>
+		void appendAdjacentCells(CellKey cellKey, std::vector<AdjacentCell>& adjCells);
+		void appendAdjacency(CellKey cellKey);
+		void compactAdjacency();
+
+		CellKey climbLevelUpCells(CellKey cellKey) const;
+		void fillTopLevels(Point minPt, Point maxPt);
+
+		// The level of the top level cell containing each pixel, row by row,
+		// or empty if BuildOptions::mTopLevelLookup wasn't set.
+		MappableArray<uint8_t> mTopLevels;
+
 		std::vector<HierarchyLevel> mLevels;
+
+		// The component of each top level full cell, in an open addressing
+		// hash table keyed on CellKey::packed.
+		struct ComponentEntry
+		{
+			uint64_t mPackedCellKey;
+			uint32_t mComponent;
+			uint32_t mCellIndex;
+		};
+
+		static const uint64_t EMPTY_COMPONENT_KEY = ~0ull;
+		static const uint32_t NO_COMPONENT = ~0u;
+
+		const ComponentEntry* findComponentEntry(uint64_t packedCellKey) const;
+		ComponentEntry* findComponentEntry(uint64_t packedCellKey)
+		{
+			// Copies the table if it's mapped from a file.
+			mComponents.data();
+			return const_cast<ComponentEntry*>(static_cast<const Hierarchy*>(this)->findComponentEntry(packedCellKey));
+		}
+
+		ComponentEntry* insertComponentEntry(CellKey cellKey);
+		void removeComponentEntry(ComponentEntry* entry);
+
+		uint32_t rootComponent(uint32_t component);
+		uint32_t newComponent();
+
+		MappableArray<ComponentEntry> mComponents;
+		int mComponentTableShift;
+		uint32_t mNumFullCells;
+
+		// updateRegion merges components by pointing one at the other, like
+		// a union-find, so the component of a cell is found by following
+		// mComponentParents from its entry's mComponent, up to a component
+		// which is its own parent. Parents always have a lower index.
+		MappableArray<uint32_t> mComponentParents;
+
+		// The adjacent cells of the 4 edges of the full cell with index i are
+		// mAdjacentCells[mAdjacencyOffsets[4 * i + edge]] up to the next
+		// offset. Empty if BuildOptions::mAdjacency wasn't set. updateRegion
+		// gives the cells it updates new indices at the end, leaving unused
+		// indices behind until they're compacted.
+		bool mBuildAdjacency = false;
+		MappableArray<uint32_t> mAdjacencyOffsets;
+		MappableArray<AdjacentCell> mAdjacentCells;
+
+		// The file the arrays refer to, if loaded with loadFromFile. Shared by
+		// copies of the hierarchy.
+		std::shared_ptr<const MappedFile> mMappedFile;
+
 		int mWidth;
 		int mHeight;
 	};
@@ -4,7 +4,39 @@ namespace Hierarchy
 	{
 		DIDA_ASSERT(pt.mX >= 0 && pt.mX < mWidth &&
 			pt.mY >= 0 && pt.mY < mHeight);
-		return mCells[pt.mX + pt.mY * mWidth];
+
+		int bit;
+		const uint64_t* words = mBits.data() + cellWordsOffset(pt, bit);
+		uint32_t full = (uint32_t)(words[FULL_PLANE] >> bit) & 1;
+		uint32_t levelUp = (uint32_t)(words[LEVEL_UP_PLANE] >> bit) & 1;
+		uint32_t partial = mNumPlanes > PARTIAL_PLANE ? (uint32_t)(words[PARTIAL_PLANE] >> bit) & 1 : 0;
+
+		// EMPTY or FULL, shifted to PARTIAL for partial cells, which are
+		// never full.
+		return (Cell)(((1 + full) << (2 * partial)) | (levelUp << 3));
+	}
+
+	CellKey Hierarchy::topLevelCellContaining(CellKey cellKey) const
+	{
+		DIDA_ASSERT(cellAt(cellKey) != Cell::PARTIAL);
+
+		if(mTopLevels.empty())
+			return climbLevelUpCells(cellKey);
+
+		// Cells outside of the map are returned unchanged, like
+		// climbLevelUpCells does, since they're never level up cells.
+		const HierarchyLevel& cellLevel = mLevels[cellKey.mLevel];
+		if((uint16_t)cellKey.mCoords.mX >= (uint16_t)cellLevel.width() ||
+			(uint16_t)cellKey.mCoords.mY >= (uint16_t)cellLevel.height())
+		{
+			return cellKey;
+		}
+
+		Point pt = cellKey.mCoords;
+		pt <<= cellKey.mLevel;
+		uint8_t level = mTopLevels[pt.mX + pt.mY * mWidth];
+		pt >>= level;
+		return CellKey(pt, level);
 	}
 
 	template <EdgeIndex edgeIndex, OnEdgeDir tieResolve>
@@ -43,13 +75,7 @@ namespace Hierarchy
 		}
 		else
 		{
-			while(isLevelUpCell(cellAt(cellKey)))
-			{
-				cellKey.mCoords >>= 1;
-				cellKey.mLevel++;
-			}
-
-			return cellKey;
+			return topLevelCellContaining(cellKey);
 		}
 	}
 
@@ -179,13 +205,7 @@ namespace Hierarchy
 		Cell cell = cellAt(cellKey);
 		if(isLevelUpCell(cell))
 		{
-			do
-			{
-				cellKey.mCoords >>= 1;
-				cellKey.mLevel++;
-				cell = cellAt(cellKey);
-			}
-			while(isLevelUpCell(cell));
+			cellKey = topLevelCellContaining(cellKey);
 		}
 		else if(cell == Cell::PARTIAL)
 		{
@@ -0,0 +1,73 @@
+#include "pch.h"
+#include "HierarchyDraw.h"
+
+namespace Hierarchy
+{
+	void drawLevel0AsBase(QPainter& painter, const Hierarchy& hierarchy, const QRect& rect)
+	{
+		QVector<QRgb> palette(256, 0);
+		palette[(int)Cell::EMPTY] = qRgb(128, 128, 128);
+		palette[(int)Cell::FULL] = qRgb(255, 255, 255);
+		palette[(int)Cell::PARTIAL] = qRgb(255, 255, 255);
+		palette[(int)Cell::LEVEL_UP_EMPTY] = qRgb(128, 128, 128);
+		palette[(int)Cell::LEVEL_UP_FULL] = qRgb(255, 255, 255);
+		drawLevelWithPalette(painter, hierarchy, 0, rect, palette);
+	}
+
+	void drawLevel(QPainter& painter, const Hierarchy& hierarchy, int levelIndex, const QRect& rect)
+	{
+		QVector<QRgb> palette(256, 0);
+		palette[(int)Cell::EMPTY] = qRgb(32, 128, 255);
+		palette[(int)Cell::FULL] = qRgb(128, 255, 32);
+		palette[(int)Cell::PARTIAL] = qRgb(185, 122, 87);
+		palette[(int)Cell::LEVEL_UP_EMPTY] = qRgb(53, 160, 198);
+		palette[(int)Cell::LEVEL_UP_FULL] = qRgb(64, 196, 16);
+		drawLevelWithPalette(painter, hierarchy, levelIndex, rect, palette);
+	}	
+
+	void drawLevelWithPalette(QPainter& painter, const Hierarchy& hierarchy, int levelIndex, const QRect& rect, const QVector<QRgb>& palette)
+	{
+		const HierarchyLevel& level = hierarchy.level(levelIndex);
+
+		QRectF srcRect(0, 0,
+			(float)hierarchy.width() / (float)(1 << levelIndex),
+			(float)hierarchy.height() / (float)(1 << levelIndex));
+
+		// The cells are bit packed, so unpack them into an 8 bit image.
+		QImage image(level.width(), level.height(), QImage::Format_Indexed8);
+		for(int y = 0; y < level.height(); y++)
+		{
+			uchar* dest = image.scanLine(y);
+			for(int x = 0; x < level.width(); x++)
+			{
+				dest[x] = (uchar)level.cellAt(Point(x, y));
+			}
+		}
+
+		image.setColorTable(palette);
+		painter.drawImage(rect, image, srcRect);
+	}
+
+	void drawDebugDraw(QPainter& painter, const DebugDraw& debugDraw, float scale)
+	{
+		painter.setPen(QPen(QColor(255, 0, 0)));
+
+		for(const DebugDraw::Line& line : debugDraw.lines())
+		{
+			QLineF qtLine(
+				(line.mFrom.mX + .5f) * scale,
+				(line.mFrom.mY + .5f) * scale,
+				(line.mTo.mX + .5f) * scale,
+				(line.mTo.mY + .5f) * scale);
+			painter.drawLine(qtLine);
+		}
+
+		for(const DebugDraw::Beam& beam : debugDraw.beams())
+		{
+			QRectF rect(
+				beam.mMin.mX * scale, beam.mMin.mY * scale,
+				beam.mMax.mX * scale, beam.mMax.mY * scale);
+			painter.fillRect(rect, QColor(255, 240, 0, 128));
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <QPainter>
+
+#include "Hierarchy.h"
+#include "DebugDraw.h"
+
+namespace Hierarchy
+{
+	// Qt drawing of the hierarchy and of path finder debug output, kept out of
+	// the core so it builds without Qt.
+	void drawLevel0AsBase(QPainter& painter, const Hierarchy& hierarchy, const QRect& rect);
+	void drawLevel(QPainter& painter, const Hierarchy& hierarchy, int levelIndex, const QRect& rect);
+	void drawLevelWithPalette(QPainter& painter, const Hierarchy& hierarchy, int levelIndex, const QRect& rect, const QVector<QRgb>& palette);
+
+	void drawDebugDraw(QPainter& painter, const DebugDraw& debugDraw, float scale);
+}
\ No newline at end of file
@@ -1,36 +1,141 @@
-#include "HierarchyPathfinder.h"
+#include "HierarchyPathFinder.h"
+
+#include <algorithm>
 
 namespace Hierarchy
 {
 	PathFinder::PathFinder(const Hierarchy* hierarchy)
-		: mHierarchy(hierarchy),
-		mClosedSet(hierarchy)
+		: mPoppedKey(0),
+		mNumPushed(0),
+		mNumPopped(0),
+		mClosedSet(hierarchy),
+		mHierarchy(hierarchy)
 	{
 	}
 
 	PathFinder::IterationRes PathFinder::begin(const CellAndCorner& root)
 	{
+		reset();
+
+		mStartPoint = root.mCell.corner(root.mCorner);
+		mEndPoint = Point::invalidPoint();
+		mStartCellKey = root.mCell;
+		mEndCellKey = CellKey::invalidCellKey();
+
 		Step step;
 		step.mStepType = StepType::DIAG;
 		step.mCornerIndex = root.mCorner;
 		step.mCellKey = root.mCell;
-		step.mClosedSetEdges = 0;
-		step.mClosedSetCellKey = CellKey::invalidCellKey();
-		step.mPoint = root.mCell.corner(root.mCorner);
+		step.mPoint = mStartPoint;
 		step.mParentPoint = Point::invalidPoint();
+		step.mViaPoint = Point::invalidPoint();
 		step.mTraversedCost = Cost(0, 0);
-		validateStep(step);
-		mOpenSet.push(step);
+		pushStep(step);
 
 		return IterationRes::IN_PROGRESS;
 	}
 
 	PathFinder::IterationRes PathFinder::begin(Point startPoint, Point endPoint, DebugDraw* debugDraw)
 	{
+		reset();
+
 		mStartPoint = startPoint;
 		mEndPoint = endPoint;
 
-		DIDA_ASSERT(!"not implemented yet");
+		mStartCellKey = mHierarchy->topLevelCellContainingPoint(startPoint);
+		mEndCellKey = mHierarchy->topLevelCellContainingPoint(endPoint);
+
+		if(!isFullCell(mHierarchy->cellAt(mStartCellKey)) ||
+			!isFullCell(mHierarchy->cellAt(mEndCellKey)) ||
+			mHierarchy->componentOf(mStartCellKey) != mHierarchy->componentOf(mEndCellKey))
+		{
+			return IterationRes::UNREACHABLE;
+		}
+
+		mClosedSet.tryAddPoint(startPoint, Point::invalidPoint(), Point::invalidPoint(), 0);
+
+		if(mStartCellKey == mEndCellKey)
+		{
+			// Both points lie in the same full cell, so the straight path
+			// between them is unobstructed.
+			mEndCost = Cost::distance(startPoint, endPoint);
+			if(endPoint != startPoint)
+			{
+				mClosedSet.tryAddPoint(endPoint, startPoint, Point::invalidPoint(), mEndCost.toFixedPoint());
+
+				if(debugDraw)
+				{
+					debugDraw->drawLine(startPoint, endPoint);
+				}
+			}
+
+			return IterationRes::END_REACHED;
+		}
+
+		// Every point of the start cell can be reached in a straight line, so
+		// no other path can improve on the points of its edges.
+		mClosedSet.addEdges(mStartCellKey, (uint8_t)ClosedSet::EdgeFlags::ALL);
+
+		Step startStep;
+		startStep.mStepType = StepType::DIAG;
+		startStep.mCellKey = mStartCellKey;
+		startStep.mPoint = startPoint;
+		startStep.mParentPoint = Point::invalidPoint();
+		startStep.mViaPoint = Point::invalidPoint();
+		startStep.mTraversedCost = Cost(0, 0);
+
+		Point min = mStartCellKey.corner(CornerIndex::MIN_X_MIN_Y);
+		Point max = mStartCellKey.corner(CornerIndex::MAX_X_MAX_Y);
+
+		// Beams leaving the start cell through each of its edges. A beam only
+		// spans the part of the edge which can be reached with a diagonal
+		// followed by a straight segment.
+		int16_t toMinX = startPoint.mX - min.mX;
+		int16_t toMaxX = max.mX - startPoint.mX;
+		int16_t toMinY = startPoint.mY - min.mY;
+		int16_t toMaxY = max.mY - startPoint.mY;
+
+		enqueueBeam<CornerIndex::MIN_X_MIN_Y, Axis2::X>(startStep, startPoint, Cost(0, 0),
+			startPoint.mY - std::min(toMinY, toMaxX), startPoint.mY + std::min(toMaxY, toMaxX));
+		enqueueBeam<CornerIndex::MAX_X_MIN_Y, Axis2::X>(startStep, startPoint, Cost(0, 0),
+			startPoint.mY - std::min(toMinY, toMinX), startPoint.mY + std::min(toMaxY, toMinX));
+		enqueueBeam<CornerIndex::MIN_X_MIN_Y, Axis2::Y>(startStep, startPoint, Cost(0, 0),
+			startPoint.mX - std::min(toMinX, toMaxY), startPoint.mX + std::min(toMaxX, toMaxY));
+		enqueueBeam<CornerIndex::MIN_X_MAX_Y, Axis2::Y>(startStep, startPoint, Cost(0, 0),
+			startPoint.mX - std::min(toMinX, toMinY), startPoint.mX + std::min(toMaxX, toMinY));
+
+		// The paths which follow the edges of the start cell along which the
+		// beams run, from where the diagonals from the start point get to
+		// them, and wrap around the empty cells next to them.
+		if(toMaxY <= toMaxX)
+			enqueueSideEdge<CornerIndex::MIN_X_MAX_Y, Axis2::X>(mStartCellKey, Point(startPoint.mX + toMaxY, max.mY), startPoint, Cost(0, 0));
+		if(toMinY <= toMaxX)
+			enqueueSideEdge<CornerIndex::MIN_X_MIN_Y, Axis2::X>(mStartCellKey, Point(startPoint.mX + toMinY, min.mY), startPoint, Cost(0, 0));
+		if(toMaxY <= toMinX)
+			enqueueSideEdge<CornerIndex::MAX_X_MAX_Y, Axis2::X>(mStartCellKey, Point(startPoint.mX - toMaxY, max.mY), startPoint, Cost(0, 0));
+		if(toMinY <= toMinX)
+			enqueueSideEdge<CornerIndex::MAX_X_MIN_Y, Axis2::X>(mStartCellKey, Point(startPoint.mX - toMinY, min.mY), startPoint, Cost(0, 0));
+		if(toMaxX <= toMaxY)
+			enqueueSideEdge<CornerIndex::MAX_X_MIN_Y, Axis2::Y>(mStartCellKey, Point(max.mX, startPoint.mY + toMaxX), startPoint, Cost(0, 0));
+		if(toMinX <= toMaxY)
+			enqueueSideEdge<CornerIndex::MIN_X_MIN_Y, Axis2::Y>(mStartCellKey, Point(min.mX, startPoint.mY + toMinX), startPoint, Cost(0, 0));
+		if(toMaxX <= toMinY)
+			enqueueSideEdge<CornerIndex::MAX_X_MAX_Y, Axis2::Y>(mStartCellKey, Point(max.mX, startPoint.mY - toMaxX), startPoint, Cost(0, 0));
+		if(toMinX <= toMinY)
+			enqueueSideEdge<CornerIndex::MIN_X_MAX_Y, Axis2::Y>(mStartCellKey, Point(min.mX, startPoint.mY - toMinX), startPoint, Cost(0, 0));
+
+		// Diagonals leaving the start cell towards each of its corners.
+		enqueueStartDiag<CornerIndex::MIN_X_MIN_Y>(startStep);
+		enqueueStartDiag<CornerIndex::MAX_X_MIN_Y>(startStep);
+		enqueueStartDiag<CornerIndex::MIN_X_MAX_Y>(startStep);
+		enqueueStartDiag<CornerIndex::MAX_X_MAX_Y>(startStep);
+
+		// The start cell's corners, which take care of the paths wrapping
+		// around its side edges and corners.
+		expandStartCorner<CornerIndex::MIN_X_MIN_Y>(startStep, debugDraw);
+		expandStartCorner<CornerIndex::MAX_X_MIN_Y>(startStep, debugDraw);
+		expandStartCorner<CornerIndex::MIN_X_MAX_Y>(startStep, debugDraw);
+		expandStartCorner<CornerIndex::MAX_X_MAX_Y>(startStep, debugDraw);
 
 		return IterationRes::IN_PROGRESS;
 	}
@@ -45,41 +150,227 @@ namespace Hierarchy
 				return IterationRes::UNREACHABLE;
 			}
 
-			step = mOpenSet.top();
-			mOpenSet.pop();
+			popStep(step);
+
+			if(step.mStepType == StepType::END)
+			{
+				// An END step's key is the exact cost of its path, and no step
+				// leads to a path cheaper than its key, so the first END step
+				// popped is a shortest path.
+				mClosedSet.tryAddPoint(step.mPoint, step.mParentPoint, step.mViaPoint, step.mTraversedCost.toFixedPoint());
+
+				if(debugDraw)
+				{
+					drawStep(step, debugDraw);
+				}
+
+				mEndCost = step.mTraversedCost;
+				return IterationRes::END_REACHED;
+			}
+
+			if(mClosedSet.pointTraversed(step.mCellKey, step.mPoint))
+			{
+				continue;
+			}
+
+			if(debugDraw && step.mParentPoint != Point::invalidPoint())
+			{
+				drawStep(step, debugDraw);
+			}
 
-			if(mClosedSet.tryAddPoint(step.mPoint, step.mParentPoint) &&
-				!mClosedSet.pointTraversed(step.mCellKey, step.mPoint))
+			if(step.mStepType == StepType::BEAM_X || step.mStepType == StepType::BEAM_Y)
 			{
-				if(step.mClosedSetEdges)
+				// Beams are continued from their parent, not their point, so
+				// their point isn't settled through them, and another step
+				// getting to it doesn't make the rest of the beam redundant.
+				// Unless the beam narrowed down to its point, then it's just a
+				// straight line on from there.
+				Axis2 axis = step.mStepType == StepType::BEAM_X ? Axis2::X : Axis2::Y;
+				if(step.mBeamMin == step.mBeamMax &&
+					!mClosedSet.tryExpandBeamPoint(step.mPoint, step.mCornerIndex, axis, step.mTraversedCost.toFixedPoint()))
 				{
-					mClosedSet.addEdges(step.mClosedSetCellKey, step.mClosedSetEdges);
+					continue;
 				}
 
-				if(debugDraw && step.mParentPoint != Point::invalidPoint())
+				if(step.mCellKey == mEndCellKey)
 				{
-					debugDraw->drawLine(step.mParentPoint, step.mPoint);
+					enqueueEnd(step);
 				}
 
-				switch(step.mStepType)
+				stepBeam(step);
+				return IterationRes::IN_PROGRESS;
+			}
+
+			// A point is expanded again when a cheaper path to it turns up
+			// later, which can happen since a beam's key is a bound for its
+			// whole edge rather than the cost at one point.
+			uint64_t cost = step.mTraversedCost.toFixedPoint();
+			if(!mClosedSet.tryExpandCorner(step.mPoint, step.mCornerIndex, cost))
+			{
+				continue;
+			}
+
+			mClosedSet.tryAddPoint(step.mPoint, step.mParentPoint, step.mViaPoint, cost);
+
+			if(step.mPoint == mEndPoint)
+			{
+				mEndCost = step.mTraversedCost;
+				return IterationRes::END_REACHED;
+			}
+
+			if(step.mCellKey == mEndCellKey)
+			{
+				enqueueEnd(step);
+			}
+
+			if(step.mStepType == StepType::DIAG)
+				stepDiag(step);
+			else
+				stepDiagOffGrid(step);
+
+			return IterationRes::IN_PROGRESS;
+		}
+	}
+
+	template <class Func>
+	void PathFinder::forEachWaypointReversed(Func func) const
+	{
+		// Walks the parents, via points and knees from the end point back to
+		// the start point. Each point is held back in cur until it's known
+		// whether the next point continues in the same direction.
+		Point prev = mEndPoint;
+		func(prev);
+
+		Point cur = Point::invalidPoint();
+		auto visit = [&](Point next)
+		{
+			if(cur != Point::invalidPoint())
+			{
+				int dx0 = cur.mX - prev.mX;
+				int dy0 = cur.mY - prev.mY;
+				int dx1 = next.mX - cur.mX;
+				int dy1 = next.mY - cur.mY;
+				bool collinear = dx0 * dy1 == dy0 * dx1 && dx0 * dx1 + dy0 * dy1 > 0;
+				if(!collinear)
 				{
-				case StepType::DIAG:
-					stepDiag(step);
-					return IterationRes::IN_PROGRESS;
-
-				case StepType::DIAG_OFF_GRID:
-					stepDiagOffGrid(step);
-					return IterationRes::IN_PROGRESS;
-						
-				case StepType::BEAM_X:
-				case StepType::BEAM_Y:
-					stepBeam(step);
-					return IterationRes::IN_PROGRESS;
+					func(cur);
+					prev = cur;
 				}
 			}
+
+			cur = next;
+		};
+
+		Point pt = mEndPoint;
+		while(pt != mStartPoint)
+		{
+			Point parent = mClosedSet.parentOf(pt);
+			DIDA_ASSERT(parent != Point::invalidPoint());
+
+			Point via = mClosedSet.viaPointOf(pt);
+			if(via != Point::invalidPoint())
+			{
+				Point knee = segmentKnee(via, pt);
+				if(knee != Point::invalidPoint())
+					visit(knee);
+
+				visit(via);
+
+				knee = segmentKnee(parent, via);
+				if(knee != Point::invalidPoint())
+					visit(knee);
+			}
+			else
+			{
+				Point knee = segmentKnee(parent, pt);
+				if(knee != Point::invalidPoint())
+					visit(knee);
+			}
+
+			visit(parent);
+			pt = parent;
+		}
+
+		if(cur != Point::invalidPoint())
+			func(cur);
+	}
+
+	Point PathFinder::segmentKnee(Point from, Point to) const
+	{
+		int16_t dx = to.mX - from.mX;
+		int16_t dy = to.mY - from.mY;
+		int16_t diagLen = std::min(std::abs(dx), std::abs(dy));
+		if(diagLen == 0 || std::abs(dx) == std::abs(dy))
+			return Point::invalidPoint();
+
+		int16_t dirX = dx > 0 ? 1 : -1;
+		int16_t dirY = dy > 0 ? 1 : -1;
+
+		// Steps only connect points whose bounding rectangle is free around
+		// either the diagonal-first or the straight-first route, so one of
+		// them is walkable.
+		Point diagFirst(from.mX + dirX * diagLen, from.mY + dirY * diagLen);
+		if(lineWalkable(from, diagFirst) && lineWalkable(diagFirst, to))
+			return diagFirst;
+
+		Point straightFirst(to.mX - dirX * diagLen, to.mY - dirY * diagLen);
+		DIDA_ASSERT(lineWalkable(from, straightFirst) && lineWalkable(straightFirst, to));
+		return straightFirst;
+	}
+
+	bool PathFinder::lineWalkable(Point from, Point to) const
+	{
+		int16_t dirX = to.mX > from.mX ? 1 : (to.mX < from.mX ? -1 : 0);
+		int16_t dirY = to.mY > from.mY ? 1 : (to.mY < from.mY ? -1 : 0);
+
+		Point pt = from;
+		while(true)
+		{
+			if(!isFullCell(mHierarchy->cellAt(CellKey(pt, 0))))
+				return false;
+
+			if(pt == to)
+				return true;
+
+			pt.mX += dirX;
+			pt.mY += dirY;
 		}
 	}
 
+	void PathFinder::drawStep(const Step& step, DebugDraw* debugDraw) const
+	{
+		if(step.mViaPoint != Point::invalidPoint())
+		{
+			debugDraw->drawLine(step.mParentPoint, step.mViaPoint);
+			debugDraw->drawLine(step.mViaPoint, step.mPoint);
+		}
+		else
+		{
+			debugDraw->drawLine(step.mParentPoint, step.mPoint);
+		}
+	}
+
+	int PathFinder::path(Point* waypoints, int capacity) const
+	{
+		DIDA_ASSERT(mClosedSet.parentOf(mEndPoint) != Point::invalidPoint() || mEndPoint == mStartPoint);
+
+		// A path has at least the end point, so an empty mWaypoints means it
+		// wasn't collected yet.
+		if(mWaypoints.empty())
+		{
+			forEachWaypointReversed([&](Point waypoint)
+			{
+				mWaypoints.push_back(waypoint);
+			});
+
+			std::reverse(mWaypoints.begin(), mWaypoints.end());
+		}
+
+		int numWaypoints = (int)mWaypoints.size();
+		std::copy(mWaypoints.begin(), mWaypoints.begin() + std::min(numWaypoints, capacity), waypoints);
+		return numWaypoints;
+	}
+
 	void PathFinder::stepDiag(const Step& step)
 	{
 		switch(step.mCornerIndex)
@@ -126,24 +417,22 @@ namespace Hierarchy
 				nextStep.mStepType = offGrid ? StepType::DIAG_OFF_GRID : StepType::DIAG;
 				nextStep.mCornerIndex = cornerIndex;
 				nextStep.mCellKey = toCellKey;
-				nextStep.mClosedSetEdges = 0xf;
-				nextStep.mClosedSetCellKey = step.mCellKey;
 				nextStep.mParentPoint = step.mPoint;
+				nextStep.mViaPoint = Point::invalidPoint();
 				nextStep.mPoint = toPoint;
 				nextStep.mTraversedCost = step.mTraversedCost + Cost(0, 1 << step.mCellKey.mLevel);
-				validateStep(nextStep);
-				mOpenSet.push(nextStep);
+				pushStep(nextStep);
 			}
 		}
 
-		enqueueSideEdge<cornerIndex, Axis2::X>(step.mCellKey, step.mPoint, step.mTraversedCost);
-		enqueueSideEdge<cornerIndex, Axis2::Y>(step.mCellKey, step.mPoint, step.mTraversedCost);
+		enqueueSideEdge<cornerIndex, Axis2::X>(step.mCellKey, step.mPoint, step.mPoint, step.mTraversedCost);
+		enqueueSideEdge<cornerIndex, Axis2::Y>(step.mCellKey, step.mPoint, step.mPoint, step.mTraversedCost);
 
 		Point min = step.mCellKey.corner(CornerIndex::MIN_X_MIN_Y);
 		Point max = step.mCellKey.corner(CornerIndex::MAX_X_MAX_Y);
 
-		enqueueBeam<cornerIndex, Axis2::X>(step, step.mPoint, min.mY, max.mY);
-		enqueueBeam<cornerIndex, Axis2::Y>(step, step.mPoint, min.mX, max.mX);
+		enqueueBeam<cornerIndex, Axis2::X>(step, step.mPoint, step.mTraversedCost, min.mY, max.mY);
+		enqueueBeam<cornerIndex, Axis2::Y>(step, step.mPoint, step.mTraversedCost, min.mX, max.mX);
 	}
 
 	void PathFinder::stepDiagOffGrid(const Step& step)
@@ -180,22 +469,39 @@ namespace Hierarchy
 
 		{
 			// Enqueue the next off grid diag.
-			enqueueDiag<cornerIndex>(step.mCellKey, step.mPoint, step.mTraversedCost, 
-				connectionInfo.mNextCellKey, connectionInfo.mDiagEndPt, 0);
+			enqueueDiag<cornerIndex>(step.mPoint, step.mTraversedCost, 
+				connectionInfo.mNextCellKey, connectionInfo.mDiagEndPt);
 
 			// Enqueue the snapped to the grid diag.
-			enqueueDiag<cornerIndex>(step.mCellKey, step.mPoint, step.mTraversedCost, 
-				connectionInfo.mNextOnGridCellKey, connectionInfo.mOnGridPoint, 0);
+			enqueueDiag<cornerIndex>(step.mPoint, step.mTraversedCost, 
+				connectionInfo.mNextOnGridCellKey, connectionInfo.mOnGridPoint);
 		}
 
+		// The point lies on the side edge the beam touching it runs along.
 		if(connectionInfo.mXBeamTouchesSideEdge)
-			enqueueSideEdge<cornerIndex, 0>(step.mCellKey, step.mPoint, step.mTraversedCost);
+			enqueueSideEdge<cornerIndex, Axis2::X>(step.mCellKey, step.mPoint, step.mPoint, step.mTraversedCost);
 
 		if(connectionInfo.mYBeamTouchesSideEdge)
-			enqueueSideEdge<cornerIndex, 1>(step.mCellKey, step.mPoint, step.mTraversedCost);
-
-		enqueueBeam<cornerIndex, 0>(step, step.mPoint, connectionInfo.mXBeamMin, connectionInfo.mXBeamMax);
-		enqueueBeam<cornerIndex, 1>(step, step.mPoint, connectionInfo.mYBeamMin, connectionInfo.mYBeamMax);
+			enqueueSideEdge<cornerIndex, Axis2::Y>(step.mCellKey, step.mPoint, step.mPoint, step.mTraversedCost);
+
+		// The beam which doesn't touch the side edge on the corner's side
+		// extends to the opposite one, so the cells beyond that edge which the
+		// diagonal doesn't get to, because its next cell is empty, are reached
+		// around it. The diagonal gets to that edge at the last point before
+		// its end point.
+		constexpr CornerIndex xBeamOppositeCorner = (CornerIndex)((int8_t)cornerIndex ^ (1 << (int8_t)Axis2::Y));
+		constexpr CornerIndex yBeamOppositeCorner = (CornerIndex)((int8_t)cornerIndex ^ (1 << (int8_t)Axis2::X));
+		Point diagExitPoint(
+			connectionInfo.mDiagEndPt.mX - 1 + 2 * cornerOnAxis(cornerIndex, Axis2::X),
+			connectionInfo.mDiagEndPt.mY - 1 + 2 * cornerOnAxis(cornerIndex, Axis2::Y));
+		if(!connectionInfo.mXBeamTouchesSideEdge)
+			enqueueSideEdge<xBeamOppositeCorner, Axis2::X>(step.mCellKey, diagExitPoint, step.mPoint, step.mTraversedCost);
+
+		if(!connectionInfo.mYBeamTouchesSideEdge)
+			enqueueSideEdge<yBeamOppositeCorner, Axis2::Y>(step.mCellKey, diagExitPoint, step.mPoint, step.mTraversedCost);
+
+		enqueueBeam<cornerIndex, Axis2::X>(step, step.mPoint, step.mTraversedCost, connectionInfo.mXBeamMin, connectionInfo.mXBeamMax);
+		enqueueBeam<cornerIndex, Axis2::Y>(step, step.mPoint, step.mTraversedCost, connectionInfo.mYBeamMin, connectionInfo.mYBeamMax);
 	}
 
 	void PathFinder::stepBeam(const Step& step)
@@ -238,28 +544,109 @@ namespace Hierarchy
 	void PathFinder::stepBeamTempl(const Step& step)
 	{
 		constexpr Axis2 perpAxis = otherAxis(axis);
-		constexpr int8_t cornerOnAxis = ((int8_t)cornerIndex >> (int8_t)axis) & 1;
+		constexpr int8_t cornerOnPerpAxis = cornerOnAxis(cornerIndex, perpAxis);
 		constexpr CornerIndex oppositeCornerIndex = (CornerIndex)((int8_t)cornerIndex ^ (1 << (int8_t)perpAxis));
 
 		int16_t cellMin = step.mCellKey.mCoords[perpAxis] << step.mCellKey.mLevel;
 		int16_t cellMax = cellMin + (1 << step.mCellKey.mLevel) - 1;
 
-		if(cellMin == step.mBeamMin)
+		// Every point of a beam is reached in a straight line from its parent,
+		// so this recovers the cost at the parent.
+		Cost parentCost = step.mTraversedCost - Cost::distance(step.mParentPoint, step.mPoint);
+
+		// The side edge on the corner's side is reached when the beam extends
+		// to it, which is the min side of the cell for corners on the min
+		// side of perpAxis, and the max side otherwise.
+		bool reachesCornerSide = cornerOnPerpAxis == 0 ? cellMin == step.mBeamMin : cellMax == step.mBeamMax;
+		bool reachesOppositeSide = cornerOnPerpAxis == 0 ? cellMax == step.mBeamMax : cellMin == step.mBeamMin;
+
+		// The point of the beam is the corner when it reaches the corner's
+		// side, the path around that side edge goes through it from the
+		// parent.
+		if(reachesCornerSide)
+		{
+			enqueueSideEdge<cornerIndex, axis>(step.mCellKey, step.mCellKey.corner(cornerIndex), step.mParentPoint, parentCost);
+		}
+
+		if(reachesOppositeSide)
 		{
-			enqueueSideEdge<cornerIndex, axis>(step.mCellKey, step.mPoint, step.mTraversedCost);
+			enqueueSideEdge<oppositeCornerIndex, axis>(step.mCellKey, step.mCellKey.corner(oppositeCornerIndex), step.mParentPoint, parentCost);
 		}
 
-		if(cellMax == step.mBeamMax)
+		enqueueBeam<cornerIndex, axis>(step, step.mParentPoint, parentCost, step.mBeamMin, step.mBeamMax);
+	}
+
+	template <CornerIndex cornerIndex>
+	void PathFinder::enqueueStartDiag(const Step& startStep)
+	{
+		int8_t cornerX = (int8_t)cornerIndex & 1;
+		int8_t cornerY = (int8_t)cornerIndex >> 1;
+		int16_t dirX = 1 - 2 * cornerX;
+		int16_t dirY = 1 - 2 * cornerY;
+
+		// Follow the diagonal from the start point until it leaves the start
+		// cell, which happens through the edges opposite to cornerIndex.
+		Point farCorner = startStep.mCellKey.corner((CornerIndex)((int8_t)cornerIndex ^ 3));
+		int16_t len = std::min(
+			std::abs(farCorner.mX - startStep.mPoint.mX),
+			std::abs(farCorner.mY - startStep.mPoint.mY)) + 1;
+
+		Point toPoint(
+			startStep.mPoint.mX + dirX * len,
+			startStep.mPoint.mY + dirY * len);
+		if(toPoint.mX < 0 || toPoint.mX >= mHierarchy->width() ||
+			toPoint.mY < 0 || toPoint.mY >= mHierarchy->height())
 		{
-			enqueueSideEdge<oppositeCornerIndex, axis>(step.mCellKey, step.mParentPoint, step.mTraversedCost);
+			return;
 		}
 
-		enqueueBeam<cornerIndex, axis>(step, step.mParentPoint, step.mBeamMin, step.mBeamMax);
+		enqueueDiag<cornerIndex>(startStep.mPoint, startStep.mTraversedCost, CellKey(toPoint, 0), toPoint);
 	}
 
 	template <CornerIndex cornerIndex>
-	void PathFinder::enqueueDiag(CellKey cellKey, Point parentPoint, Cost costToParent,
-		CellKey toCellKey, Point toPoint, uint8_t closedSetEdges)
+	void PathFinder::expandStartCorner(const Step& startStep, DebugDraw* debugDraw)
+	{
+		constexpr CornerIndex outwardCornerIndex = (CornerIndex)((int8_t)cornerIndex ^ 3);
+
+		int8_t cornerX = (int8_t)cornerIndex & 1;
+		int8_t cornerY = (int8_t)cornerIndex >> 1;
+
+		Step cornerStep;
+		cornerStep.mStepType = StepType::DIAG;
+		cornerStep.mCornerIndex = cornerIndex;
+		cornerStep.mCellKey = startStep.mCellKey;
+		cornerStep.mPoint = startStep.mCellKey.corner(cornerIndex);
+		cornerStep.mParentPoint = startStep.mPoint;
+		cornerStep.mViaPoint = Point::invalidPoint();
+		cornerStep.mTraversedCost = startStep.mTraversedCost + Cost::distance(startStep.mPoint, cornerStep.mPoint);
+		validateStep(cornerStep);
+
+		// Expanded right away rather than pushed, since the start cell's edges
+		// are in the closed set already.
+		uint64_t cornerCost = cornerStep.mTraversedCost.toFixedPoint();
+		mClosedSet.tryExpandCorner(cornerStep.mPoint, cornerIndex, cornerCost);
+		if(cornerStep.mPoint != startStep.mPoint &&
+			mClosedSet.tryAddPoint(cornerStep.mPoint, startStep.mPoint, Point::invalidPoint(), cornerCost) &&
+			debugDraw)
+		{
+			debugDraw->drawLine(startStep.mPoint, cornerStep.mPoint);
+		}
+
+		stepDiagTempl<cornerIndex>(cornerStep);
+
+		// The diagonal leaving the start cell through this corner.
+		Point toPoint(
+			cornerStep.mPoint.mX + 2 * cornerX - 1,
+			cornerStep.mPoint.mY + 2 * cornerY - 1);
+		if(toPoint.mX >= 0 && toPoint.mX < mHierarchy->width() &&
+			toPoint.mY >= 0 && toPoint.mY < mHierarchy->height())
+		{
+			enqueueDiag<outwardCornerIndex>(cornerStep.mPoint, cornerStep.mTraversedCost, CellKey(toPoint, 0), toPoint);
+		}
+	}
+
+	template <CornerIndex cornerIndex>
+	void PathFinder::enqueueDiag(Point parentPoint, Cost costToParent, CellKey toCellKey, Point toPoint)
 	{
 		toCellKey = mHierarchy->topLevelCellContainingCorner(toCellKey, cornerIndex);
 		if(isEmptyCell(mHierarchy->cellAt(toCellKey)))
@@ -275,24 +662,60 @@ namespace Hierarchy
 			nextStep.mStepType = offGrid ? StepType::DIAG_OFF_GRID : StepType::DIAG;
 			nextStep.mCornerIndex = cornerIndex;
 			nextStep.mCellKey = toCellKey;
-			nextStep.mClosedSetEdges = closedSetEdges;
-			nextStep.mClosedSetCellKey = cellKey;
 			nextStep.mParentPoint = parentPoint;
+			nextStep.mViaPoint = Point::invalidPoint();
 			nextStep.mPoint = toPoint;
 			nextStep.mTraversedCost = costToParent + Cost::distance(parentPoint, toPoint);
-			validateStep(nextStep);
-			mOpenSet.push(nextStep);
+			pushStep(nextStep);
 		}
 	}
 
 	template <CornerIndex cornerIndex, Axis2 axis>
-	void PathFinder::enqueueBeam(const Step& step, Point parentPoint, int16_t beamMin, int16_t beamMax)
+	void PathFinder::enqueueBeam(const Step& step, Point parentPoint, Cost parentCost, int16_t beamMin, int16_t beamMax)
 	{
-		int8_t cornerX = (int8_t)cornerIndex & 1;
-		int8_t cornerY = (int8_t)cornerIndex >> 1;
 		int8_t cornerOnAxis = ((int8_t)cornerIndex >> (int8_t)axis) & 1;
 		constexpr Axis2 perpAxis = otherAxis(axis);
 
+		// The boundary cells are visited towards the negative side when the
+		// corner is on the positive side of perpAxis.
+		constexpr bool towardsPositive = (((int8_t)cornerIndex >> (int8_t)perpAxis) & 1) == 0;
+
+		constexpr EdgeIndex edge = (EdgeIndex)((int8_t)axis + 2 * (1 - (((int8_t)cornerIndex >> (int8_t)axis) & 1)));
+		const AdjacentCell* adjBegin;
+		const AdjacentCell* adjEnd;
+		if(mHierarchy->adjacentCells(step.mCellKey, edge, adjBegin, adjEnd))
+		{
+			if(towardsPositive)
+			{
+				const AdjacentCell* adjCell = std::lower_bound(adjBegin, adjEnd, beamMin,
+					[](const AdjacentCell& cell, int16_t coord) { return cell.mMax < coord; });
+				for(; adjCell != adjEnd && adjCell->mMin <= beamMax; adjCell++)
+				{
+					if(adjCell->mFull)
+					{
+						enqueueBeamCell<cornerIndex, axis>(step, parentPoint, parentCost, adjCell->cellKey(),
+							std::max(beamMin, adjCell->mMin), std::min(beamMax, adjCell->mMax));
+					}
+				}
+			}
+			else
+			{
+				const AdjacentCell* adjCell = std::upper_bound(adjBegin, adjEnd, beamMax,
+					[](int16_t coord, const AdjacentCell& cell) { return coord < cell.mMin; });
+				while(adjCell != adjBegin && (adjCell - 1)->mMax >= beamMin)
+				{
+					adjCell--;
+					if(adjCell->mFull)
+					{
+						enqueueBeamCell<cornerIndex, axis>(step, parentPoint, parentCost, adjCell->cellKey(),
+							std::max(beamMin, adjCell->mMin), std::min(beamMax, adjCell->mMax));
+					}
+				}
+			}
+
+			return;
+		}
+
 		CellKey nextCellKey = step.mCellKey;
 		nextCellKey.mCoords[axis] += 1 - 2 * cornerOnAxis;
 
@@ -300,43 +723,38 @@ namespace Hierarchy
 		if(nextCell == Cell::PARTIAL)
 		{
 			Hierarchy::BoundaryCellIterator<cornerIndex, perpAxis> it(
-				mHierarchy, nextCellKey, beamMin);
+				mHierarchy, nextCellKey, towardsPositive ? beamMin : beamMax);
 			while(it.moveNext())
 			{
 				CellKey childCellKey = it.cell();
 				int16_t childMin = childCellKey.mCoords[perpAxis] << childCellKey.mLevel;
-				if(childMin > beamMax)
+				int16_t childMax = childMin + (1 << childCellKey.mLevel) - 1;
+				if(towardsPositive ? childMin > beamMax : childMax < beamMin)
 				{
 					break;
 				}
 
-				int16_t childMax = childMin + (1 << childCellKey.mLevel) - 1;
-
-				enqueueBeamCell<cornerIndex, axis>(step, parentPoint, childCellKey, 
+				enqueueBeamCell<cornerIndex, axis>(step, parentPoint, parentCost, childCellKey, 
 					std::max(beamMin, childMin), std::min(beamMax, childMax));
 			}
 		}
 		else if(isFullCell(nextCell))
 		{
-			while(isLevelUpCell(nextCell))
-			{
-				nextCellKey.mCoords >>= 1;
-				nextCellKey.mLevel++;
-				nextCell = mHierarchy->cellAt(nextCellKey);
-			}
+			if(isLevelUpCell(nextCell))
+				nextCellKey = mHierarchy->topLevelCellContaining(nextCellKey);
 
-			enqueueBeamCell<cornerIndex, axis>(step, parentPoint, nextCellKey, beamMin, beamMax);
+			enqueueBeamCell<cornerIndex, axis>(step, parentPoint, parentCost, nextCellKey, beamMin, beamMax);
 		}
 	}
 
 	template <CornerIndex cornerIndex, Axis2 axis>
-	void PathFinder::enqueueBeamCell(const Step& step, Point parentPoint, CellKey nextCellKey, int16_t beamMin, int16_t beamMax)
+	void PathFinder::enqueueBeamCell(const Step& step, Point parentPoint, Cost parentCost, CellKey nextCellKey, int16_t beamMin, int16_t beamMax)
 	{
 		constexpr Axis2 perpAxis = otherAxis(axis);
 		constexpr int8_t cornerOnPerpAxis = cornerOnAxis(cornerIndex, perpAxis);
 
-		int16_t cellMin = nextCellKey.mCoords[perpAxis] << nextCellKey.mLevel;
-		int16_t cellMax = cellMin + (1 << nextCellKey.mLevel) - 1;
+		DIDA_ON_DEBUG(int16_t cellMin = nextCellKey.mCoords[perpAxis] << nextCellKey.mLevel);
+		DIDA_ON_DEBUG(int16_t cellMax = cellMin + (1 << nextCellKey.mLevel) - 1);
 
 		DIDA_ASSERT(beamMin >= cellMin);
 		DIDA_ASSERT(beamMax <= cellMax);
@@ -357,21 +775,19 @@ namespace Hierarchy
 				nextStep.mStepType = axis == Axis2::X ? StepType::BEAM_X : StepType::BEAM_Y;
 				nextStep.mCornerIndex = cornerIndex;
 				nextStep.mCellKey = nextCellKey;
-				nextStep.mClosedSetEdges = 0;
-				nextStep.mClosedSetCellKey = step.mCellKey;
 				nextStep.mPoint = point;
 				nextStep.mParentPoint = parentPoint;
+				nextStep.mViaPoint = Point::invalidPoint();
 				nextStep.mBeamMin = beamMin;
 				nextStep.mBeamMax = beamMax;
-				nextStep.mTraversedCost = step.mTraversedCost + Cost::distance(step.mPoint, point);
-				validateStep(nextStep);
-				mOpenSet.push(nextStep);
+				nextStep.mTraversedCost = parentCost + Cost::distance(parentPoint, point);
+				pushStep(nextStep);
 			}
 		}
 	}
 	
 	template <CornerIndex cornerIndex, Axis2 beamAxis>
-	void PathFinder::enqueueSideEdge(CellKey cellKey, Point parentPoint, Cost costToParent)
+	void PathFinder::enqueueSideEdge(CellKey cellKey, Point fromPoint, Point parentPoint, Cost costToParent)
 	{
 		constexpr Axis2 sideEdgeAxis = otherAxis(beamAxis);
 		constexpr int8_t sideEdgeSide = ((int8_t)cornerIndex >> (int8_t)sideEdgeAxis) & 1;
@@ -379,62 +795,95 @@ namespace Hierarchy
 
 		constexpr CornerIndex oppositeCorner = (CornerIndex)((int8_t)cornerIndex ^ (1 << (int8_t)sideEdgeAxis));
 		
+		// The steps enqueued here go from the parent to fromPoint, and from
+		// there along and around the side edge. The cells along the side edge
+		// are visited from the corner on, but only the ones ahead of fromPoint
+		// can be wrapped around.
+		Point cornerPoint = cellKey.corner(cornerIndex);
+		Cost costToFromPoint = costToParent + Cost::distance(parentPoint, fromPoint);
+		int16_t fromLen = std::abs(fromPoint[beamAxis] - cornerPoint[beamAxis]);
+		DIDA_ASSERT(fromPoint[sideEdgeAxis] == cornerPoint[sideEdgeAxis]);
+
 		CellKey neighborCellKey = cellKey;
 		neighborCellKey.mCoords[sideEdgeAxis] += 2 * sideEdgeSide - 1;
 
-		Cell neighborCell = mHierarchy->cellAt(neighborCellKey);
-
 		bool prevEmpty = false;
-
 		int16_t len = 0;
-		if(neighborCell == Cell::PARTIAL)
+
+		// Visits the cells along the side edge in beamDir order, a diagonal
+		// step is enqueued to every full cell which follows an empty cell.
+		auto visitSideEdgeCell = [&](CellKey diagCellKey, bool full, int16_t size)
 		{
-			Hierarchy::BoundaryCellIterator<oppositeCorner, beamAxis> it(mHierarchy, neighborCellKey);
-			while(it.moveNext())
+			if(full)
 			{
-				CellKey diagCellKey = it.cell();
-				Cell diagCell = mHierarchy->cellAt(diagCellKey);
-				if(diagCell == Cell::FULL)
+				if(prevEmpty && len > fromLen)
 				{
-					if(prevEmpty)
+					Point point = cornerPoint;
+					point[sideEdgeAxis] += 2 * sideEdgeSide - 1;
+					if(beamDir == OnEdgeDir::TOWARDS_POSITIVE)
+						point[beamAxis] += len;
+					else
+						point[beamAxis] -= len;
+
+					if(!mClosedSet.pointTraversed(diagCellKey, point))
 					{
-						Point point = cellKey.corner(cornerIndex);
-						point[sideEdgeAxis] += 2 * sideEdgeSide - 1;
-						if(beamDir == OnEdgeDir::TOWARDS_POSITIVE)
-							point[beamAxis] += len;
-						else
-							point[beamAxis] -= len;
-
-						if(!mClosedSet.pointTraversed(diagCellKey, point))
-						{
-							Step nextStep;
-							nextStep.mStepType = StepType::DIAG;
-							nextStep.mCornerIndex = oppositeCorner;
-							nextStep.mCellKey = diagCellKey;
-							nextStep.mClosedSetEdges = 0;
-							nextStep.mPoint = point;
-							nextStep.mParentPoint = parentPoint;
-							nextStep.mTraversedCost = costToParent + Cost(len, 0);
-							validateStep(nextStep);
-							mOpenSet.push(nextStep);
-						}
-
-						prevEmpty = false;
+						Step nextStep;
+						nextStep.mStepType = StepType::DIAG;
+						nextStep.mCornerIndex = oppositeCorner;
+						nextStep.mCellKey = diagCellKey;
+						nextStep.mPoint = point;
+						nextStep.mParentPoint = parentPoint;
+						nextStep.mViaPoint = fromPoint != parentPoint ? fromPoint : Point::invalidPoint();
+						nextStep.mTraversedCost = costToFromPoint + Cost::distance(fromPoint, point);
+						pushStep(nextStep);
 					}
+
+					prevEmpty = false;
 				}
-				else
-				{
-					DIDA_ASSERT(diagCell == Cell::EMPTY);
-					prevEmpty = true;
-				}
+			}
+			else
+			{
+				prevEmpty = true;
+			}
 
-				len += 1 << diagCellKey.mLevel;
+			len += size;
+		};
+
+		constexpr EdgeIndex sideEdge = (EdgeIndex)((int8_t)sideEdgeAxis + 2 * sideEdgeSide);
+		const AdjacentCell* adjBegin;
+		const AdjacentCell* adjEnd;
+		if(mHierarchy->adjacentCells(cellKey, sideEdge, adjBegin, adjEnd))
+		{
+			if(beamDir == OnEdgeDir::TOWARDS_POSITIVE)
+			{
+				for(const AdjacentCell* adjCell = adjBegin; adjCell != adjEnd; adjCell++)
+					visitSideEdgeCell(adjCell->cellKey(), adjCell->mFull, adjCell->mMax - adjCell->mMin + 1);
+			}
+			else
+			{
+				for(const AdjacentCell* adjCell = adjEnd; adjCell != adjBegin; adjCell--)
+					visitSideEdgeCell((adjCell - 1)->cellKey(), (adjCell - 1)->mFull, (adjCell - 1)->mMax - (adjCell - 1)->mMin + 1);
 			}
 		}
 		else
 		{
-			prevEmpty = isEmptyCell(neighborCell);
-			len += 1 << cellKey.mLevel;
+			Cell neighborCell = mHierarchy->cellAt(neighborCellKey);
+			if(neighborCell == Cell::PARTIAL)
+			{
+				Hierarchy::BoundaryCellIterator<oppositeCorner, beamAxis> it(mHierarchy, neighborCellKey);
+				while(it.moveNext())
+				{
+					CellKey diagCellKey = it.cell();
+					Cell diagCell = mHierarchy->cellAt(diagCellKey);
+					DIDA_ASSERT(diagCell == Cell::FULL || diagCell == Cell::EMPTY);
+					visitSideEdgeCell(diagCellKey, diagCell == Cell::FULL, 1 << diagCellKey.mLevel);
+				}
+			}
+			else
+			{
+				prevEmpty = isEmptyCell(neighborCell);
+				len += 1 << cellKey.mLevel;
+			}
 		}
 
 		if(prevEmpty)
@@ -449,7 +898,7 @@ namespace Hierarchy
 
 			if(mHierarchy->cellAt(diagCellKey) == Cell::FULL)
 			{
-				Point point = cellKey.corner(cornerIndex);
+				Point point = cornerPoint;
 				point[sideEdgeAxis] += 2 * sideEdgeSide - 1;
 				if(beamDir == OnEdgeDir::TOWARDS_POSITIVE)
 					point[beamAxis] += len;
@@ -464,12 +913,11 @@ namespace Hierarchy
 					nextStep.mStepType = offGrid ? StepType::DIAG_OFF_GRID : StepType::DIAG;
 					nextStep.mCornerIndex = oppositeCorner;
 					nextStep.mCellKey = diagCellKey;
-					nextStep.mClosedSetEdges = 0;
 					nextStep.mPoint = point;
 					nextStep.mParentPoint = parentPoint;
-					nextStep.mTraversedCost = costToParent + Cost(len, 0);
-					validateStep(nextStep);
-					mOpenSet.push(nextStep);
+					nextStep.mViaPoint = fromPoint != parentPoint ? fromPoint : Point::invalidPoint();
+					nextStep.mTraversedCost = costToFromPoint + Cost::distance(fromPoint, point);
+					pushStep(nextStep);
 				}
 			}
 		}
@@ -583,18 +1031,268 @@ namespace Hierarchy
 		mNextOnGridCellKey.mCoords.mX += 1 - 2 * cornerX;
 		mNextOnGridCellKey.mCoords.mY += 1 - 2 * cornerY;
 
-		mOnGridPoint = mNextCellKey.corner(cornerIndex);
+		mOnGridPoint = mNextOnGridCellKey.corner(cornerIndex);
 		mNextOnGridCellKey = hierarchy.topLevelCellContainingCorner(mNextOnGridCellKey, cornerIndex);
 	}
 
-	void PathFinder::validateStep(const Step& step) const
+	void PathFinder::enqueueEnd(const Step& step)
 	{
-		int axis = (int)step.mStepType - (int)StepType::BEAM_X;
+		// The step lies on the boundary of the end cell, which is full, so the
+		// end point can be reached from it in a straight line.
+		Step nextStep;
+		nextStep.mStepType = StepType::END;
+		nextStep.mCornerIndex = step.mCornerIndex;
+		nextStep.mCellKey = mEndCellKey;
+		nextStep.mPoint = mEndPoint;
+
+		if(step.mStepType == StepType::BEAM_X || step.mStepType == StepType::BEAM_Y)
+		{
+			// Every point of the beam's edge can be the one the path enters the
+			// end cell at, so the path goes through the one which makes it
+			// shortest.
+			Point viaPoint = beamPointTowards(step, mEndPoint);
+			Cost parentCost = step.mTraversedCost - Cost::distance(step.mParentPoint, step.mPoint);
+
+			nextStep.mParentPoint = step.mParentPoint;
+			nextStep.mViaPoint = viaPoint != mEndPoint ? viaPoint : Point::invalidPoint();
+			nextStep.mTraversedCost = parentCost + Cost::distance(step.mParentPoint, viaPoint) + Cost::distance(viaPoint, mEndPoint);
+		}
+		else
+		{
+			nextStep.mParentPoint = step.mPoint;
+			nextStep.mViaPoint = Point::invalidPoint();
+			nextStep.mTraversedCost = step.mTraversedCost + Cost::distance(step.mPoint, mEndPoint);
+		}
+
+		pushStep(nextStep);
+	}
+
+	Point PathFinder::beamPointTowards(const Step& step, Point target) const
+	{
+		DIDA_ASSERT(step.mStepType == StepType::BEAM_X || step.mStepType == StepType::BEAM_Y);
+
+		if(step.mBeamMin == step.mBeamMax)
+			return step.mPoint;
+
+		int axis = step.mStepType == StepType::BEAM_X ? 0 : 1;
 		int perpAxis = axis ^ 1;
 
-		Point cellMin = step.mCellKey.corner(CornerIndex::MIN_X_MIN_Y);
-		Point cellMax = step.mCellKey.corner(CornerIndex::MAX_X_MAX_Y);
-		Point cornerPt = step.mCellKey.corner(step.mCornerIndex);
+		// The length of the path through the edge is a convex piecewise linear
+		// function of the point's perpAxis coordinate, which only bends where
+		// the parent or the target is straight or diagonal from the point, so
+		// its minimum is at one of those coordinates or at an end of the edge.
+		int16_t parentAxisDist = std::abs(step.mParentPoint[axis] - step.mPoint[axis]);
+		int16_t targetAxisDist = std::abs(target[axis] - step.mPoint[axis]);
+		int16_t candidates[] =
+		{
+			step.mBeamMin,
+			step.mBeamMax,
+			step.mParentPoint[perpAxis],
+			(int16_t)(step.mParentPoint[perpAxis] - parentAxisDist),
+			(int16_t)(step.mParentPoint[perpAxis] + parentAxisDist),
+			target[perpAxis],
+			(int16_t)(target[perpAxis] - targetAxisDist),
+			(int16_t)(target[perpAxis] + targetAxisDist),
+		};
+
+		Point bestPoint = step.mPoint;
+		uint64_t bestLength = UINT64_MAX;
+		for(int16_t candidate : candidates)
+		{
+			Point point = step.mPoint;
+			point[perpAxis] = std::min(std::max(candidate, step.mBeamMin), step.mBeamMax);
+
+			uint64_t length = (Cost::distance(step.mParentPoint, point) + Cost::distance(point, target)).toFixedPoint();
+			if(length < bestLength)
+			{
+				bestPoint = point;
+				bestLength = length;
+			}
+		}
+
+		return bestPoint;
+	}
+
+	void PathFinder::reset()
+	{
+		// Only empties the containers, their storage is kept for the next
+		// query.
+		mOpenSet.clear();
+		mSteps.clear();
+		mStepCosts.clear();
+		mFreeSteps.clear();
+		mClosedSet.clear();
+		mWaypoints.clear();
+
+		mPoppedKey = 0;
+		mNumPushed = 0;
+		mNumPopped = 0;
+	}
+
+	PathFinder::Stats PathFinder::stats() const
+	{
+		// Slots of popped steps are reused, so mSteps only grows when the
+		// open set is larger than ever before.
+		Stats stats;
+		stats.mNumPushed = mNumPushed;
+		stats.mNumPopped = mNumPopped;
+		stats.mPeakOpenSize = mSteps.size();
+		stats.mClosedSetSize = mClosedSet.numPoints();
+		return stats;
+	}
+
+	void PathFinder::pushStep(const Step& step)
+	{
+		validateStep(step);
+
+		// Octile distance never overestimates. A beam continues from its
+		// parent through any point of its edge, so its estimate is that of the
+		// point of the edge the path to the end point is shortest through.
+		Cost estimatedCost = step.mTraversedCost;
+		if(mEndPoint != Point::invalidPoint())
+		{
+			if(step.mStepType == StepType::BEAM_X || step.mStepType == StepType::BEAM_Y)
+			{
+				Point point = beamPointTowards(step, mEndPoint);
+				estimatedCost = estimatedCost - Cost::distance(step.mParentPoint, step.mPoint) +
+					Cost::distance(step.mParentPoint, point) + Cost::distance(point, mEndPoint);
+			}
+			else
+			{
+				estimatedCost = estimatedCost + Cost::distance(step.mPoint, mEndPoint);
+			}
+		}
+
+		uint32_t stepIndex;
+		if(!mFreeSteps.empty())
+		{
+			stepIndex = mFreeSteps.back();
+			mFreeSteps.pop_back();
+		}
+		else
+		{
+			stepIndex = (uint32_t)mSteps.size();
+			mSteps.emplace_back();
+			mStepCosts.emplace_back();
+		}
+
+		packStep(step, mSteps[stepIndex]);
+		mStepCosts[stepIndex] = step.mTraversedCost;
+
+		// Raising the key to that of the step being expanded keeps the heap
+		// monotone, and since that key is itself a lower bound on any path
+		// through the parent, the raised key still is one.
+		mOpenSet.push(std::max(estimatedCost.toFixedPoint(), mPoppedKey), stepIndex);
+		mNumPushed++;
+	}
+
+	void PathFinder::popStep(Step& step)
+	{
+		mPoppedKey = mOpenSet.topKey();
+		uint32_t stepIndex = mOpenSet.pop();
+		unpackStep(mSteps[stepIndex], step);
+		step.mTraversedCost = mStepCosts[stepIndex];
+		mFreeSteps.push_back(stepIndex);
+		mNumPopped++;
+	}
+
+	void PathFinder::packStep(const Step& step, PackedStep& packedStep)
+	{
+		packedStep.mPoint = step.mPoint;
+		packedStep.mParentPoint = step.mParentPoint;
+		packedStep.mCellCoords = step.mStepType == StepType::END ? step.mViaPoint : step.mCellKey.mCoords;
+		packedStep.mLevel = step.mCellKey.mLevel;
+		packedStep.mFlags = (uint8_t)step.mStepType | ((uint8_t)step.mCornerIndex << 3);
+
+		if(step.mStepType == StepType::BEAM_X || step.mStepType == StepType::BEAM_Y)
+		{
+			Axis2 perpAxis = step.mStepType == StepType::BEAM_X ? Axis2::Y : Axis2::X;
+			if(cornerOnAxis(step.mCornerIndex, perpAxis) == 0)
+			{
+				DIDA_ASSERT(step.mPoint[perpAxis] == step.mBeamMin);
+				packedStep.mBeamFarExtent = step.mBeamMax;
+			}
+			else
+			{
+				DIDA_ASSERT(step.mPoint[perpAxis] == step.mBeamMax);
+				packedStep.mBeamFarExtent = step.mBeamMin;
+			}
+		}
+
+		if(step.mViaPoint != Point::invalidPoint() && step.mStepType != StepType::END)
+		{
+			// Only side edge steps have a via point, and those are never beams,
+			// so mBeamFarExtent is free, see unpackStep.
+			DIDA_ASSERT(step.mStepType == StepType::DIAG || step.mStepType == StepType::DIAG_OFF_GRID);
+
+			// When the offsets along both axes fit the side edge axis, either
+			// choice decodes to the same via point.
+			Axis2 sideEdgeAxis = step.mPoint.mX - step.mViaPoint.mX == 1 - 2 * cornerOnAxis(step.mCornerIndex, Axis2::X) ?
+				Axis2::X : Axis2::Y;
+			Axis2 beamAxis = otherAxis(sideEdgeAxis);
+
+			packedStep.mFlags |= (1 << 6) | ((uint8_t)sideEdgeAxis << 7);
+			packedStep.mBeamFarExtent = step.mPoint[beamAxis] - step.mViaPoint[beamAxis];
+
+			DIDA_ON_DEBUG(Step unpacked);
+			DIDA_ON_DEBUG(unpackStep(packedStep, unpacked));
+			DIDA_ASSERT(unpacked.mViaPoint == step.mViaPoint);
+		}
+	}
+
+	void PathFinder::unpackStep(const PackedStep& packedStep, Step& step)
+	{
+		step.mStepType = (StepType)(packedStep.mFlags & 7);
+		step.mCornerIndex = (CornerIndex)((packedStep.mFlags >> 3) & 3);
+		step.mCellKey = CellKey(packedStep.mCellCoords, packedStep.mLevel);
+		step.mPoint = packedStep.mPoint;
+		step.mParentPoint = packedStep.mParentPoint;
+
+		if(step.mStepType == StepType::BEAM_X || step.mStepType == StepType::BEAM_Y)
+		{
+			Axis2 perpAxis = step.mStepType == StepType::BEAM_X ? Axis2::Y : Axis2::X;
+			if(cornerOnAxis(step.mCornerIndex, perpAxis) == 0)
+			{
+				step.mBeamMin = step.mPoint[perpAxis];
+				step.mBeamMax = packedStep.mBeamFarExtent;
+			}
+			else
+			{
+				step.mBeamMin = packedStep.mBeamFarExtent;
+				step.mBeamMax = step.mPoint[perpAxis];
+			}
+		}
+
+		if(packedStep.mFlags & (1 << 6))
+		{
+			// The via point is the corner of a side edge, which lies one pixel
+			// behind mPoint on the side edge axis, and mBeamFarExtent pixels
+			// behind it on the other axis.
+			Axis2 sideEdgeAxis = (Axis2)(packedStep.mFlags >> 7);
+			Axis2 beamAxis = otherAxis(sideEdgeAxis);
+
+			step.mViaPoint[sideEdgeAxis] = step.mPoint[sideEdgeAxis] - 1 + 2 * cornerOnAxis(step.mCornerIndex, sideEdgeAxis);
+			step.mViaPoint[beamAxis] = step.mPoint[beamAxis] - packedStep.mBeamFarExtent;
+		}
+		else if(step.mStepType == StepType::END)
+		{
+			step.mCellKey = CellKey::invalidCellKey();
+			step.mViaPoint = packedStep.mCellCoords;
+		}
+		else
+		{
+			step.mViaPoint = Point::invalidPoint();
+		}
+	}
+
+	void PathFinder::validateStep(const Step& step) const
+	{
+		DIDA_ON_DEBUG(int axis = (int)step.mStepType - (int)StepType::BEAM_X);
+		DIDA_ON_DEBUG(int perpAxis = axis ^ 1);
+
+		DIDA_ON_DEBUG(Point cellMin = step.mCellKey.corner(CornerIndex::MIN_X_MIN_Y));
+		DIDA_ON_DEBUG(Point cellMax = step.mCellKey.corner(CornerIndex::MAX_X_MAX_Y));
+		DIDA_ON_DEBUG(Point cornerPt = step.mCellKey.corner(step.mCornerIndex));
 
 		// step.mPoint must lie inside the cell.
 		DIDA_ASSERT(step.mPoint.mX >= cellMin.mX && step.mPoint.mX <= cellMax.mX);
@@ -616,6 +1314,10 @@ namespace Hierarchy
 			DIDA_ASSERT(step.mBeamMin >= cellMin[perpAxis]);
 			DIDA_ASSERT(step.mBeamMax <= cellMax[perpAxis]);
 			break;
+
+		case StepType::END:
+			DIDA_ASSERT(step.mPoint == mEndPoint);
+			break;
 		}
 	}
 }
\ No newline at end of file
@@ -1,11 +1,11 @@
 #pragma once
 
-#include <queue>
 #include <map>
 #include <set>
 
 #include "Hierarchy.h"
 #include "ClosedSet.h"
+#include "RadixHeap.h"
 #include "DebugDraw.h"
 
 namespace Hierarchy
@@ -67,6 +67,7 @@ namespace Hierarchy
 			DIAG_OFF_GRID,
 			BEAM_X,
 			BEAM_Y,
+			END,
 		};
 
 		struct Step
@@ -76,21 +77,19 @@ namespace Hierarchy
 
 			CellKey mCellKey;
 
-			uint8_t mClosedSetEdges;
-			CellKey mClosedSetCellKey;
-
 			Point mPoint;
 			Point mParentPoint;
 
+			// The corner a side edge step wraps around on its way from
+			// mParentPoint, or the point an END step enters the end cell at
+			// through a beam, or Point::invalidPoint() if the step goes
+			// straight from mParentPoint to mPoint.
+			Point mViaPoint;
+
 			int16_t mBeamMin;
 			int16_t mBeamMax;
 			
 			Cost mTraversedCost;
-
-			bool operator < (const Step& b) const
-			{
-				return mTraversedCost > b.mTraversedCost;
-			}
 		};
 
 		IterationRes begin(const CellAndCorner& root);
@@ -98,6 +97,35 @@ namespace Hierarchy
 
 		IterationRes iteration(DebugDraw* debugDraw);
 
+		// The cost of the path to the end point, only valid after begin or
+		// iteration returned END_REACHED.
+		Cost endCost() const { return mEndCost; }
+
+		// Writes the waypoints of the path from the start point to the end
+		// point into waypoints, starting with the start point and ending with
+		// the end point. Consecutive waypoints are connected by a straight or
+		// diagonal line, and points which lie on such a line between their
+		// neighbors are left out. Only valid after begin or iteration
+		// returned END_REACHED. Returns the number of waypoints of the path, if
+		// that's larger than capacity, only the first capacity waypoints are
+		// written. The waypoints are collected on the first call after a
+		// query, later calls only copy them.
+		int path(Point* waypoints, int capacity) const;
+
+		// Counters of the query started by the last call to begin.
+		struct Stats
+		{
+			uint64_t mNumPushed;
+			uint64_t mNumPopped;
+
+			// The largest number of steps in the open set at once.
+			size_t mPeakOpenSize;
+
+			size_t mClosedSetSize;
+		};
+
+		Stats stats() const;
+
 	private:
 		void stepDiag(const Step& step);
 
@@ -115,19 +143,79 @@ namespace Hierarchy
 		void stepBeamTempl(const Step& step);
 
 		template <CornerIndex cornerIndex>
-		void enqueueDiag(CellKey cellKey, Point parentPoint, Cost costToParent,
-			CellKey toCellKey, Point toPoint, uint8_t closedSetEdges);
+		void enqueueStartDiag(const Step& startStep);
+
+		template <CornerIndex cornerIndex>
+		void expandStartCorner(const Step& startStep, DebugDraw* debugDraw);
+
+		template <CornerIndex cornerIndex>
+		void enqueueDiag(Point parentPoint, Cost costToParent, CellKey toCellKey, Point toPoint);
 
 		template <CornerIndex cornerIndex, Axis2 axis>
-		void enqueueBeam(const Step& step, Point parentPoint, int16_t beamMin, int16_t beamMax);
+		void enqueueBeam(const Step& step, Point parentPoint, Cost parentCost, int16_t beamMin, int16_t beamMax);
 
 		template <CornerIndex cornerIndex, Axis2 axis>
-		void enqueueBeamCell(const Step& step, Point parentPoint, CellKey nextCellKey, int16_t beamMin, int16_t beamMax);
+		void enqueueBeamCell(const Step& step, Point parentPoint, Cost parentCost, CellKey nextCellKey, int16_t beamMin, int16_t beamMax);
 
+		// Enqueues the paths which follow the side edge of cellKey from
+		// fromPoint, which lies on it, in the beam direction of cornerIndex,
+		// and wrap around the ends of the empty cells next to it.
 		template <CornerIndex cornerIndex, Axis2 beamAxis>
-		void enqueueSideEdge(CellKey cellKey, Point parentPoint, Cost costToParent);
+		void enqueueSideEdge(CellKey cellKey, Point fromPoint, Point parentPoint, Cost costToParent);
+
+		void enqueueEnd(const Step& step);
+
+		// The point on the near edge of a beam's cell through which the path
+		// from the beam's parent to target is shortest.
+		Point beamPointTowards(const Step& step, Point target) const;
+
+		void reset();
+
+		// The representation of a step in the open set. A beam's near extent is
+		// implied by mPoint, so only the far extent is stored.
+		struct PackedStep
+		{
+			Point mPoint;
+			Point mParentPoint;
+
+			// END steps are always in mEndCellKey, so instead of their cell's
+			// coordinates, this holds their via point.
+			Point mCellCoords;
+
+			uint8_t mLevel;
+
+			// The StepType in bits 0-2, the CornerIndex in bits 3-4, whether
+			// a DIAG or DIAG_OFF_GRID step has a via point in bit 6, and the
+			// via point's side edge axis in bit 7.
+			uint8_t mFlags;
+
+			// The far extent of a beam, or the offset of mPoint from the via
+			// point along the beam axis.
+			int16_t mBeamFarExtent;
+		};
+
+		static_assert(sizeof(PackedStep) == 16, "PackedStep should stay 16 bytes");
+
+		static void packStep(const Step& step, PackedStep& packedStep);
+		static void unpackStep(const PackedStep& packedStep, Step& step);
+
+		void pushStep(const Step& step);
+		void popStep(Step& step);
 
 		void validateStep(const Step& step) const;
+
+		void drawStep(const Step& step, DebugDraw* debugDraw) const;
+
+		// The point where a path from from to to turns from diagonal to
+		// straight or the other way around, or Point::invalidPoint() if it's
+		// purely straight or diagonal.
+		Point segmentKnee(Point from, Point to) const;
+
+		// Whether all level 0 cells on a straight or diagonal line are full.
+		bool lineWalkable(Point from, Point to) const;
+
+		template <class Func>
+		void forEachWaypointReversed(Func func) const;
 	
 		Point mStartPoint;
 		Point mEndPoint;
@@ -135,7 +223,25 @@ namespace Hierarchy
 		CellKey mStartCellKey;
 		CellKey mEndCellKey;
 
-		std::priority_queue<Step> mOpenSet;
+		Cost mEndCost;
+
+		// The waypoints of the last query's path, collected by the first call
+		// to path and copied out by later ones, so asking for the number of
+		// waypoints and then for the waypoints walks the parents only once.
+		// Emptied by begin.
+		mutable std::vector<Point> mWaypoints;
+
+		// The open set holds indices into mSteps and mStepCosts, keyed on the
+		// fixed point estimated cost. Slots of popped steps are reused through
+		// mFreeSteps.
+		RadixHeap mOpenSet;
+		std::vector<PackedStep> mSteps;
+		std::vector<Cost> mStepCosts;
+		std::vector<uint32_t> mFreeSteps;
+		uint64_t mPoppedKey;
+
+		uint64_t mNumPushed;
+		uint64_t mNumPopped;
 
 		ClosedSet mClosedSet;
 
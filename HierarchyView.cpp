@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "HierarchyView.h"
+#include "HierarchyDraw.h"
 
 HierarchyView::HierarchyView(const Hierarchy::TestCase* testCase)
 {
@@ -122,12 +123,12 @@ void HierarchyArea::paintEvent(QPaintEvent* evnt)
 	QRect rect(0, 0, width(), height());
 	
 	const Hierarchy::Hierarchy* hierarchy = mTestCase->hierarchy();
-	hierarchy->drawLevel0AsBase(painter, rect);
+	Hierarchy::drawLevel0AsBase(painter, *hierarchy, rect);
 
 	painter.setOpacity(.7f);
-	hierarchy->drawLevel(painter, mSelectedLevel, rect);
+	Hierarchy::drawLevel(painter, *hierarchy, mSelectedLevel, rect);
 
-	mDebugDraw.drawToPainter(painter, mScale);
+	Hierarchy::drawDebugDraw(painter, mDebugDraw, mScale);
 
 	if(mSelectedCell != Point::invalidPoint())
 	{
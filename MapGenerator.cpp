@@ -0,0 +1,351 @@
+#include "MapGenerator.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace Hierarchy
+{
+	static const uint8_t BLOCKED = 0;
+	static const uint8_t WALKABLE = 255;
+
+	// SplitMix64. The standard distributions differ between standard
+	// libraries, so the ranges are computed here.
+	class MapRandom
+	{
+	public:
+		MapRandom(uint64_t seed)
+			: mState(seed)
+		{
+		}
+
+		uint64_t next()
+		{
+			uint64_t z = (mState += 0x9e3779b97f4a7c15ull);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			return z ^ (z >> 31);
+		}
+
+		// A value in [0, n).
+		uint32_t below(uint32_t n)
+		{
+			return (uint32_t)(((next() >> 32) * n) >> 32);
+		}
+
+		// A value in [min, max].
+		int between(int min, int max)
+		{
+			return min + (int)below(max - min + 1);
+		}
+
+		bool chance(float probability)
+		{
+			return (next() >> 40) < (uint64_t)(probability * (1 << 24));
+		}
+
+	private:
+		uint64_t mState;
+	};
+
+	class MapCanvas
+	{
+	public:
+		MapCanvas(std::vector<uint8_t>& elevation, int width, int height)
+			: mElevation(elevation),
+			mWidth(width),
+			mHeight(height)
+		{
+		}
+
+		// Sets the pixels of a rectangle, clipped to the map.
+		void fill(int x, int y, int width, int height, uint8_t value)
+		{
+			int beginX = std::max(x, 0);
+			int endX = std::min(x + width, mWidth);
+			int beginY = std::max(y, 0);
+			int endY = std::min(y + height, mHeight);
+			if(beginX >= endX)
+				return;
+
+			for(int rowY = beginY; rowY < endY; rowY++)
+			{
+				uint8_t* row = mElevation.data() + (size_t)rowY * mWidth;
+				std::fill(row + beginX, row + endX, value);
+			}
+		}
+
+	private:
+		std::vector<uint8_t>& mElevation;
+		int mWidth;
+		int mHeight;
+	};
+
+	static void generateRandomBlocks(const MapOptions& options, MapRandom& random, MapCanvas& canvas)
+	{
+		int size = options.mFeatureSize;
+		for(int y = 0; y < options.mHeight; y += size)
+		{
+			for(int x = 0; x < options.mWidth; x += size)
+			{
+				if(random.chance(options.mDensity))
+					canvas.fill(x, y, size, size, BLOCKED);
+			}
+		}
+	}
+
+	// A recursive backtracker, with an explicit stack. Cell (x, y) of the
+	// maze starts at pixel ((2 * x + 1) * size, (2 * y + 1) * size), the
+	// pixels in between are the walls.
+	static void generateMaze(const MapOptions& options, MapRandom& random, MapCanvas& canvas)
+	{
+		int size = options.mFeatureSize;
+		int numCellsX = (options.mWidth - size) / (2 * size);
+		int numCellsY = (options.mHeight - size) / (2 * size);
+		if(numCellsX <= 0 || numCellsY <= 0)
+			return;
+
+		uint32_t numCells = (uint32_t)numCellsX * numCellsY;
+		std::vector<uint8_t> visited(numCells, 0);
+		std::vector<uint32_t> stack;
+
+		uint32_t start = random.below(numCells);
+		visited[start] = 1;
+		stack.push_back(start);
+		canvas.fill((2 * (start % numCellsX) + 1) * size, (2 * (start / numCellsX) + 1) * size, size, size, WALKABLE);
+
+		while(!stack.empty())
+		{
+			uint32_t cell = stack.back();
+			int cellX = cell % numCellsX;
+			int cellY = cell / numCellsX;
+
+			uint32_t neighbors[4];
+			int numNeighbors = 0;
+			if(cellX > 0 && !visited[cell - 1])
+				neighbors[numNeighbors++] = cell - 1;
+			if(cellX < numCellsX - 1 && !visited[cell + 1])
+				neighbors[numNeighbors++] = cell + 1;
+			if(cellY > 0 && !visited[cell - numCellsX])
+				neighbors[numNeighbors++] = cell - numCellsX;
+			if(cellY < numCellsY - 1 && !visited[cell + numCellsX])
+				neighbors[numNeighbors++] = cell + numCellsX;
+
+			if(numNeighbors == 0)
+			{
+				stack.pop_back();
+				continue;
+			}
+
+			uint32_t next = neighbors[random.below(numNeighbors)];
+			visited[next] = 1;
+			stack.push_back(next);
+
+			// Carves the next cell and the wall between the two cells in one
+			// rectangle.
+			int nextX = next % numCellsX;
+			int nextY = next / numCellsX;
+			canvas.fill(
+				(2 * std::min(cellX, nextX) + 1) * size,
+				(2 * std::min(cellY, nextY) + 1) * size,
+				(nextX != cellX ? 3 : 1) * size,
+				(nextY != cellY ? 3 : 1) * size,
+				WALKABLE);
+		}
+	}
+
+	static void generateRooms(const MapOptions& options, MapRandom& random, MapCanvas& canvas)
+	{
+		int size = options.mFeatureSize;
+		int slotSize = 5 * size;
+		int numSlotsX = std::max(options.mWidth / slotSize, 1);
+		int numSlotsY = std::max(options.mHeight / slotSize, 1);
+
+		// The center of the room of every slot, or an invalid point if it
+		// has none.
+		std::vector<Point> centers((size_t)numSlotsX * numSlotsY, Point::invalidPoint());
+		for(int slotY = 0; slotY < numSlotsY; slotY++)
+		{
+			for(int slotX = 0; slotX < numSlotsX; slotX++)
+			{
+				if(random.chance(options.mDensity))
+					continue;
+
+				// Rooms leave at least a pixel free at the max sides of their
+				// slot, so rooms of neighboring slots never touch.
+				int width = random.between(size, 4 * size);
+				int height = random.between(size, 4 * size);
+				int x = slotX * slotSize + random.between(0, slotSize - width - 1);
+				int y = slotY * slotSize + random.between(0, slotSize - height - 1);
+				canvas.fill(x, y, width, height, WALKABLE);
+
+				centers[slotY * numSlotsX + slotX] = Point(
+					(int16_t)std::min(x + width / 2, options.mWidth - 1),
+					(int16_t)std::min(y + height / 2, options.mHeight - 1));
+			}
+		}
+
+		// Every room is connected to the next room to its right and the next
+		// room below it by an L shaped corridor.
+		int corridorWidth = std::max(size / 4, 1);
+		auto connect = [&](Point a, Point b)
+		{
+			canvas.fill(std::min(a.mX, b.mX), a.mY - corridorWidth / 2, std::abs(b.mX - a.mX) + corridorWidth, corridorWidth, WALKABLE);
+			canvas.fill(b.mX - corridorWidth / 2, std::min(a.mY, b.mY), corridorWidth, std::abs(b.mY - a.mY) + corridorWidth, WALKABLE);
+		};
+
+		for(int slotY = 0; slotY < numSlotsY; slotY++)
+		{
+			for(int slotX = 0; slotX < numSlotsX; slotX++)
+			{
+				Point center = centers[slotY * numSlotsX + slotX];
+				if(center == Point::invalidPoint())
+					continue;
+
+				for(int nextX = slotX + 1; nextX < numSlotsX; nextX++)
+				{
+					Point next = centers[slotY * numSlotsX + nextX];
+					if(next != Point::invalidPoint())
+					{
+						connect(center, next);
+						break;
+					}
+				}
+
+				for(int nextY = slotY + 1; nextY < numSlotsY; nextY++)
+				{
+					Point next = centers[nextY * numSlotsX + slotX];
+					if(next != Point::invalidPoint())
+					{
+						connect(center, next);
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	// The number of smoothing steps of the cave automaton.
+	static const int NUM_CAVE_STEPS = 4;
+
+	static void generateCaves(const MapOptions& options, MapRandom& random, std::vector<uint8_t>& elevation)
+	{
+		int size = options.mFeatureSize;
+		int gridWidth = (options.mWidth + size - 1) / size;
+		int gridHeight = (options.mHeight + size - 1) / size;
+
+		// 1 for walls, cells outside of the grid are walls too.
+		std::vector<uint8_t> walls((size_t)gridWidth * gridHeight);
+		for(uint8_t& wall : walls)
+			wall = random.chance(options.mDensity);
+
+		// A cell becomes a wall if 5 or more of the 9 cells around it,
+		// including itself, are walls. The vertical sums of 3 cells are
+		// computed a row at a time, so each cell is only summed twice.
+		std::vector<uint8_t> nextWalls(walls.size());
+		std::vector<uint8_t> columnSums(gridWidth + 2);
+		for(int step = 0; step < NUM_CAVE_STEPS; step++)
+		{
+			for(int y = 0; y < gridHeight; y++)
+			{
+				const uint8_t* above = y > 0 ? walls.data() + (size_t)(y - 1) * gridWidth : nullptr;
+				const uint8_t* row = walls.data() + (size_t)y * gridWidth;
+				const uint8_t* below = y < gridHeight - 1 ? walls.data() + (size_t)(y + 1) * gridWidth : nullptr;
+
+				columnSums[0] = 3;
+				columnSums[gridWidth + 1] = 3;
+				for(int x = 0; x < gridWidth; x++)
+					columnSums[x + 1] = (above ? above[x] : 1) + row[x] + (below ? below[x] : 1);
+
+				uint8_t* nextRow = nextWalls.data() + (size_t)y * gridWidth;
+				for(int x = 0; x < gridWidth; x++)
+					nextRow[x] = columnSums[x] + columnSums[x + 1] + columnSums[x + 2] >= 5;
+			}
+
+			walls.swap(nextWalls);
+		}
+
+		for(int y = 0; y < options.mHeight; y++)
+		{
+			const uint8_t* gridRow = walls.data() + (size_t)(y / size) * gridWidth;
+			uint8_t* row = elevation.data() + (size_t)y * options.mWidth;
+			for(int x = 0; x < options.mWidth; x++)
+				row[x] = gridRow[x / size] ? BLOCKED : WALKABLE;
+		}
+	}
+
+	static void generateOpenField(const MapOptions& options, MapRandom& random, MapCanvas& canvas)
+	{
+		int size = options.mFeatureSize;
+		double meanSide = (1 + size) / 2.0;
+		uint64_t numObstacles = (uint64_t)(options.mDensity * options.mWidth * options.mHeight / (meanSide * meanSide));
+		for(uint64_t i = 0; i < numObstacles; i++)
+		{
+			int width = random.between(1, size);
+			int height = random.between(1, size);
+			int x = random.below(options.mWidth);
+			int y = random.below(options.mHeight);
+			canvas.fill(x, y, width, height, BLOCKED);
+		}
+	}
+
+	const char* mapKindName(MapKind kind)
+	{
+		switch(kind)
+		{
+		case MapKind::RANDOM_BLOCKS:
+			return "random_blocks";
+
+		case MapKind::MAZE:
+			return "maze";
+
+		case MapKind::ROOMS:
+			return "rooms";
+
+		case MapKind::CAVES:
+			return "caves";
+
+		case MapKind::OPEN_FIELD:
+			return "open_field";
+
+		default:
+			return "unknown";
+		}
+	}
+
+	void generateMap(const MapOptions& options, std::vector<uint8_t>& elevation)
+	{
+		DIDA_ASSERT(options.mWidth > 0 && options.mWidth <= INT16_MAX &&
+			options.mHeight > 0 && options.mHeight <= INT16_MAX);
+		DIDA_ASSERT(options.mFeatureSize >= 1);
+
+		// Mazes and rooms are carved out of a blocked map, obstacles are
+		// added to an open one.
+		bool carved = options.mKind == MapKind::MAZE || options.mKind == MapKind::ROOMS;
+		elevation.assign((size_t)options.mWidth * options.mHeight, carved ? BLOCKED : WALKABLE);
+
+		MapRandom random(options.mSeed);
+		MapCanvas canvas(elevation, options.mWidth, options.mHeight);
+		switch(options.mKind)
+		{
+		case MapKind::RANDOM_BLOCKS:
+			generateRandomBlocks(options, random, canvas);
+			break;
+
+		case MapKind::MAZE:
+			generateMaze(options, random, canvas);
+			break;
+
+		case MapKind::ROOMS:
+			generateRooms(options, random, canvas);
+			break;
+
+		case MapKind::CAVES:
+			generateCaves(options, random, elevation);
+			break;
+
+		case MapKind::OPEN_FIELD:
+			generateOpenField(options, random, canvas);
+			break;
+		}
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+
+#include "Utils.h"
+
+namespace Hierarchy
+{
+	enum class MapKind : uint8_t
+	{
+		// Square blocks of featureSize pixels on a grid, each blocked with a
+		// probability of density. A feature size of 1 gives pixel noise.
+		RANDOM_BLOCKS,
+
+		// A perfect maze with corridors and walls featureSize pixels wide.
+		// Ignores density.
+		MAZE,
+
+		// Rooms of featureSize up to 4 * featureSize pixels, connected to
+		// their neighbors by corridors, on a grid of 5 * featureSize pixel
+		// slots of which density are left without a room.
+		ROOMS,
+
+		// Cellular automaton caves, grown from noise of the given density on
+		// a grid of featureSize pixels.
+		CAVES,
+
+		// An open field with small obstacles of 1 up to featureSize pixels,
+		// covering about density of the map.
+		OPEN_FIELD,
+	};
+
+	struct MapOptions
+	{
+		MapKind mKind = MapKind::RANDOM_BLOCKS;
+		int mWidth = 1024;
+		int mHeight = 1024;
+		uint64_t mSeed = 1;
+		float mDensity = 0.3f;
+		int mFeatureSize = 8;
+	};
+
+	const char* mapKindName(MapKind kind);
+
+	// Generates a synthetic map, with an elevation of 0 for blocked pixels
+	// and 255 for walkable ones, as taken by the Hierarchy constructor. The
+	// map only depends on the options, not on the platform or standard
+	// library.
+	void generateMap(const MapOptions& options, std::vector<uint8_t>& elevation);
+}
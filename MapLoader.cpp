@@ -0,0 +1,246 @@
+#include "MapLoader.h"
+
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+namespace Hierarchy
+{
+	// The elevation of the 8 pixels of a PBM byte, most significant bit first,
+	// packed in the byte order of memory.
+	struct PbmTable
+	{
+		uint64_t mElevation[256];
+
+		PbmTable()
+		{
+			for(int i = 0; i < 256; i++)
+			{
+				uint8_t bytes[8];
+				for(int bit = 0; bit < 8; bit++)
+					bytes[bit] = (i >> (7 - bit)) & 1 ? 0 : 255;
+
+				memcpy(&mElevation[i], bytes, 8);
+			}
+		}
+	};
+
+	static const PbmTable pbmTable;
+
+	// The elevation of each terrain character of a Moving AI map.
+	struct MovingAiTable
+	{
+		uint8_t mElevation[256];
+
+		MovingAiTable()
+		{
+			memset(mElevation, 0, sizeof(mElevation));
+			mElevation['.'] = 255;
+			mElevation['G'] = 255;
+			mElevation['S'] = 255;
+		}
+	};
+
+	static const MovingAiTable movingAiTable;
+
+	MapLoader::MapLoader()
+		: mFormat(Format::RAW),
+		mWidth(0),
+		mHeight(0),
+		mNextRow(0)
+	{
+	}
+
+	bool MapLoader::readHeaderValue(int& value)
+	{
+		// Values are separated by whitespace and comments, which run from a
+		// '#' to the end of the line.
+		int c = mFile.get();
+		while(c != EOF && (isspace(c) || c == '#'))
+		{
+			if(c == '#')
+			{
+				while(c != EOF && c != '\n')
+					c = mFile.get();
+			}
+
+			c = mFile.get();
+		}
+
+		if(c == EOF || !isdigit(c))
+			return false;
+
+		value = 0;
+		while(isdigit(c))
+		{
+			if(value > (INT_MAX - 9) / 10)
+				return false;
+
+			value = value * 10 + (c - '0');
+			c = mFile.get();
+		}
+
+		// A single whitespace character ends the value, which for the last
+		// value of the header is the last byte before the pixels.
+		return c != EOF && isspace(c);
+	}
+
+	bool MapLoader::open(const char* fileName)
+	{
+		mFile.close();
+		mFile.clear();
+		mFile.open(fileName, std::ios::binary);
+		if(!mFile)
+			return false;
+
+		char magic[2];
+		if(!mFile.read(magic, 2))
+			return false;
+
+		if(magic[0] == 't' && magic[1] == 'y')
+		{
+			mFile.seekg(0);
+			return readMovingAiHeader();
+		}
+
+		if(magic[0] != 'P')
+			return false;
+
+		if(magic[1] == '5')
+			mFormat = Format::PGM;
+		else if(magic[1] == '4')
+			mFormat = Format::PBM;
+		else
+			return false;
+
+		if(!readHeaderValue(mWidth) || !readHeaderValue(mHeight))
+			return false;
+
+		if(mFormat == Format::PGM)
+		{
+			// Only single byte values are supported.
+			int maxValue;
+			if(!readHeaderValue(maxValue) || maxValue <= 0 || maxValue > 255)
+				return false;
+		}
+
+		if(mWidth <= 0 || mHeight <= 0 || mWidth > INT16_MAX || mHeight > INT16_MAX)
+			return false;
+
+		mNextRow = 0;
+		if(mFormat == Format::PBM)
+			mRowBuffer.resize((mWidth + 7) / 8);
+
+		return true;
+	}
+
+	bool MapLoader::readMovingAiHeader()
+	{
+		// "type octile", "height <h>" and "width <w>" lines, followed by a
+		// "map" line after which the rows start.
+		mWidth = 0;
+		mHeight = 0;
+		while(std::getline(mFile, mLine))
+		{
+			if(!mLine.empty() && mLine.back() == '\r')
+				mLine.pop_back();
+
+			if(mLine == "map")
+				break;
+
+			if(mLine.compare(0, 7, "height ") == 0)
+				mHeight = atoi(mLine.c_str() + 7);
+			else if(mLine.compare(0, 6, "width ") == 0)
+				mWidth = atoi(mLine.c_str() + 6);
+		}
+
+		if(!mFile || mWidth <= 0 || mHeight <= 0 || mWidth > INT16_MAX || mHeight > INT16_MAX)
+			return false;
+
+		mFormat = Format::MOVING_AI;
+		mNextRow = 0;
+		return true;
+	}
+
+	bool MapLoader::openRaw(const char* fileName, int width, int height)
+	{
+		mFile.close();
+		mFile.clear();
+		mFile.open(fileName, std::ios::binary);
+		if(!mFile || width <= 0 || height <= 0 || width > INT16_MAX || height > INT16_MAX)
+			return false;
+
+		mFormat = Format::RAW;
+		mWidth = width;
+		mHeight = height;
+		mNextRow = 0;
+		return true;
+	}
+
+	bool MapLoader::readRows(uint8_t* elevation, int numRows)
+	{
+		if(numRows > mHeight - mNextRow)
+			return false;
+
+		if(mFormat == Format::MOVING_AI)
+		{
+			for(int y = 0; y < numRows; y++)
+			{
+				if(!std::getline(mFile, mLine) || (int)mLine.size() < mWidth)
+					return false;
+
+				for(int x = 0; x < mWidth; x++)
+					elevation[x] = movingAiTable.mElevation[(uint8_t)mLine[x]];
+
+				elevation += mWidth;
+				mNextRow++;
+			}
+
+			return true;
+		}
+
+		if(mFormat != Format::PBM)
+		{
+			if(!mFile.read((char*)elevation, (std::streamsize)mWidth * numRows))
+				return false;
+
+			mNextRow += numRows;
+			return true;
+		}
+
+		int numFullBytes = mWidth / 8;
+		int numRemainingBits = mWidth % 8;
+		for(int y = 0; y < numRows; y++)
+		{
+			if(!mFile.read((char*)mRowBuffer.data(), mRowBuffer.size()))
+				return false;
+
+			for(int i = 0; i < numFullBytes; i++)
+				memcpy(elevation + 8 * i, &pbmTable.mElevation[mRowBuffer[i]], 8);
+
+			if(numRemainingBits)
+				memcpy(elevation + 8 * numFullBytes, &pbmTable.mElevation[mRowBuffer[numFullBytes]], numRemainingBits);
+
+			elevation += mWidth;
+			mNextRow++;
+		}
+
+		return true;
+	}
+
+	bool MapLoader::readAll(std::vector<uint8_t>& elevation)
+	{
+		int numRows = mHeight - mNextRow;
+		elevation.resize((size_t)mWidth * numRows);
+		return readRows(elevation.data(), numRows);
+	}
+
+	RefPtr<Hierarchy> MapLoader::buildHierarchy(const BuildOptions& options)
+	{
+		if(mNextRow != 0)
+			return nullptr;
+
+		return Hierarchy::buildFromSource(mWidth, mHeight, *this, options);
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Obj.h"
+#include "Hierarchy.h"
+
+namespace Hierarchy
+{
+	// Reads maps from binary PGM and PBM files, Moving AI .map files, and from
+	// raw files of one byte per pixel, without going through Qt. Rows are
+	// converted to elevation a whole row at a time. PGM and raw values are
+	// used as the elevation as-is, set PBM bits (black pixels) become 0 and
+	// clear ones 255. In .map files '.', 'G' and 'S' are walkable, and every
+	// other terrain is blocked.
+	class MapLoader : public ElevationSource
+	{
+	public:
+		MapLoader();
+
+		// Opens a PGM (P5), PBM (P4) or Moving AI .map file and reads its
+		// header.
+		bool open(const char* fileName);
+
+		// Opens a raw file of width * height bytes.
+		bool openRaw(const char* fileName, int width, int height);
+
+		int width() const { return mWidth; }
+		int height() const { return mHeight; }
+
+		virtual bool readRows(uint8_t* elevation, int numRows) override;
+
+		// Reads all remaining rows.
+		bool readAll(std::vector<uint8_t>& elevation);
+
+		// Builds a hierarchy from all remaining rows, without reading the whole
+		// map into memory first. Returns null if the file can't be read.
+		RefPtr<Hierarchy> buildHierarchy(const BuildOptions& options);
+
+	private:
+		enum class Format : uint8_t
+		{
+			RAW,
+			PGM,
+			PBM,
+			MOVING_AI,
+		};
+
+		bool readHeaderValue(int& value);
+		bool readMovingAiHeader();
+
+		std::ifstream mFile;
+		Format mFormat;
+		int mWidth;
+		int mHeight;
+		int mNextRow;
+		std::vector<uint8_t> mRowBuffer;
+		std::string mLine;
+	};
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace Hierarchy
+{
+	// An array which either owns its elements, or refers to read only
+	// elements owned by something else, like a mapped file. The referred
+	// elements are copied on the first non-const access.
+	template <class T>
+	class MappableArray
+	{
+	public:
+		MappableArray()
+			: mData(nullptr),
+			mSize(0)
+		{
+		}
+
+		MappableArray(const MappableArray& src)
+		{
+			*this = src;
+		}
+
+		MappableArray(MappableArray&& src)
+		{
+			*this = std::move(src);
+		}
+
+		MappableArray& operator = (const MappableArray& src)
+		{
+			if(src.isOwned())
+			{
+				mOwned = src.mOwned;
+				mData = mOwned.data();
+			}
+			else
+			{
+				mOwned.clear();
+				mData = src.mData;
+			}
+
+			mSize = src.mSize;
+			return *this;
+		}
+
+		MappableArray& operator = (MappableArray&& src)
+		{
+			bool owned = src.isOwned();
+			mOwned = std::move(src.mOwned);
+			mData = owned ? mOwned.data() : src.mData;
+			mSize = src.mSize;
+
+			src.mData = nullptr;
+			src.mSize = 0;
+			return *this;
+		}
+
+		void assign(size_t size, const T& value)
+		{
+			mOwned.assign(size, value);
+			mData = mOwned.data();
+			mSize = size;
+		}
+
+		void assign(std::vector<T>&& elements)
+		{
+			mOwned = std::move(elements);
+			mData = mOwned.data();
+			mSize = mOwned.size();
+		}
+
+		// Refers to size elements at data, which have to outlive this array.
+		void refer(const T* data, size_t size)
+		{
+			mOwned.clear();
+			mOwned.shrink_to_fit();
+			mData = data;
+			mSize = size;
+		}
+
+		bool isOwned() const
+		{
+			return mData == mOwned.data();
+		}
+
+		size_t size() const { return mSize; }
+		bool empty() const { return mSize == 0; }
+
+		const T* data() const { return mData; }
+
+		T* data()
+		{
+			if(!isOwned())
+			{
+				mOwned.assign(mData, mData + mSize);
+				mData = mOwned.data();
+			}
+
+			return mOwned.data();
+		}
+
+		// Copies the referred elements first, like any non-const access.
+		void push_back(const T& element)
+		{
+			data();
+			mOwned.push_back(element);
+			mData = mOwned.data();
+			mSize++;
+		}
+
+		const T& operator [] (size_t index) const { return mData[index]; }
+		T& operator [] (size_t index) { return data()[index]; }
+
+	private:
+		std::vector<T> mOwned;
+		const T* mData;
+		size_t mSize;
+	};
+}
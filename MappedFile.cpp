@@ -0,0 +1,115 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "MappedFile.h"
+
+namespace Hierarchy
+{
+	MappedFile::MappedFile()
+		: mData(nullptr),
+		mSize(0)
+#ifdef _WIN32
+		, mFile(INVALID_HANDLE_VALUE),
+		mMapping(nullptr)
+#endif
+	{
+	}
+
+	MappedFile::~MappedFile()
+	{
+		close();
+	}
+
+#ifdef _WIN32
+	bool MappedFile::open(const char* fileName)
+	{
+		close();
+
+		mFile = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if(mFile == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize;
+		if(!GetFileSizeEx(mFile, &fileSize) || fileSize.QuadPart == 0)
+		{
+			close();
+			return false;
+		}
+
+		mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if(!mMapping)
+		{
+			close();
+			return false;
+		}
+
+		mData = (const uint8_t*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+		if(!mData)
+		{
+			close();
+			return false;
+		}
+
+		mSize = (size_t)fileSize.QuadPart;
+		return true;
+	}
+
+	void MappedFile::close()
+	{
+		if(mData)
+			UnmapViewOfFile(mData);
+		if(mMapping)
+			CloseHandle(mMapping);
+		if(mFile != INVALID_HANDLE_VALUE)
+			CloseHandle(mFile);
+
+		mData = nullptr;
+		mSize = 0;
+		mMapping = nullptr;
+		mFile = INVALID_HANDLE_VALUE;
+	}
+#else
+	bool MappedFile::open(const char* fileName)
+	{
+		close();
+
+		int fd = ::open(fileName, O_RDONLY);
+		if(fd < 0)
+			return false;
+
+		struct stat fileStat;
+		if(fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+		{
+			::close(fd);
+			return false;
+		}
+
+		// The mapping stays valid after the descriptor is closed.
+		void* data = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if(data == MAP_FAILED)
+			return false;
+
+		mData = (const uint8_t*)data;
+		mSize = (size_t)fileStat.st_size;
+		return true;
+	}
+
+	void MappedFile::close()
+	{
+		if(mData)
+			munmap((void*)mData, mSize);
+
+		mData = nullptr;
+		mSize = 0;
+	}
+#endif
+}
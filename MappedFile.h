@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Hierarchy
+{
+	// A whole file mapped read only into memory. Processes mapping the same
+	// file share its pages.
+	class MappedFile
+	{
+	public:
+		MappedFile();
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator = (const MappedFile&) = delete;
+
+		// Returns false if the file can't be opened, or is empty.
+		bool open(const char* fileName);
+
+		const uint8_t* data() const { return mData; }
+		size_t size() const { return mSize; }
+
+	private:
+		void close();
+
+		const uint8_t* mData;
+		size_t mSize;
+
+#ifdef _WIN32
+		void* mFile;
+		void* mMapping;
+#endif
+	};
+}
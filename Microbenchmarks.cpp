@@ -0,0 +1,426 @@
+#include "Hierarchy.h"
+#include "MapLoader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Measures the hierarchy navigation primitives the path finder calls on every
+// expansion, each in isolation, over randomized cell keys. Runs on synthetic
+// noise maps, and on the PGM and PBM maps given on the command line, each
+// built with the default options, the Morton layout and the top level
+// lookup. Prints one JSON object per line, with the cache misses per op if
+// the hardware counters are available, or null if they aren't.
+//
+// Usage: GridPathFindingMicrobenchmarks [numOps] [map.pgm ...]
+
+namespace Hierarchy
+{
+	typedef std::chrono::steady_clock Clock;
+
+	// The cache misses of the calling thread, through perf_event_open.
+	class CacheMissCounter
+	{
+	public:
+		CacheMissCounter()
+			: mFd(-1)
+		{
+#ifdef __linux__
+			perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_CACHE_MISSES;
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			mFd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+		}
+
+		~CacheMissCounter()
+		{
+#ifdef __linux__
+			if(mFd != -1)
+				close(mFd);
+#endif
+		}
+
+		CacheMissCounter(const CacheMissCounter&) = delete;
+		CacheMissCounter& operator = (const CacheMissCounter&) = delete;
+
+		bool available() const { return mFd != -1; }
+
+		void start()
+		{
+#ifdef __linux__
+			if(mFd != -1)
+			{
+				ioctl(mFd, PERF_EVENT_IOC_RESET, 0);
+				ioctl(mFd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+#endif
+		}
+
+		uint64_t stop()
+		{
+			uint64_t count = 0;
+#ifdef __linux__
+			if(mFd != -1)
+			{
+				ioctl(mFd, PERF_EVENT_IOC_DISABLE, 0);
+				if(read(mFd, &count, sizeof(count)) != sizeof(count))
+					count = 0;
+			}
+#endif
+			return count;
+		}
+
+	private:
+		int mFd;
+	};
+
+	struct CornerInput
+	{
+		CellKey mCellKey;
+		CornerIndex mCorner;
+	};
+
+	struct EdgePointInput
+	{
+		CellKey mCellKey;
+		Point mEdgePoint;
+	};
+
+	// The number of inputs of every primitive, enough to not fit in the L1
+	// cache together with the cells they touch.
+	static const int NUM_INPUTS = 1 << 14;
+
+	class Microbenchmark
+	{
+	public:
+		Microbenchmark(const Hierarchy* hierarchy, const std::string& mapName, const char* options, int numOps)
+			: mHierarchy(hierarchy),
+			mMapName(mapName),
+			mOptions(options),
+			mNumOps(numOps),
+			mRandom(1)
+		{
+		}
+
+		void run()
+		{
+			std::vector<CornerInput> corners(NUM_INPUTS);
+			for(CornerInput& input : corners)
+				input = CornerInput{ randomCellKey(0), randomCorner() };
+
+			measure("topLevelCellContainingCorner", [&]()
+			{
+				uint64_t sink = 0;
+				for(const CornerInput& input : corners)
+					sink += mHierarchy->topLevelCellContainingCorner(input.mCellKey, input.mCorner).packed();
+				return sink;
+			});
+
+			std::vector<EdgePointInput> edgePoints[4];
+			for(int edge = 0; edge < 4; edge++)
+			{
+				edgePoints[edge].resize(NUM_INPUTS / 4);
+				for(EdgePointInput& input : edgePoints[edge])
+				{
+					input.mCellKey = randomCellKey(0);
+
+					// A point along the edge, within the cell.
+					int8_t edgeAxis = edge & 1;
+					int8_t perpAxis = edgeAxis ^ 1;
+					input.mEdgePoint = input.mCellKey.corner((CornerIndex)((edge >> 1) * 3));
+					input.mEdgePoint[perpAxis] = (input.mCellKey.mCoords[perpAxis] << input.mCellKey.mLevel) +
+						(int16_t)(mRandom() & ((1 << input.mCellKey.mLevel) - 1));
+				}
+			}
+
+			measure("topLevelCellContainingEdgePoint", [&]()
+			{
+				return edgePointPass<EdgeIndex::MIN_X>(edgePoints[0]) +
+					edgePointPass<EdgeIndex::MIN_Y>(edgePoints[1]) +
+					edgePointPass<EdgeIndex::MAX_X>(edgePoints[2]) +
+					edgePointPass<EdgeIndex::MAX_Y>(edgePoints[3]);
+			});
+
+			// cellKeyAdjToCorner looks at the cell diagonally past the given
+			// corner, so its input is the cell on the other side of it.
+			std::vector<CornerInput> adjCorners(NUM_INPUTS);
+			for(CornerInput& input : adjCorners)
+			{
+				CornerIndex corner = randomCorner();
+				int8_t cornerX = (int8_t)corner & 1;
+				int8_t cornerY = (int8_t)corner >> 1;
+				CellKey cellKey = randomCellKey(1);
+				cellKey.mCoords.mX += 1 - cornerX;
+				cellKey.mCoords.mY += 1 - cornerY;
+				input = CornerInput{ cellKey, corner };
+			}
+
+			measure("cellKeyAdjToCorner", [&]()
+			{
+				uint64_t sink = 0;
+				for(const CornerInput& input : adjCorners)
+					sink += mHierarchy->cellKeyAdjToCorner(input.mCellKey, input.mCorner).packed();
+				return sink;
+			});
+
+			// Cells which aren't at the border, so the diagonal neighbor and
+			// the boundary neighbors are in the level.
+			std::vector<CornerInput> diagCorners(NUM_INPUTS);
+			for(CornerInput& input : diagCorners)
+				input = CornerInput{ randomCellKey(1), randomCorner() };
+
+			measure("diagNextCellKey", [&]()
+			{
+				uint64_t sink = 0;
+				for(const CornerInput& input : diagCorners)
+					sink += mHierarchy->diagNextCellKey(input.mCellKey, input.mCorner).packed();
+				return sink;
+			});
+
+			std::vector<CellKey> boundaryCells(NUM_INPUTS / 4);
+			for(CellKey& cellKey : boundaryCells)
+				cellKey = randomCellKey(1);
+
+			measure("prevBoundaryCell", [&]()
+			{
+				return boundaryPass<EdgeIndex::MIN_X, OnEdgeDir::TOWARDS_POSITIVE>(boundaryCells) +
+					boundaryPass<EdgeIndex::MIN_Y, OnEdgeDir::TOWARDS_NEGATIVE>(boundaryCells) +
+					boundaryPass<EdgeIndex::MAX_X, OnEdgeDir::TOWARDS_NEGATIVE>(boundaryCells) +
+					boundaryPass<EdgeIndex::MAX_Y, OnEdgeDir::TOWARDS_POSITIVE>(boundaryCells);
+			});
+
+			measure("nextBoundaryCell", [&]()
+			{
+				uint64_t sink = 0;
+				for(const CellKey& cellKey : boundaryCells)
+				{
+					sink += mHierarchy->nextBoundaryCell<EdgeIndex::MIN_X, OnEdgeDir::TOWARDS_POSITIVE>(cellKey).packed();
+					sink += mHierarchy->nextBoundaryCell<EdgeIndex::MIN_Y, OnEdgeDir::TOWARDS_NEGATIVE>(cellKey).packed();
+					sink += mHierarchy->nextBoundaryCell<EdgeIndex::MAX_X, OnEdgeDir::TOWARDS_NEGATIVE>(cellKey).packed();
+					sink += mHierarchy->nextBoundaryCell<EdgeIndex::MAX_Y, OnEdgeDir::TOWARDS_POSITIVE>(cellKey).packed();
+				}
+				return sink;
+			});
+
+			// An op is a whole walk along one edge of a cell, the number of
+			// boundary cells per walk is reported as well.
+			std::vector<CellKey> iteratorCells(NUM_INPUTS / 4);
+			for(CellKey& cellKey : iteratorCells)
+				cellKey = randomCellKey(0);
+
+			mNumBoundaryCells = 0;
+			measure("BoundaryCellIterator", [&]()
+			{
+				return iteratorPass<CornerIndex::MIN_X_MIN_Y, Axis2::X>(iteratorCells) +
+					iteratorPass<CornerIndex::MAX_X_MIN_Y, Axis2::Y>(iteratorCells) +
+					iteratorPass<CornerIndex::MAX_X_MAX_Y, Axis2::X>(iteratorCells) +
+					iteratorPass<CornerIndex::MIN_X_MAX_Y, Axis2::Y>(iteratorCells);
+			});
+		}
+
+	private:
+		CornerIndex randomCorner()
+		{
+			return (CornerIndex)(mRandom() & 3);
+		}
+
+		// A random cell of a random level which isn't a level up cell, so
+		// either a top level cell or a partial cell, at least margin cells
+		// away from the edges of its level.
+		CellKey randomCellKey(int margin)
+		{
+			for(;;)
+			{
+				uint8_t levelIndex = (uint8_t)(mRandom() % mHierarchy->numLevels());
+				const HierarchyLevel& level = mHierarchy->level(levelIndex);
+				if(level.width() <= 2 * margin || level.height() <= 2 * margin)
+					continue;
+
+				CellKey cellKey(Point(
+					(int16_t)(margin + mRandom() % (level.width() - 2 * margin)),
+					(int16_t)(margin + mRandom() % (level.height() - 2 * margin))),
+					levelIndex);
+
+				if(isLevelUpCell(mHierarchy->cellAt(cellKey)))
+					cellKey = mHierarchy->topLevelCellContaining(cellKey);
+
+				const HierarchyLevel& cellLevel = mHierarchy->level(cellKey.mLevel);
+				if(cellKey.mCoords.mX >= margin && cellKey.mCoords.mX < cellLevel.width() - margin &&
+					cellKey.mCoords.mY >= margin && cellKey.mCoords.mY < cellLevel.height() - margin)
+				{
+					return cellKey;
+				}
+			}
+		}
+
+		template <EdgeIndex edge>
+		uint64_t edgePointPass(const std::vector<EdgePointInput>& inputs)
+		{
+			uint64_t sink = 0;
+			for(const EdgePointInput& input : inputs)
+				sink += mHierarchy->topLevelCellContainingEdgePoint<edge, OnEdgeDir::TOWARDS_POSITIVE>(input.mCellKey, input.mEdgePoint).packed();
+			return sink;
+		}
+
+		template <EdgeIndex edge, OnEdgeDir dir>
+		uint64_t boundaryPass(const std::vector<CellKey>& cellKeys)
+		{
+			uint64_t sink = 0;
+			for(const CellKey& cellKey : cellKeys)
+				sink += mHierarchy->prevBoundaryCell<edge, dir>(cellKey).packed();
+			return sink;
+		}
+
+		template <CornerIndex startCornerIndex, Axis2 axis>
+		uint64_t iteratorPass(const std::vector<CellKey>& cellKeys)
+		{
+			uint64_t sink = 0;
+			for(const CellKey& cellKey : cellKeys)
+			{
+				Hierarchy::BoundaryCellIterator<startCornerIndex, axis> it(mHierarchy, cellKey);
+				while(it.moveNext())
+				{
+					sink += it.cell().packed();
+					mNumBoundaryCells++;
+				}
+			}
+			return sink;
+		}
+
+		// Runs pass, which does NUM_INPUTS ops, until at least mNumOps ops
+		// are done, and prints the time and cache misses per op.
+		template <class Pass>
+		void measure(const char* primitive, Pass pass)
+		{
+			// Warms up the caches and the branch predictors.
+			uint64_t sink = pass();
+			mNumBoundaryCells = 0;
+
+			int numPasses = std::max(mNumOps / NUM_INPUTS, 1);
+
+			CacheMissCounter cacheMisses;
+			Clock::time_point start = Clock::now();
+			cacheMisses.start();
+			for(int i = 0; i < numPasses; i++)
+				sink += pass();
+			uint64_t numCacheMisses = cacheMisses.stop();
+			int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+			mSink += sink;
+
+			double numOps = (double)numPasses * NUM_INPUTS;
+			printf("{\"type\":\"primitive\",\"map\":\"%s\",\"options\":\"%s\",\"primitive\":\"%s\",\"ops\":%.0f,\"ns_per_op\":%.2f,",
+				mMapName.c_str(), mOptions, primitive, numOps, ns / numOps);
+
+			if(cacheMisses.available())
+				printf("\"cache_misses_per_op\":%.4f", numCacheMisses / numOps);
+			else
+				printf("\"cache_misses_per_op\":null");
+
+			if(mNumBoundaryCells)
+				printf(",\"cells_per_op\":%.2f", mNumBoundaryCells / numOps);
+
+			printf("}\n");
+		}
+
+		const Hierarchy* mHierarchy;
+		std::string mMapName;
+		const char* mOptions;
+		int mNumOps;
+		std::mt19937 mRandom;
+
+		uint64_t mNumBoundaryCells = 0;
+
+		// Keeps the results of the primitives alive.
+		volatile uint64_t mSink = 0;
+	};
+
+	static void benchmarkMap(const std::string& name, int width, int height, const std::vector<uint8_t>& elevation, int numOps)
+	{
+		struct Variant
+		{
+			const char* mName;
+			CellLayout mCellLayout;
+			bool mTopLevelLookup;
+		};
+
+		static const Variant variants[] =
+		{
+			{ "default", CellLayout::ROW_MAJOR, false },
+			{ "morton", CellLayout::MORTON, false },
+			{ "top_level_lookup", CellLayout::ROW_MAJOR, true },
+		};
+
+		for(const Variant& variant : variants)
+		{
+			BuildOptions options;
+			options.mCellLayout = variant.mCellLayout;
+			options.mTopLevelLookup = variant.mTopLevelLookup;
+
+			RefPtr<Hierarchy> hierarchy;
+			hierarchy.setNew(new Hierarchy(width, height, elevation.data(), options));
+
+			Microbenchmark microbenchmark(hierarchy, name, variant.mName, numOps);
+			microbenchmark.run();
+		}
+	}
+
+	// A map of random pixels, of which the given percentage is blocked.
+	static std::vector<uint8_t> noiseMap(int width, int height, int blockedPercentage)
+	{
+		std::mt19937 random(blockedPercentage);
+		std::vector<uint8_t> elevation(width * height);
+		for(uint8_t& pixel : elevation)
+			pixel = (int)(random() % 100) < blockedPercentage ? 0 : 255;
+
+		return elevation;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	using namespace Hierarchy;
+
+	int numOps = argc > 1 ? std::max(atoi(argv[1]), 1) : 1 << 20;
+
+	static const int NOISE_MAP_SIZE = 1024;
+	static const int noisePercentages[] = { 5, 20, 40 };
+	for(int blockedPercentage : noisePercentages)
+	{
+		std::string name = "noise" + std::to_string(blockedPercentage);
+		benchmarkMap(name, NOISE_MAP_SIZE, NOISE_MAP_SIZE, noiseMap(NOISE_MAP_SIZE, NOISE_MAP_SIZE, blockedPercentage), numOps);
+	}
+
+	int numFailed = 0;
+	for(int i = 2; i < argc; i++)
+	{
+		MapLoader loader;
+		std::vector<uint8_t> elevation;
+		if(!loader.open(argv[i]) || !loader.readAll(elevation))
+		{
+			fprintf(stderr, "Failed to load %s\n", argv[i]);
+			numFailed++;
+			continue;
+		}
+
+		benchmarkMap(argv[i], loader.width(), loader.height(), elevation, numOps);
+	}
+
+	return numFailed == 0 ? 0 : 1;
+}
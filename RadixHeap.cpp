@@ -0,0 +1,77 @@
+#include "RadixHeap.h"
+
+namespace Hierarchy
+{
+	RadixHeap::RadixHeap()
+		: mLastKey(0),
+		mSize(0)
+	{
+	}
+
+	void RadixHeap::push(uint64_t key, uint32_t value)
+	{
+		DIDA_ASSERT(key >= mLastKey);
+
+		Entry entry;
+		entry.mKey = key;
+		entry.mValue = value;
+		mBuckets[bucketIndex(key)].push_back(entry);
+		mSize++;
+	}
+
+	uint64_t RadixHeap::topKey()
+	{
+		DIDA_ASSERT(!empty());
+
+		refillBucket0();
+		return mLastKey;
+	}
+
+	uint32_t RadixHeap::pop()
+	{
+		DIDA_ASSERT(!empty());
+
+		refillBucket0();
+
+		uint32_t ret = mBuckets[0].back().mValue;
+		mBuckets[0].pop_back();
+		mSize--;
+		return ret;
+	}
+
+	void RadixHeap::clear()
+	{
+		for(auto& bucket : mBuckets)
+			bucket.clear();
+
+		mLastKey = 0;
+		mSize = 0;
+	}
+
+	void RadixHeap::refillBucket0()
+	{
+		if(!mBuckets[0].empty())
+			return;
+
+		int bucketI = 1;
+		while(mBuckets[bucketI].empty())
+			bucketI++;
+
+		std::vector<Entry>& bucket = mBuckets[bucketI];
+
+		uint64_t minKey = bucket[0].mKey;
+		for(const Entry& entry : bucket)
+		{
+			if(entry.mKey < minKey)
+				minKey = entry.mKey;
+		}
+
+		// All entries in this bucket share the bits above bucketI - 1 with
+		// minKey, so they all move to a lower bucket.
+		mLastKey = minKey;
+		for(const Entry& entry : bucket)
+			mBuckets[bucketIndex(entry.mKey)].push_back(entry);
+
+		bucket.clear();
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+
+#include "Utils.h"
+
+namespace Hierarchy
+{
+	// Monotone priority queue of (key, value) pairs. Keys are put in the
+	// bucket of the highest bit in which they differ from the last popped key,
+	// so a push is O(1), and every element is redistributed at most 64 times
+	// before it's popped.
+	class RadixHeap
+	{
+	public:
+		RadixHeap();
+
+		bool empty() const { return mSize == 0; }
+		size_t size() const { return mSize; }
+
+		// The key must be at least the key of the last popped element.
+		void push(uint64_t key, uint32_t value);
+
+		// The key of the element pop() will return.
+		uint64_t topKey();
+		uint32_t pop();
+
+		void clear();
+
+	private:
+		struct Entry
+		{
+			uint64_t mKey;
+			uint32_t mValue;
+		};
+
+		static_assert(sizeof(Entry) == 16, "Entry is padded to the alignment of its key");
+
+		static const int NUM_BUCKETS = 65;
+
+		int bucketIndex(uint64_t key) const
+		{
+			return key == mLastKey ? 0 : highestSetBit(key ^ mLastKey) + 1;
+		}
+
+		void refillBucket0();
+
+		std::vector<Entry> mBuckets[NUM_BUCKETS];
+		uint64_t mLastKey;
+		size_t mSize;
+	};
+}
@@ -0,0 +1,190 @@
+#include "ReferencePathFinder.h"
+
+#include <algorithm>
+
+namespace Hierarchy
+{
+	struct ReferenceNeighbor
+	{
+		int16_t mX;
+		int16_t mY;
+		Cost mCost;
+	};
+
+	static const ReferenceNeighbor referenceNeighbors[8] =
+	{
+		{ 1, 0, Cost(1, 0) },
+		{ -1, 0, Cost(1, 0) },
+		{ 0, 1, Cost(1, 0) },
+		{ 0, -1, Cost(1, 0) },
+		{ 1, 1, Cost(0, 1) },
+		{ -1, 1, Cost(0, 1) },
+		{ 1, -1, Cost(0, 1) },
+		{ -1, -1, Cost(0, 1) },
+	};
+
+	ReferencePathFinder::ReferencePathFinder(const Hierarchy* hierarchy)
+		: mHierarchy(hierarchy),
+		mWidth(hierarchy->width()),
+		mHeight(hierarchy->height()),
+		mGeneration(0),
+		mNumPushed(0),
+		mNumPopped(0),
+		mPeakOpenSize(0),
+		mNumExpanded(0)
+	{
+	}
+
+	void ReferencePathFinder::nextGeneration()
+	{
+		// The generation is stored above the expanded bit, so it wraps
+		// around at 2^31.
+		mGeneration++;
+		if(mGeneration == 1u << 31)
+		{
+			for(Node& node : mNodes)
+				node.mStamp = 0;
+
+			mGeneration = 1;
+		}
+	}
+
+	PathFinder::IterationRes ReferencePathFinder::findPath(Point startPoint, Point endPoint)
+	{
+		mStartPoint = startPoint;
+		mEndPoint = endPoint;
+		mOpenSet.clear();
+		mNumPushed = 0;
+		mNumPopped = 0;
+		mPeakOpenSize = 0;
+		mNumExpanded = 0;
+
+		// Only the level 0 cells are looked at, not the upper levels or the
+		// components, since those are what PathFinder is checked against.
+		// Unreachable queries flood the start's component.
+		if(!isFullCell(mHierarchy->cellAt(CellKey(startPoint, 0))) ||
+			!isFullCell(mHierarchy->cellAt(CellKey(endPoint, 0))))
+		{
+			return PathFinder::IterationRes::UNREACHABLE;
+		}
+
+		if(mNodes.empty())
+			mNodes.resize((size_t)mWidth * mHeight, Node{ 0, 0, Cost(0, 0) });
+
+		nextGeneration();
+		uint32_t openStamp = mGeneration << 1;
+		uint32_t expandedStamp = openStamp | 1;
+
+		uint32_t startIndex = pixelIndex(startPoint);
+		mNodes[startIndex] = Node{ openStamp, startIndex, Cost(0, 0) };
+		mOpenSet.push(Cost::distance(startPoint, endPoint).toFixedPoint(), startIndex);
+		mNumPushed++;
+
+		// Nodes are pushed again when a cheaper path to them is found, the
+		// stale entries are skipped when they're popped. Octile distance is
+		// consistent, so a node is final when it's first popped.
+		while(!mOpenSet.empty())
+		{
+			mPeakOpenSize = std::max(mPeakOpenSize, mOpenSet.size());
+
+			uint32_t index = mOpenSet.pop();
+			mNumPopped++;
+
+			Node& node = mNodes[index];
+			if(node.mStamp == expandedStamp)
+				continue;
+
+			node.mStamp = expandedStamp;
+			mNumExpanded++;
+
+			Point pt = pixelPoint(index);
+			if(pt == endPoint)
+			{
+				mEndCost = node.mCost;
+				return PathFinder::IterationRes::END_REACHED;
+			}
+
+			for(const ReferenceNeighbor& neighbor : referenceNeighbors)
+			{
+				Point nextPt((int16_t)(pt.mX + neighbor.mX), (int16_t)(pt.mY + neighbor.mY));
+				if(!isFullCell(mHierarchy->cellAt(CellKey(nextPt, 0))))
+					continue;
+
+				uint32_t nextIndex = pixelIndex(nextPt);
+				Node& nextNode = mNodes[nextIndex];
+				if(nextNode.mStamp == expandedStamp)
+					continue;
+
+				Cost nextCost = node.mCost + neighbor.mCost;
+				if(nextNode.mStamp == openStamp && nextNode.mCost.toFixedPoint() <= nextCost.toFixedPoint())
+					continue;
+
+				nextNode = Node{ openStamp, index, nextCost };
+				mOpenSet.push((nextCost + Cost::distance(nextPt, endPoint)).toFixedPoint(), nextIndex);
+				mNumPushed++;
+			}
+		}
+
+		return PathFinder::IterationRes::UNREACHABLE;
+	}
+
+	template <class Func>
+	int ReferencePathFinder::forEachWaypointReversed(Func func) const
+	{
+		// The parents lead back to the start one cell at a time, only the
+		// cells where the direction changes are waypoints.
+		func(0, mEndPoint);
+		int numWaypoints = 1;
+
+		Point pt = mEndPoint;
+		int prevDirX = 0;
+		int prevDirY = 0;
+		while(pt != mStartPoint)
+		{
+			Point parent = pixelPoint(mNodes[pixelIndex(pt)].mParent);
+			int dirX = parent.mX - pt.mX;
+			int dirY = parent.mY - pt.mY;
+			if(pt != mEndPoint && (dirX != prevDirX || dirY != prevDirY))
+			{
+				func(numWaypoints, pt);
+				numWaypoints++;
+			}
+
+			prevDirX = dirX;
+			prevDirY = dirY;
+			pt = parent;
+		}
+
+		if(mStartPoint != mEndPoint)
+		{
+			func(numWaypoints, mStartPoint);
+			numWaypoints++;
+		}
+
+		return numWaypoints;
+	}
+
+	int ReferencePathFinder::path(Point* waypoints, int capacity) const
+	{
+		int numWaypoints = forEachWaypointReversed([](int, Point) { });
+
+		forEachWaypointReversed([&](int reversedIndex, Point waypoint)
+		{
+			int index = numWaypoints - 1 - reversedIndex;
+			if(index < capacity)
+				waypoints[index] = waypoint;
+		});
+
+		return numWaypoints;
+	}
+
+	PathFinder::Stats ReferencePathFinder::stats() const
+	{
+		PathFinder::Stats stats;
+		stats.mNumPushed = mNumPushed;
+		stats.mNumPopped = mNumPopped;
+		stats.mPeakOpenSize = mPeakOpenSize;
+		stats.mClosedSetSize = mNumExpanded;
+		return stats;
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+
+#include "Obj.h"
+#include "Hierarchy.h"
+#include "HierarchyPathFinder.h"
+#include "RadixHeap.h"
+
+namespace Hierarchy
+{
+	// A plain octile A* over the level 0 cells of a Hierarchy, as the baseline
+	// PathFinder is compared against. It steps between the same cells as
+	// PathFinder, so diagonal steps between two empty cells are allowed, and
+	// its paths are always optimal. The per pixel nodes are allocated by the
+	// first query, and reused by later ones.
+	class ReferencePathFinder
+	{
+	public:
+		ReferencePathFinder(const Hierarchy* hierarchy);
+
+		// Runs a query to completion, returns END_REACHED or UNREACHABLE.
+		PathFinder::IterationRes findPath(Point startPoint, Point endPoint);
+
+		// Only valid after findPath returned END_REACHED.
+		Cost endCost() const { return mEndCost; }
+
+		// The waypoints of the path, like PathFinder::path. Only valid after
+		// findPath returned END_REACHED.
+		int path(Point* waypoints, int capacity) const;
+
+		// Counters of the last query, mClosedSetSize is the number of cells
+		// which were expanded.
+		PathFinder::Stats stats() const;
+
+	private:
+		struct Node
+		{
+			// The generation of the query which last reached the node in the
+			// high bits, and whether it was expanded by that query in bit 0.
+			uint32_t mStamp;
+			uint32_t mParent;
+			Cost mCost;
+		};
+
+		uint32_t pixelIndex(Point pt) const
+		{
+			return (uint32_t)pt.mY * mWidth + pt.mX;
+		}
+
+		Point pixelPoint(uint32_t index) const
+		{
+			return Point((int16_t)(index % mWidth), (int16_t)(index / mWidth));
+		}
+
+		void nextGeneration();
+
+		template <class Func>
+		int forEachWaypointReversed(Func func) const;
+
+		RefPtr<const Hierarchy> mHierarchy;
+		int mWidth;
+		int mHeight;
+
+		std::vector<Node> mNodes;
+		uint32_t mGeneration;
+
+		RadixHeap mOpenSet;
+
+		Point mStartPoint;
+		Point mEndPoint;
+		Cost mEndCost;
+
+		uint64_t mNumPushed;
+		uint64_t mNumPopped;
+		size_t mPeakOpenSize;
+		size_t mNumExpanded;
+	};
+}
@@ -0,0 +1,138 @@
+#include "MapGenerator.h"
+#include "Hierarchy.h"
+#include "HierarchyPathFinder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+// Generates synthetic maps of increasing size, and prints how the time to
+// build their hierarchy, its memory and the latency of random queries
+// scale, as one JSON object per map.
+//
+// Usage: GridPathFindingScaling [maxSize] [numQueries] [seed]
+
+namespace Hierarchy
+{
+	typedef std::chrono::steady_clock Clock;
+
+	static int64_t nanosecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+	}
+
+	struct Workload
+	{
+		MapKind mKind;
+		float mDensity;
+		int mFeatureSize;
+	};
+
+	static const Workload workloads[] =
+	{
+		{ MapKind::RANDOM_BLOCKS, 0.1f, 1 },
+		{ MapKind::RANDOM_BLOCKS, 0.3f, 1 },
+		{ MapKind::RANDOM_BLOCKS, 0.3f, 16 },
+		{ MapKind::MAZE, 0.0f, 4 },
+		{ MapKind::ROOMS, 0.3f, 8 },
+		{ MapKind::CAVES, 0.45f, 2 },
+		{ MapKind::OPEN_FIELD, 0.05f, 8 },
+	};
+
+	// The number of random pixels tried for each query point before a
+	// map is considered to have no walkable pixels.
+	static const int MAX_POINT_TRIES = 1000;
+
+	static void benchmarkWorkload(const Workload& workload, int size, uint64_t seed, int numQueries)
+	{
+		MapOptions options;
+		options.mKind = workload.mKind;
+		options.mWidth = size;
+		options.mHeight = size;
+		options.mSeed = seed;
+		options.mDensity = workload.mDensity;
+		options.mFeatureSize = workload.mFeatureSize;
+
+		std::vector<uint8_t> elevation;
+		Clock::time_point start = Clock::now();
+		generateMap(options, elevation);
+		int64_t generateNs = nanosecondsSince(start);
+
+		start = Clock::now();
+		RefPtr<Hierarchy> hierarchy;
+		hierarchy.setNew(new Hierarchy(size, size, elevation.data()));
+		int64_t buildNs = nanosecondsSince(start);
+
+		std::mt19937 random((uint32_t)seed);
+		auto randomWalkablePoint = [&](Point& pt)
+		{
+			for(int i = 0; i < MAX_POINT_TRIES; i++)
+			{
+				pt = Point((int16_t)(random() % size), (int16_t)(random() % size));
+				if(elevation[(size_t)pt.mY * size + pt.mX])
+					return true;
+			}
+
+			return false;
+		};
+
+		PathFinder pathFinder(hierarchy);
+		int numRun = 0;
+		int numReached = 0;
+		int64_t queryNs = 0;
+		int64_t maxQueryNs = 0;
+		int64_t numIterations = 0;
+		for(int i = 0; i < numQueries; i++)
+		{
+			Point startPoint;
+			Point endPoint;
+			if(!randomWalkablePoint(startPoint) || !randomWalkablePoint(endPoint))
+				break;
+
+			start = Clock::now();
+			PathFinder::IterationRes res = pathFinder.begin(startPoint, endPoint, nullptr);
+			while(res == PathFinder::IterationRes::IN_PROGRESS)
+			{
+				res = pathFinder.iteration(nullptr);
+				numIterations++;
+			}
+			int64_t ns = nanosecondsSince(start);
+
+			numRun++;
+			if(res == PathFinder::IterationRes::END_REACHED)
+				numReached++;
+
+			queryNs += ns;
+			maxQueryNs = std::max(maxQueryNs, ns);
+		}
+
+		size_t numBlocked = std::count(elevation.begin(), elevation.end(), 0);
+		printf("{\"type\":\"scaling\",\"kind\":\"%s\",\"density\":%.2f,\"feature_size\":%d,\"size\":%d,\"seed\":%llu,"
+			"\"blocked_fraction\":%.4f,\"generate_ns\":%lld,\"build_ns\":%lld,\"memory_bytes\":%zu,\"levels\":%d,"
+			"\"queries\":%d,\"reached\":%d,\"mean_query_ns\":%lld,\"max_query_ns\":%lld,\"mean_iterations\":%.1f}\n",
+			mapKindName(workload.mKind), workload.mDensity, workload.mFeatureSize, size, (unsigned long long)seed,
+			(double)numBlocked / elevation.size(), (long long)generateNs, (long long)buildNs, hierarchy->memoryUsage(), hierarchy->numLevels(),
+			numRun, numReached, (long long)(numRun ? queryNs / numRun : 0), (long long)maxQueryNs,
+			numRun ? (double)numIterations / numRun : 0.0);
+		fflush(stdout);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	using namespace Hierarchy;
+
+	int maxSize = argc > 1 ? std::min(atoi(argv[1]), (int)INT16_MAX) : 4096;
+	int numQueries = argc > 2 ? std::max(atoi(argv[2]), 0) : 100;
+	uint64_t seed = argc > 3 ? strtoull(argv[3], nullptr, 10) : 1;
+
+	static const int MIN_SIZE = 512;
+	for(const Workload& workload : workloads)
+	{
+		for(int size = MIN_SIZE; size <= maxSize; size *= 2)
+			benchmarkWorkload(workload, size, seed, numQueries);
+	}
+
+	return 0;
+}
@@ -0,0 +1,83 @@
+#include "Scenario.h"
+
+#include <cstdlib>
+#include <fstream>
+
+namespace Hierarchy
+{
+	// Fields are separated by tabs, so map names may contain spaces. Files
+	// without tabs are split on spaces instead.
+	static void splitFields(const std::string& line, std::vector<std::string>& fields)
+	{
+		char separator = line.find('\t') != std::string::npos ? '\t' : ' ';
+
+		fields.clear();
+		size_t begin = 0;
+		while(begin <= line.size())
+		{
+			size_t end = line.find(separator, begin);
+			if(end == std::string::npos)
+				end = line.size();
+
+			if(end != begin)
+				fields.push_back(line.substr(begin, end - begin));
+
+			begin = end + 1;
+		}
+	}
+
+	static bool parseInt(const std::string& field, int& value)
+	{
+		char* end;
+		long result = strtol(field.c_str(), &end, 10);
+		if(end == field.c_str() || *end != '\0' || result < INT16_MIN || result > INT16_MAX)
+			return false;
+
+		value = (int)result;
+		return true;
+	}
+
+	bool loadScenarios(const char* fileName, std::vector<Scenario>& scenarios)
+	{
+		std::ifstream file(fileName, std::ios::binary);
+		if(!file)
+			return false;
+
+		std::string line;
+		std::vector<std::string> fields;
+		while(std::getline(file, line))
+		{
+			if(!line.empty() && line.back() == '\r')
+				line.pop_back();
+
+			splitFields(line, fields);
+			if(fields.empty() || fields[0] == "version")
+				continue;
+
+			if(fields.size() != 9)
+				return false;
+
+			Scenario scenario;
+			int startX, startY, goalX, goalY;
+			if(!parseInt(fields[0], scenario.mBucket) ||
+				!parseInt(fields[2], scenario.mMapWidth) || !parseInt(fields[3], scenario.mMapHeight) ||
+				!parseInt(fields[4], startX) || !parseInt(fields[5], startY) ||
+				!parseInt(fields[6], goalX) || !parseInt(fields[7], goalY))
+			{
+				return false;
+			}
+
+			char* end;
+			scenario.mOptimalLength = strtod(fields[8].c_str(), &end);
+			if(end == fields[8].c_str())
+				return false;
+
+			scenario.mMapName = fields[1];
+			scenario.mStart = Point((int16_t)startX, (int16_t)startY);
+			scenario.mGoal = Point((int16_t)goalX, (int16_t)goalY);
+			scenarios.push_back(scenario);
+		}
+
+		return true;
+	}
+}
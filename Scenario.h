@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Utils.h"
+
+namespace Hierarchy
+{
+	// A query of a Moving AI .scen file, with the length of the shortest
+	// octile path between its points, which doesn't cut corners.
+	struct Scenario
+	{
+		int mBucket;
+		std::string mMapName;
+		int mMapWidth;
+		int mMapHeight;
+		Point mStart;
+		Point mGoal;
+		double mOptimalLength;
+	};
+
+	// Reads the scenarios of a .scen file, with or without a "version" line.
+	// Returns false if the file can't be read or a line isn't a scenario.
+	bool loadScenarios(const char* fileName, std::vector<Scenario>& scenarios);
+}
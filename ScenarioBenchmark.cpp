@@ -0,0 +1,325 @@
+#include "MapLoader.h"
+#include "Scenario.h"
+#include "HierarchyPathFinder.h"
+#include "ReferencePathFinder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Runs the scenarios of a Moving AI .scen file, and prints one JSON object per
+// line:
+//
+// {"type":"map", ...} with the time to load a map and build its hierarchy,
+// {"type":"bucket", ...} with how the path lengths of the scenarios of a
+// bucket compare to their optimal length, and percentiles of their latency.
+//
+// The optimal lengths of scenarios don't cut corners, while the path finder
+// does, so paths can be shorter than optimal on maps with diagonal gaps. Only
+// scenarios which aren't reached, or whose path is longer than optimal, are
+// counted as mismatches, and any mismatch makes the run fail.
+//
+// Maps are looked up by the scenario's map name in mapDir, which defaults to
+// the directory of the .scen file, and then by the file name only.
+//
+// With --compare, every scenario is also run by ReferencePathFinder, and the
+// buckets get the speedup over it, the mean number of popped steps of both,
+// and the number of scenarios whose costs differ. Any such mismatch makes
+// the run fail.
+//
+// Usage: GridPathFindingScenarios [--compare] scenFile [mapDir] [numRuns]
+
+namespace Hierarchy
+{
+	typedef std::chrono::steady_clock Clock;
+
+	static int64_t nanosecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+	}
+
+	// Path lengths within this distance of the optimal length count as
+	// optimal, the lengths in .scen files are rounded.
+	static const double LENGTH_TOLERANCE = 1e-3;
+
+	struct BucketResults
+	{
+		int mNumScenarios = 0;
+		int mNumReached = 0;
+		int mNumOptimal = 0;
+		int mNumShorter = 0;
+		int mNumLonger = 0;
+		double mExcess = 0.0;
+
+		// The mean time of each scenario, over all runs.
+		std::vector<int64_t> mNs;
+
+		// Only gathered with --compare.
+		int64_t mTotalNs = 0;
+		int64_t mReferenceTotalNs = 0;
+		uint64_t mNumPopped = 0;
+		uint64_t mReferenceNumPopped = 0;
+		int mNumCostMismatches = 0;
+	};
+
+	// A map with the path finder which runs its scenarios, so the closed set
+	// is allocated once per map.
+	struct LoadedMap
+	{
+		RefPtr<Hierarchy> mHierarchy;
+		std::unique_ptr<PathFinder> mPathFinder;
+		std::unique_ptr<ReferencePathFinder> mReferencePathFinder;
+	};
+
+	static RefPtr<Hierarchy> loadMap(const std::filesystem::path& mapDir, const std::string& mapName)
+	{
+		std::filesystem::path fileNames[] =
+		{
+			mapDir / mapName,
+			mapDir / std::filesystem::path(mapName).filename(),
+		};
+
+		for(const std::filesystem::path& fileName : fileNames)
+		{
+			Clock::time_point start = Clock::now();
+			MapLoader loader;
+			if(!loader.open(fileName.string().c_str()))
+				continue;
+
+			RefPtr<Hierarchy> hierarchy = loader.buildHierarchy(BuildOptions());
+			if(!hierarchy)
+				continue;
+
+			int64_t ns = nanosecondsSince(start);
+			printf("{\"type\":\"map\",\"map\":\"%s\",\"width\":%d,\"height\":%d,\"build_ns\":%lld,\"memory_bytes\":%zu}\n",
+				mapName.c_str(), loader.width(), loader.height(), (long long)ns, hierarchy->memoryUsage());
+			return hierarchy;
+		}
+
+		return nullptr;
+	}
+
+	// The length of the path through the waypoints, which are connected by
+	// straight and diagonal lines.
+	static double pathLength(const std::vector<Point>& waypoints)
+	{
+		double ret = 0.0;
+		for(size_t i = 1; i < waypoints.size(); i++)
+		{
+			int xDiff = std::abs(waypoints[i].mX - waypoints[i - 1].mX);
+			int yDiff = std::abs(waypoints[i].mY - waypoints[i - 1].mY);
+			ret += std::min(xDiff, yDiff) * std::sqrt(2.0) + std::abs(xDiff - yDiff);
+		}
+
+		return ret;
+	}
+
+	// The nearest rank percentile of sorted values.
+	static int64_t percentile(const std::vector<int64_t>& sorted, double fraction)
+	{
+		size_t rank = (size_t)std::ceil(fraction * sorted.size());
+		return sorted[std::max(rank, (size_t)1) - 1];
+	}
+
+	// Scenarios which weren't reached, or whose path is longer than optimal.
+	// Shorter paths are expected, since the optimal lengths don't cut
+	// corners.
+	static int numMismatches(const BucketResults& results)
+	{
+		return results.mNumScenarios - results.mNumReached + results.mNumLonger;
+	}
+
+	static void printBucket(const std::string& scenName, int bucket, BucketResults& results, bool compare)
+	{
+		std::sort(results.mNs.begin(), results.mNs.end());
+		printf("{\"type\":\"bucket\",\"scen\":\"%s\",\"bucket\":%d,\"scenarios\":%d,\"reached\":%d,"
+			"\"optimal\":%d,\"shorter\":%d,\"longer\":%d,\"mismatches\":%d,\"mean_excess\":%.6f,"
+			"\"p50_ns\":%lld,\"p90_ns\":%lld,\"p99_ns\":%lld,\"max_ns\":%lld",
+			scenName.c_str(), bucket, results.mNumScenarios, results.mNumReached,
+			results.mNumOptimal, results.mNumShorter, results.mNumLonger, numMismatches(results),
+			results.mNumReached ? results.mExcess / results.mNumReached : 0.0,
+			(long long)percentile(results.mNs, 0.5), (long long)percentile(results.mNs, 0.9),
+			(long long)percentile(results.mNs, 0.99), (long long)results.mNs.back());
+
+		if(compare)
+		{
+			printf(",\"reference_mean_ns\":%lld,\"speedup\":%.3f,\"mean_popped\":%.1f,\"reference_mean_popped\":%.1f,"
+				"\"cost_mismatches\":%d",
+				(long long)(results.mReferenceTotalNs / results.mNumScenarios),
+				results.mTotalNs ? (double)results.mReferenceTotalNs / results.mTotalNs : 0.0,
+				(double)results.mNumPopped / results.mNumScenarios,
+				(double)results.mReferenceNumPopped / results.mNumScenarios,
+				results.mNumCostMismatches);
+		}
+
+		printf("}\n");
+	}
+
+	// Runs a query numRuns times, and returns the mean time of a run.
+	template <class Func>
+	static int64_t timeRuns(int numRuns, Func run)
+	{
+		int64_t totalNs = 0;
+		for(int i = 0; i < numRuns; i++)
+		{
+			Clock::time_point start = Clock::now();
+			run();
+			totalNs += nanosecondsSince(start);
+		}
+
+		return totalNs / numRuns;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	using namespace Hierarchy;
+
+	const char* programName = argv[0];
+	bool compare = argc > 1 && strcmp(argv[1], "--compare") == 0;
+	if(compare)
+	{
+		argc--;
+		argv++;
+	}
+
+	if(argc < 2)
+	{
+		fprintf(stderr, "Usage: %s [--compare] scenFile [mapDir] [numRuns]\n", programName);
+		return 1;
+	}
+
+	std::filesystem::path scenFileName = argv[1];
+	std::filesystem::path mapDir = argc > 2 ? std::filesystem::path(argv[2]) : scenFileName.parent_path();
+	int numRuns = argc > 3 ? std::max(atoi(argv[3]), 1) : 1;
+
+	std::vector<Scenario> scenarios;
+	if(!loadScenarios(scenFileName.string().c_str(), scenarios))
+	{
+		fprintf(stderr, "Failed to load %s\n", scenFileName.string().c_str());
+		return 1;
+	}
+
+	std::string scenName = scenFileName.filename().string();
+	std::map<std::string, LoadedMap> maps;
+	std::map<int, BucketResults> buckets;
+	std::vector<Point> waypoints;
+	int numFailed = 0;
+	for(const Scenario& scenario : scenarios)
+	{
+		auto it = maps.find(scenario.mMapName);
+		if(it == maps.end())
+		{
+			LoadedMap map;
+			map.mHierarchy = loadMap(mapDir, scenario.mMapName);
+			if(map.mHierarchy)
+			{
+				map.mPathFinder.reset(new PathFinder(map.mHierarchy));
+				if(compare)
+					map.mReferencePathFinder.reset(new ReferencePathFinder(map.mHierarchy));
+			}
+			else
+				fprintf(stderr, "Failed to load map %s\n", scenario.mMapName.c_str());
+
+			it = maps.emplace(scenario.mMapName, std::move(map)).first;
+		}
+
+		const LoadedMap& map = it->second;
+		if(!map.mHierarchy)
+		{
+			numFailed++;
+			continue;
+		}
+
+		if(map.mHierarchy->width() != scenario.mMapWidth || map.mHierarchy->height() != scenario.mMapHeight)
+		{
+			fprintf(stderr, "Map %s doesn't have the size of its scenarios\n", scenario.mMapName.c_str());
+			numFailed++;
+			continue;
+		}
+
+		if(scenario.mStart.mX < 0 || scenario.mStart.mX >= scenario.mMapWidth ||
+			scenario.mStart.mY < 0 || scenario.mStart.mY >= scenario.mMapHeight ||
+			scenario.mGoal.mX < 0 || scenario.mGoal.mX >= scenario.mMapWidth ||
+			scenario.mGoal.mY < 0 || scenario.mGoal.mY >= scenario.mMapHeight)
+		{
+			fprintf(stderr, "Scenario point outside of map %s\n", scenario.mMapName.c_str());
+			numFailed++;
+			continue;
+		}
+
+		PathFinder& pathFinder = *map.mPathFinder;
+		PathFinder::IterationRes res = PathFinder::IterationRes::UNREACHABLE;
+		int64_t ns = timeRuns(numRuns, [&]()
+		{
+			res = pathFinder.begin(scenario.mStart, scenario.mGoal, nullptr);
+			while(res == PathFinder::IterationRes::IN_PROGRESS)
+				res = pathFinder.iteration(nullptr);
+		});
+
+		BucketResults& results = buckets[scenario.mBucket];
+		results.mNumScenarios++;
+		results.mNs.push_back(ns);
+
+		if(compare)
+		{
+			ReferencePathFinder& referencePathFinder = *map.mReferencePathFinder;
+			PathFinder::IterationRes referenceRes = PathFinder::IterationRes::UNREACHABLE;
+			int64_t referenceNs = timeRuns(numRuns, [&]()
+			{
+				referenceRes = referencePathFinder.findPath(scenario.mStart, scenario.mGoal);
+			});
+
+			results.mTotalNs += ns;
+			results.mReferenceTotalNs += referenceNs;
+			results.mNumPopped += pathFinder.stats().mNumPopped;
+			results.mReferenceNumPopped += referencePathFinder.stats().mNumPopped;
+
+			bool costsMatch = res == referenceRes &&
+				(res != PathFinder::IterationRes::END_REACHED || pathFinder.endCost() == referencePathFinder.endCost());
+			if(!costsMatch)
+				results.mNumCostMismatches++;
+		}
+
+		if(res != PathFinder::IterationRes::END_REACHED)
+			continue;
+
+		waypoints.resize(pathFinder.path(waypoints.data(), 0));
+		pathFinder.path(waypoints.data(), (int)waypoints.size());
+
+		double length = pathLength(waypoints);
+		results.mNumReached++;
+		if(length < scenario.mOptimalLength - LENGTH_TOLERANCE)
+			results.mNumShorter++;
+		else if(length > scenario.mOptimalLength + LENGTH_TOLERANCE)
+			results.mNumLonger++;
+		else
+			results.mNumOptimal++;
+
+		if(scenario.mOptimalLength > 0.0)
+			results.mExcess += length / scenario.mOptimalLength - 1.0;
+	}
+
+	int numLengthMismatches = 0;
+	int numCostMismatches = 0;
+	for(auto& bucket : buckets)
+	{
+		printBucket(scenName, bucket.first, bucket.second, compare);
+		numLengthMismatches += numMismatches(bucket.second);
+		numCostMismatches += bucket.second.mNumCostMismatches;
+	}
+
+	if(numLengthMismatches)
+		fprintf(stderr, "%d scenarios aren't reached or are longer than their optimal length\n", numLengthMismatches);
+
+	if(numCostMismatches)
+		fprintf(stderr, "%d scenarios don't match the cost of ReferencePathFinder\n", numCostMismatches);
+
+	return numFailed == 0 && numLengthMismatches == 0 && numCostMismatches == 0 ? 0 : 1;
+}
@@ -1,6 +1,7 @@
-#include "pch.h"
 #include "TestCase.h"
 
+#include <utility>
+
 namespace Hierarchy
 {
 	TestCase::TestCase(Hierarchy* hierarchy, const CellAndCorner* roots, int numRoots)
@@ -19,68 +20,57 @@ namespace Hierarchy
 	{
 	}
 
-	RefPtr<TestCase> TestCase::loadFromFile(const char* fileName)
+	// The corner of the root a pixel of the given color marks, or -1 if the
+	// color doesn't mark a root.
+	static int rootCornerOfColor(uint32_t color)
 	{
-		QImage image(fileName);
-		if(image.isNull())
+		switch(color)
 		{
-			return nullptr;
+		case 0xffff0000:
+			return (int)CornerIndex::MIN_X_MIN_Y;
+
+		case 0xff00ff00:
+			return (int)CornerIndex::MAX_X_MIN_Y;
+
+		case 0xff0000ff:
+			return (int)CornerIndex::MIN_X_MAX_Y;
+
+		case 0xffffff00:
+			return (int)CornerIndex::MAX_X_MAX_Y;
+
+		default:
+			return -1;
 		}
+	}
 
-		int imageWidth = image.width();
-		int imageHeight = image.height();
-		
+	RefPtr<TestCase> TestCase::fromImage(int width, int height, const uint32_t* pixels)
+	{
 		RefPtr<TestCase> ret;
 		ret.setNew(new TestCase());
 
+		// The roots can only be added once the hierarchy is built, so they're
+		// collected in the same pass as the elevation.
+		std::vector<uint8_t> elevation(width * height);
+		std::vector<std::pair<Point, CornerIndex>> roots;
+		for(int y = 0; y < height; y++)
 		{
-			std::vector<uint8_t> elevation;
-			elevation.resize(imageWidth * imageHeight);
-
-			int i = 0;
-			for(int y = 0; y < imageHeight; y++)
+			for(int x = 0; x < width; x++)
 			{
-				for(int x = 0; x < imageWidth; x++)
-				{
-					if(image.pixel(x, y) == qRgb(0, 0, 0))
-						elevation[i] = 0;
-					else
-						elevation[i] = 255;
-					i++;
-				}
+				uint32_t color = *(pixels++);
+				elevation[y * width + x] = color == BLOCKED_COLOR ? 0 : 255;
+
+				int rootCorner = rootCornerOfColor(color);
+				if(rootCorner != -1)
+					roots.emplace_back(Point(x, y), (CornerIndex)rootCorner);
 			}
-			
-			ret->mHierarchy.setNew(new Hierarchy(imageWidth, imageHeight, elevation.data()));
 		}
-		
-		for(int y = 0; y < imageHeight; y++)
-		{	
-			for(int x = 0; x < imageWidth; x++)
-			{
-				QRgb color = image.pixel(x, y);
-				switch(color)
-				{
-				case qRgb(255, 0, 0):
-					if(!ret->tryAddRoot(Point(x, y), CornerIndex::MIN_X_MIN_Y))
-						return nullptr;
-					break;
-
-				case qRgb(0, 255, 0):
-					if(!ret->tryAddRoot(Point(x, y), CornerIndex::MAX_X_MIN_Y))
-						return nullptr;
-					break;
-
-				case qRgb(0, 0, 255):
-					if(!ret->tryAddRoot(Point(x, y), CornerIndex::MIN_X_MAX_Y))
-						return nullptr;
-					break;
-
-				case qRgb(255, 255, 0):
-					if(!ret->tryAddRoot(Point(x, y), CornerIndex::MAX_X_MAX_Y))
-						return nullptr;
-					break;
-				}
-			}
+
+		ret->mHierarchy.setNew(new Hierarchy(width, height, elevation.data()));
+
+		for(const std::pair<Point, CornerIndex>& root : roots)
+		{
+			if(!ret->tryAddRoot(root.first, root.second))
+				return nullptr;
 		}
 
 		if(ret->mRoots.empty())
@@ -133,7 +123,6 @@ namespace Hierarchy
 		mHierarchy->rotate90DegCcw();
 
 		int rotatedWidth = mHierarchy->width();
-		int rotatedHeight = mHierarchy->height();
 		for(CellAndCorner& root : mRoots)
 		{
 			CellKey level0CellKey = root.mCell;
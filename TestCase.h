@@ -13,8 +13,19 @@ namespace Hierarchy
 		TestCase(const TestCase& src);
 		virtual ~TestCase();
 
+		// Loads a test case from an image file through Qt, see fromImage.
+		// Defined in TestCaseQt.cpp, which is part of the viewer.
 		static RefPtr<TestCase> loadFromFile(const char* fileName);
 
+		// Builds a test case from 32 bit 0xAARRGGBB pixels, row by row. Black
+		// pixels are blocked, and red, green, blue and yellow pixels mark the
+		// MIN_X_MIN_Y, MAX_X_MIN_Y, MIN_X_MAX_Y and MAX_X_MAX_Y corner of a
+		// root cell. Returns null if a marker isn't at that corner of its
+		// top level cell, or there are no roots.
+		static RefPtr<TestCase> fromImage(int width, int height, const uint32_t* pixels);
+
+		static const uint32_t BLOCKED_COLOR = 0xff000000;
+
 		const Hierarchy* hierarchy() const { return mHierarchy; }
 		const CellAndCorner* rootsBegin() const { return mRoots.data(); }
 		int numRoots() const { return (int)mRoots.size(); }
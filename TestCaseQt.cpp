@@ -0,0 +1,20 @@
+#include "pch.h"
+#include "TestCase.h"
+
+namespace Hierarchy
+{
+	RefPtr<TestCase> TestCase::loadFromFile(const char* fileName)
+	{
+		QImage image(fileName);
+		if(image.isNull())
+		{
+			return nullptr;
+		}
+
+		// Converting indexed images goes through their color table, a
+		// scanline at a time. ARGB32 scanlines are never padded, so the
+		// converted image is one contiguous array of pixels.
+		image = image.convertToFormat(QImage::Format_ARGB32);
+		return fromImage(image.width(), image.height(), (const uint32_t*)image.constBits());
+	}
+}
\ No newline at end of file
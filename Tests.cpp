@@ -0,0 +1,942 @@
+#include "MapGenerator.h"
+#include "Hierarchy.h"
+#include "HierarchyPathFinder.h"
+#include "ReferencePathFinder.h"
+#include "TiledWorld.h"
+
+#include <cstdarg>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+// Checks hierarchies built in different ways against each other, and the
+// path finder against the reference path finder, on generated maps. Every
+// test is registered with ctest on its own, see CMakeLists.txt.
+//
+// Usage: GridPathFindingTests [testName]
+
+namespace Hierarchy
+{
+	static int numFailures = 0;
+
+	static void fail(const char* format, ...)
+	{
+		va_list args;
+		va_start(args, format);
+		vfprintf(stderr, format, args);
+		va_end(args);
+		fputc('\n', stderr);
+
+		numFailures++;
+	}
+
+	struct TestMap
+	{
+		const char* mName;
+		MapOptions mOptions;
+	};
+
+	// Sizes which aren't powers of 2, so the upper levels extend past the
+	// map. The large map has levels which are built in more than one band.
+	static std::vector<TestMap> testMaps()
+	{
+		std::vector<TestMap> ret;
+		auto add = [&](const char* name, MapKind kind, int width, int height, float density, int featureSize)
+		{
+			TestMap map;
+			map.mName = name;
+			map.mOptions.mKind = kind;
+			map.mOptions.mWidth = width;
+			map.mOptions.mHeight = height;
+			map.mOptions.mSeed = 1;
+			map.mOptions.mDensity = density;
+			map.mOptions.mFeatureSize = featureSize;
+			ret.push_back(map);
+		};
+
+		add("blocks", MapKind::RANDOM_BLOCKS, 200, 150, 0.3f, 4);
+		add("noise", MapKind::RANDOM_BLOCKS, 97, 131, 0.2f, 1);
+		add("maze", MapKind::MAZE, 150, 200, 0.0f, 3);
+		add("rooms", MapKind::ROOMS, 256, 180, 0.3f, 6);
+		add("caves", MapKind::CAVES, 180, 180, 0.45f, 2);
+		add("large", MapKind::OPEN_FIELD, 640, 480, 0.05f, 8);
+		return ret;
+	}
+
+	static RefPtr<Hierarchy> buildHierarchy(const MapOptions& mapOptions, const std::vector<uint8_t>& elevation,
+		const BuildOptions& buildOptions)
+	{
+		RefPtr<Hierarchy> ret;
+		ret.setNew(new Hierarchy(mapOptions.mWidth, mapOptions.mHeight, elevation.data(), buildOptions));
+		return ret;
+	}
+
+	static bool walkable(const Hierarchy& hierarchy, Point pt)
+	{
+		return isFullCell(hierarchy.cellAt(CellKey(pt, 0)));
+	}
+
+	// Compares every cell of every level, the top level cell of every
+	// pixel, the adjacency of the full cells if both have it, and the
+	// components, which only have to partition the cells the same way, not
+	// have the same labels.
+	static void checkSameHierarchy(const char* what, const Hierarchy& expected, const Hierarchy& actual)
+	{
+		if(expected.width() != actual.width() || expected.height() != actual.height() ||
+			expected.numLevels() != actual.numLevels())
+		{
+			fail("%s: size or number of levels differs", what);
+			return;
+		}
+
+		for(int levelIndex = 0; levelIndex < expected.numLevels(); levelIndex++)
+		{
+			const HierarchyLevel& level = expected.level(levelIndex);
+			for(int y = 0; y < level.height(); y++)
+			{
+				for(int x = 0; x < level.width(); x++)
+				{
+					CellKey cellKey(Point((int16_t)x, (int16_t)y), (uint8_t)levelIndex);
+					if(expected.cellAt(cellKey) != actual.cellAt(cellKey))
+					{
+						fail("%s: cell (%d, %d) of level %d differs", what, x, y, levelIndex);
+						return;
+					}
+				}
+			}
+		}
+
+		std::map<uint32_t, uint32_t> expectedToActual;
+		std::map<uint32_t, uint32_t> actualToExpected;
+		for(int y = 0; y < expected.height(); y++)
+		{
+			for(int x = 0; x < expected.width(); x++)
+			{
+				Point pt((int16_t)x, (int16_t)y);
+				CellKey cellKey = expected.topLevelCellContainingPoint(pt);
+				if(cellKey != actual.topLevelCellContainingPoint(pt))
+				{
+					fail("%s: top level cell of (%d, %d) differs", what, x, y);
+					return;
+				}
+
+				if(!isFullCell(expected.cellAt(cellKey)))
+					continue;
+
+				if(pt == cellKey.corner(CornerIndex::MIN_X_MIN_Y))
+				{
+					for(int edge = 0; edge < 4; edge++)
+					{
+						const AdjacentCell* expectedBegin;
+						const AdjacentCell* expectedEnd;
+						const AdjacentCell* actualBegin;
+						const AdjacentCell* actualEnd;
+						if(!expected.adjacentCells(cellKey, (EdgeIndex)edge, expectedBegin, expectedEnd) ||
+							!actual.adjacentCells(cellKey, (EdgeIndex)edge, actualBegin, actualEnd))
+						{
+							continue;
+						}
+
+						bool same = expectedEnd - expectedBegin == actualEnd - actualBegin;
+						for(const AdjacentCell* it = expectedBegin; same && it != expectedEnd; it++)
+						{
+							const AdjacentCell& actualCell = actualBegin[it - expectedBegin];
+							same = it->cellKey() == actualCell.cellKey() && it->mFull == actualCell.mFull &&
+								it->mMin == actualCell.mMin && it->mMax == actualCell.mMax;
+						}
+
+						if(!same)
+						{
+							fail("%s: adjacent cells of edge %d of the cell at (%d, %d) differ", what, edge, x, y);
+							return;
+						}
+					}
+				}
+
+				uint32_t expectedComponent = expected.componentOf(cellKey);
+				uint32_t actualComponent = actual.componentOf(cellKey);
+				auto expectedIt = expectedToActual.emplace(expectedComponent, actualComponent).first;
+				auto actualIt = actualToExpected.emplace(actualComponent, expectedComponent).first;
+				if(expectedIt->second != actualComponent || actualIt->second != expectedComponent)
+				{
+					fail("%s: component of (%d, %d) differs", what, x, y);
+					return;
+				}
+			}
+		}
+	}
+
+	static PathFinder::IterationRes runQuery(PathFinder& pathFinder, Point startPoint, Point endPoint)
+	{
+		PathFinder::IterationRes res = pathFinder.begin(startPoint, endPoint, nullptr);
+		while(res == PathFinder::IterationRes::IN_PROGRESS)
+			res = pathFinder.iteration(nullptr);
+
+		return res;
+	}
+
+	// Runs the same random queries on both hierarchies, which must give the
+	// same results and costs.
+	static void checkSameQueries(const char* what, const Hierarchy* expected, const Hierarchy* actual, uint32_t seed)
+	{
+		static const int NUM_QUERIES = 100;
+
+		std::vector<Point> walkablePoints;
+		for(int y = 0; y < expected->height(); y++)
+		{
+			for(int x = 0; x < expected->width(); x++)
+			{
+				if(walkable(*expected, Point((int16_t)x, (int16_t)y)))
+					walkablePoints.push_back(Point((int16_t)x, (int16_t)y));
+			}
+		}
+
+		if(walkablePoints.empty())
+			return;
+
+		PathFinder expectedPathFinder(expected);
+		PathFinder actualPathFinder(actual);
+		std::mt19937 random(seed);
+		for(int i = 0; i < NUM_QUERIES; i++)
+		{
+			Point startPoint = walkablePoints[random() % walkablePoints.size()];
+			Point endPoint = walkablePoints[random() % walkablePoints.size()];
+
+			PathFinder::IterationRes expectedRes = runQuery(expectedPathFinder, startPoint, endPoint);
+			PathFinder::IterationRes actualRes = runQuery(actualPathFinder, startPoint, endPoint);
+			if(expectedRes != actualRes ||
+				(expectedRes == PathFinder::IterationRes::END_REACHED && !(expectedPathFinder.endCost() == actualPathFinder.endCost())))
+			{
+				fail("%s: query from (%d, %d) to (%d, %d) differs", what,
+					startPoint.mX, startPoint.mY, endPoint.mX, endPoint.mY);
+				return;
+			}
+		}
+	}
+
+	struct NamedBuildOptions
+	{
+		const char* mName;
+		BuildOptions mOptions;
+	};
+
+	static std::vector<NamedBuildOptions> buildOptionVariants()
+	{
+		std::vector<NamedBuildOptions> ret;
+		auto add = [&](const char* name, int numThreads, CellLayout cellLayout, bool topLevelLookup, bool adjacency)
+		{
+			NamedBuildOptions variant;
+			variant.mName = name;
+			variant.mOptions.mNumThreads = numThreads;
+			variant.mOptions.mCellLayout = cellLayout;
+			variant.mOptions.mTopLevelLookup = topLevelLookup;
+			variant.mOptions.mAdjacency = adjacency;
+			ret.push_back(variant);
+		};
+
+		add("threads", 4, CellLayout::ROW_MAJOR, false, false);
+		add("morton", 1, CellLayout::MORTON, false, false);
+		add("lookup", 1, CellLayout::ROW_MAJOR, true, false);
+		add("adjacency", 1, CellLayout::ROW_MAJOR, false, true);
+		add("all", 3, CellLayout::MORTON, true, true);
+		return ret;
+	}
+
+	// Builds with threads, the Morton layout and the optional tables must
+	// give the same hierarchy as a serial build without them.
+	static void testBuildOptions()
+	{
+		for(const TestMap& map : testMaps())
+		{
+			std::vector<uint8_t> elevation;
+			generateMap(map.mOptions, elevation);
+
+			RefPtr<Hierarchy> serial = buildHierarchy(map.mOptions, elevation, BuildOptions());
+			for(const NamedBuildOptions& variant : buildOptionVariants())
+			{
+				std::string what = std::string(map.mName) + " " + variant.mName;
+				RefPtr<Hierarchy> hierarchy = buildHierarchy(map.mOptions, elevation, variant.mOptions);
+				checkSameHierarchy(what.c_str(), *serial, *hierarchy);
+				checkSameQueries(what.c_str(), serial, hierarchy, 1);
+			}
+		}
+	}
+
+	// Editing a hierarchy with updateRegion must give the same hierarchy as
+	// building one from the edited map.
+	static void testUpdateRegion()
+	{
+		static const int NUM_EDITS = 20;
+
+		for(const TestMap& map : testMaps())
+		{
+			int width = map.mOptions.mWidth;
+			int height = map.mOptions.mHeight;
+
+			std::vector<uint8_t> elevation;
+			generateMap(map.mOptions, elevation);
+
+			for(const NamedBuildOptions& variant : buildOptionVariants())
+			{
+				std::string what = std::string(map.mName) + " " + variant.mName;
+				RefPtr<Hierarchy> hierarchy = buildHierarchy(map.mOptions, elevation, variant.mOptions);
+				std::vector<uint8_t> edited = elevation;
+
+				// Rectangles of random sizes, which either clear or block
+				// them, or copy noise into them.
+				std::mt19937 random(7);
+				std::vector<uint8_t> region;
+				for(int i = 0; i < NUM_EDITS; i++)
+				{
+					int regionWidth = 1 + random() % std::min(width, 40);
+					int regionHeight = 1 + random() % std::min(height, 40);
+					int x = random() % (width - regionWidth + 1);
+					int y = random() % (height - regionHeight + 1);
+					int mode = random() % 3;
+
+					region.resize(regionWidth * regionHeight);
+					for(uint8_t& pixel : region)
+						pixel = mode == 0 ? 0 : (mode == 1 ? 255 : (random() % 4 == 0 ? 0 : 255));
+
+					hierarchy->updateRegion(x, y, regionWidth, regionHeight, region.data());
+					for(int regionY = 0; regionY < regionHeight; regionY++)
+					{
+						memcpy(edited.data() + (y + regionY) * width + x,
+							region.data() + regionY * regionWidth, regionWidth);
+					}
+				}
+
+				RefPtr<Hierarchy> rebuilt = buildHierarchy(map.mOptions, edited, variant.mOptions);
+				checkSameHierarchy(what.c_str(), *rebuilt, *hierarchy);
+				checkSameQueries(what.c_str(), rebuilt, hierarchy, 2);
+			}
+		}
+	}
+
+	// Small edits of a large map must only look at the cells around them.
+	// Caves and open fields have few narrow passages, so blocking a few
+	// pixels rarely splits a component into large pieces, which is the only
+	// case where updateRegion walks further.
+	static void testUpdateRegionLocal()
+	{
+		static const int NUM_EDITS = 100;
+		static const int MAX_CELLS_LOOKED_AT = 1000;
+
+		std::vector<TestMap> maps;
+		for(const TestMap& map : testMaps())
+		{
+			if(map.mOptions.mKind == MapKind::CAVES || map.mOptions.mKind == MapKind::OPEN_FIELD)
+			{
+				maps.push_back(map);
+				maps.back().mOptions.mWidth = 1024;
+				maps.back().mOptions.mHeight = 1024;
+			}
+		}
+
+		BuildOptions options;
+		options.mAdjacency = true;
+
+		for(const TestMap& map : maps)
+		{
+			int width = map.mOptions.mWidth;
+			int height = map.mOptions.mHeight;
+
+			std::vector<uint8_t> elevation;
+			generateMap(map.mOptions, elevation);
+			RefPtr<Hierarchy> hierarchy = buildHierarchy(map.mOptions, elevation, options);
+
+			int numFullCells = 0;
+			for(int y = 0; y < height; y++)
+			{
+				for(int x = 0; x < width; x++)
+				{
+					Point pt((int16_t)x, (int16_t)y);
+					CellKey cellKey = hierarchy->topLevelCellContainingPoint(pt);
+					if(isFullCell(hierarchy->cellAt(cellKey)) && pt == cellKey.corner(CornerIndex::MIN_X_MIN_Y))
+						numFullCells++;
+				}
+			}
+
+			if(numFullCells < 20 * MAX_CELLS_LOOKED_AT)
+				fail("%s: only %d full cells, too few to tell whether updates stay local", map.mName, numFullCells);
+
+			std::mt19937 random(11);
+			for(int i = 0; i < NUM_EDITS; i++)
+			{
+				int x = random() % (width - 1);
+				int y = random() % (height - 1);
+				uint8_t value = random() % 2 == 0 ? 0 : 255;
+				uint8_t region[4] = { value, value, value, value };
+
+				int numCellsLookedAt = hierarchy->updateRegion(x, y, 2, 2, region);
+				if(numCellsLookedAt > MAX_CELLS_LOOKED_AT)
+				{
+					fail("%s: edit at (%d, %d) looked at %d of %d cells", map.mName, x, y,
+						numCellsLookedAt, numFullCells);
+				}
+
+				for(int regionY = 0; regionY < 2; regionY++)
+					memcpy(elevation.data() + (y + regionY) * width + x, region + 2 * regionY, 2);
+			}
+
+			RefPtr<Hierarchy> rebuilt = buildHierarchy(map.mOptions, elevation, options);
+			checkSameHierarchy(map.mName, *rebuilt, *hierarchy);
+		}
+	}
+
+	// A hierarchy loaded from a file must be the same as the one which was
+	// saved.
+	static void testSaveLoad()
+	{
+		std::string fileName = (std::filesystem::temp_directory_path() / "GridPathFindingTests.hierarchy").string();
+
+		for(const TestMap& map : testMaps())
+		{
+			std::vector<uint8_t> elevation;
+			generateMap(map.mOptions, elevation);
+
+			for(const NamedBuildOptions& variant : buildOptionVariants())
+			{
+				std::string what = std::string(map.mName) + " " + variant.mName;
+				RefPtr<Hierarchy> saved = buildHierarchy(map.mOptions, elevation, variant.mOptions);
+				if(!saved->saveToFile(fileName.c_str()))
+				{
+					fail("%s: can't save to %s", what.c_str(), fileName.c_str());
+					continue;
+				}
+
+				RefPtr<Hierarchy> loaded = Hierarchy::loadFromFile(fileName.c_str());
+				if(!loaded)
+				{
+					fail("%s: can't load %s", what.c_str(), fileName.c_str());
+					continue;
+				}
+
+				checkSameHierarchy(what.c_str(), *saved, *loaded);
+				checkSameQueries(what.c_str(), saved, loaded, 3);
+			}
+		}
+
+		std::filesystem::remove(fileName);
+	}
+
+	// loadFromFile must reject files whose sizes or tables would make the
+	// hierarchy read out of bounds. The byte offsets are those of FileHeader
+	// in Hierarchy.cpp.
+	static void testLoadInvalidFile()
+	{
+		static const size_t WIDTH_OFFSET = 8;
+		static const size_t COMPONENTS_OFFSET = 32;
+		static const size_t COMPONENT_PARENTS_OFFSET = 48;
+		static const size_t ADJACENCY_OFFSETS_OFFSET = 80;
+
+		std::string fileName = (std::filesystem::temp_directory_path() / "GridPathFindingTests.hierarchy").string();
+
+		TestMap map = testMaps()[4];
+		std::vector<uint8_t> elevation;
+		generateMap(map.mOptions, elevation);
+
+		BuildOptions options;
+		options.mAdjacency = true;
+		RefPtr<Hierarchy> saved = buildHierarchy(map.mOptions, elevation, options);
+		if(!saved->saveToFile(fileName.c_str()))
+		{
+			fail("%s: can't save to %s", map.mName, fileName.c_str());
+			return;
+		}
+
+		std::vector<uint8_t> file(std::filesystem::file_size(fileName));
+		{
+			std::ifstream stream(fileName, std::ios::binary);
+			stream.read((char*)file.data(), (std::streamsize)file.size());
+		}
+
+		auto readU64 = [&](size_t offset)
+		{
+			uint64_t value;
+			memcpy(&value, file.data() + offset, sizeof(value));
+			return value;
+		};
+
+		// The first full cell in the component table.
+		uint64_t componentsOffset = readU64(COMPONENTS_OFFSET);
+		size_t entryOffset = (size_t)componentsOffset;
+		while(readU64(entryOffset) == ~0ull)
+			entryOffset += 16;
+
+		uint64_t parentsOffset = readU64(COMPONENT_PARENTS_OFFSET);
+		uint64_t adjacencyOffsetsOffset = readU64(ADJACENCY_OFFSETS_OFFSET);
+
+		struct Corruption
+		{
+			const char* mName;
+			size_t mOffset;
+			uint32_t mValue;
+		};
+
+		const Corruption corruptions[] =
+		{
+			{ "none", 0, 0 },
+			{ "width past INT16_MAX", WIDTH_OFFSET, 40000 },
+			{ "component past the parents", entryOffset + 8, ~0u },
+			{ "cell index past the offsets", entryOffset + 12, ~0u },
+			{ "parent after its component", (size_t)parentsOffset, 1 },
+			{ "decreasing adjacency offsets", (size_t)adjacencyOffsetsOffset + 4, ~0u },
+		};
+
+		for(const Corruption& corruption : corruptions)
+		{
+			for(bool truncate : { false, true })
+			{
+				std::vector<uint8_t> corrupted = file;
+				if(corruption.mOffset != 0)
+					memcpy(corrupted.data() + corruption.mOffset, &corruption.mValue, sizeof(corruption.mValue));
+				if(truncate)
+					corrupted.resize(corrupted.size() - 1);
+
+				{
+					std::ofstream stream(fileName, std::ios::binary | std::ios::trunc);
+					stream.write((const char*)corrupted.data(), (std::streamsize)corrupted.size());
+				}
+
+				bool valid = corruption.mOffset == 0 && !truncate;
+				RefPtr<Hierarchy> loaded = Hierarchy::loadFromFile(fileName.c_str());
+				if((bool)loaded != valid)
+				{
+					fail("%s: %s%s file was %s", map.mName, corruption.mName, truncate ? ", truncated" : "",
+						loaded ? "loaded" : "rejected");
+				}
+			}
+		}
+
+		// A component table without an empty slot, with as many full cells.
+		{
+			std::vector<uint8_t> corrupted = file;
+			uint64_t numEntries = readU64(COMPONENTS_OFFSET + 8);
+			uint32_t numFullCells = (uint32_t)numEntries;
+			memcpy(corrupted.data() + 28, &numFullCells, sizeof(numFullCells));
+			for(uint64_t i = 0; i < numEntries; i++)
+			{
+				uint8_t* entry = corrupted.data() + componentsOffset + 16 * i;
+				uint64_t key;
+				memcpy(&key, entry, sizeof(key));
+				if(key == ~0ull)
+					memcpy(entry, file.data() + entryOffset, 16);
+			}
+
+			{
+				std::ofstream stream(fileName, std::ios::binary | std::ios::trunc);
+				stream.write((const char*)corrupted.data(), (std::streamsize)corrupted.size());
+			}
+
+			if(Hierarchy::loadFromFile(fileName.c_str()))
+				fail("%s: full component table was loaded", map.mName);
+		}
+
+		std::filesystem::remove(fileName);
+	}
+
+	// The lookup table must give the same top level cells as climbing the
+	// levels, also for the cells outside of the map which path finders look
+	// at next to walkable border pixels.
+	static void testTopLevelLookup()
+	{
+		BuildOptions lookupOptions;
+		lookupOptions.mTopLevelLookup = true;
+
+		for(const TestMap& map : testMaps())
+		{
+			int width = map.mOptions.mWidth;
+			int height = map.mOptions.mHeight;
+
+			std::vector<uint8_t> elevation;
+			generateMap(map.mOptions, elevation);
+			for(int x = 0; x < width; x++)
+			{
+				elevation[x] = 255;
+				elevation[(height - 1) * width + x] = 255;
+			}
+
+			for(int y = 0; y < height; y++)
+			{
+				elevation[y * width] = 255;
+				elevation[y * width + width - 1] = 255;
+			}
+
+			RefPtr<Hierarchy> climbing = buildHierarchy(map.mOptions, elevation, BuildOptions());
+			RefPtr<Hierarchy> lookup = buildHierarchy(map.mOptions, elevation, lookupOptions);
+			checkSameHierarchy(map.mName, *climbing, *lookup);
+			checkSameQueries(map.mName, climbing, lookup, 4);
+
+			// The two rings of cells around every level.
+			for(int levelIndex = 0; levelIndex < climbing->numLevels(); levelIndex++)
+			{
+				const HierarchyLevel& level = climbing->level(levelIndex);
+				for(int y = -2; y < level.height() + 2; y++)
+				{
+					for(int x = -2; x < level.width() + 2; x++)
+					{
+						if(x == 0 && y >= 0 && y < level.height())
+							x = level.width();
+
+						CellKey cellKey(Point((int16_t)x, (int16_t)y), (uint8_t)levelIndex);
+						if(climbing->topLevelCellContaining(cellKey) != cellKey ||
+							lookup->topLevelCellContaining(cellKey) != cellKey)
+						{
+							fail("%s: top level cell of cell (%d, %d) of level %d outside of the map differs", map.mName,
+								x, y, levelIndex);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// Whether the waypoints go from startPoint to endPoint in straight or
+	// diagonal lines over walkable pixels only, at a total cost of cost.
+	static bool validPath(const Hierarchy& hierarchy, const std::vector<Point>& waypoints,
+		Point startPoint, Point endPoint, Cost cost)
+	{
+		if(waypoints.empty() || waypoints.front() != startPoint || waypoints.back() != endPoint)
+			return false;
+
+		Cost pathCost(0, 0);
+		for(size_t i = 1; i < waypoints.size(); i++)
+		{
+			Point from = waypoints[i - 1];
+			Point to = waypoints[i];
+			int dx = to.mX - from.mX;
+			int dy = to.mY - from.mY;
+			if(dx != 0 && dy != 0 && std::abs(dx) != std::abs(dy))
+				return false;
+
+			Point pt = from;
+			while(true)
+			{
+				if(!walkable(hierarchy, pt))
+					return false;
+
+				if(pt == to)
+					break;
+
+				pt.mX += (int16_t)((dx > 0) - (dx < 0));
+				pt.mY += (int16_t)((dy > 0) - (dy < 0));
+			}
+
+			pathCost += Cost::distance(from, to);
+		}
+
+		return pathCost == cost;
+	}
+
+	// The path finder must find paths as short as the reference path
+	// finder's, which searches the pixels directly, on small maps of every
+	// kind, with and without walkable border pixels.
+	static void testPathFinderOptimal()
+	{
+		static const int NUM_QUERIES = 20;
+		static const int SIZES[] = { 16, 33, 64 };
+		static const int FEATURE_SIZES[] = { 1, 2, 4 };
+		static const int NUM_SEEDS = 4;
+
+		for(int kind = 0; kind <= (int)MapKind::OPEN_FIELD; kind++)
+		{
+			for(int size : SIZES)
+			{
+				for(int featureSize : FEATURE_SIZES)
+				{
+					for(int seed = 1; seed <= NUM_SEEDS; seed++)
+					{
+						for(int openBorder = 0; openBorder < 2; openBorder++)
+						{
+							MapOptions options;
+							options.mKind = (MapKind)kind;
+							options.mWidth = size;
+							options.mHeight = size;
+							options.mSeed = seed;
+							options.mDensity = 0.3f;
+							options.mFeatureSize = featureSize;
+
+							std::vector<uint8_t> elevation;
+							generateMap(options, elevation);
+							if(openBorder)
+							{
+								for(int i = 0; i < size; i++)
+								{
+									elevation[i] = elevation[(size - 1) * size + i] = 255;
+									elevation[i * size] = elevation[i * size + size - 1] = 255;
+								}
+							}
+
+							RefPtr<Hierarchy> hierarchy = buildHierarchy(options, elevation, BuildOptions());
+
+							std::vector<Point> walkablePoints;
+							for(int y = 0; y < size; y++)
+							{
+								for(int x = 0; x < size; x++)
+								{
+									if(walkable(*hierarchy, Point((int16_t)x, (int16_t)y)))
+										walkablePoints.push_back(Point((int16_t)x, (int16_t)y));
+								}
+							}
+
+							if(walkablePoints.empty())
+								continue;
+
+							PathFinder pathFinder(hierarchy);
+							ReferencePathFinder referencePathFinder(hierarchy);
+							std::mt19937 random(seed);
+							std::vector<Point> waypoints;
+							for(int i = 0; i < NUM_QUERIES; i++)
+							{
+								Point startPoint = walkablePoints[random() % walkablePoints.size()];
+								Point endPoint = walkablePoints[random() % walkablePoints.size()];
+
+								PathFinder::IterationRes res = runQuery(pathFinder, startPoint, endPoint);
+								PathFinder::IterationRes referenceRes = referencePathFinder.findPath(startPoint, endPoint);
+								if(res != referenceRes ||
+									(res == PathFinder::IterationRes::END_REACHED && !(pathFinder.endCost() == referencePathFinder.endCost())))
+								{
+									fail("kind %d size %d feature size %d seed %d%s: query from (%d, %d) to (%d, %d) isn't optimal",
+										kind, size, featureSize, seed, openBorder ? " open border" : "",
+										startPoint.mX, startPoint.mY, endPoint.mX, endPoint.mY);
+									continue;
+								}
+
+								if(res != PathFinder::IterationRes::END_REACHED)
+									continue;
+
+								waypoints.resize(pathFinder.path(nullptr, 0));
+								pathFinder.path(waypoints.data(), (int)waypoints.size());
+								if(!validPath(*hierarchy, waypoints, startPoint, endPoint, pathFinder.endCost()))
+								{
+									fail("kind %d size %d feature size %d seed %d%s: path from (%d, %d) to (%d, %d) is invalid",
+										kind, size, featureSize, seed, openBorder ? " open border" : "",
+										startPoint.mX, startPoint.mY, endPoint.mX, endPoint.mY);
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+
+		// A maze where the search used to close a point through a longer
+		// path than the one which ended up shortest.
+		MapOptions options;
+		options.mKind = MapKind::MAZE;
+		options.mWidth = 16;
+		options.mHeight = 16;
+		options.mSeed = 6;
+		options.mDensity = 0.3f;
+		options.mFeatureSize = 2;
+
+		std::vector<uint8_t> elevation;
+		generateMap(options, elevation);
+		RefPtr<Hierarchy> hierarchy = buildHierarchy(options, elevation, BuildOptions());
+		PathFinder pathFinder(hierarchy);
+		if(runQuery(pathFinder, Point(9, 2), Point(7, 3)) != PathFinder::IterationRes::END_REACHED ||
+			!(pathFinder.endCost() == Cost(1, 1)))
+		{
+			fail("maze: query from (9, 2) to (7, 3) doesn't cost 1 + sqrt(2)");
+		}
+	}
+
+	// Splits the map into numTiles x numTiles tiles, and runs the queries
+	// on the tiled world and on the whole map. The tiled world must reach
+	// the same points as the reference path finder. Paths through portals
+	// can be longer, but never shorter, and must stay walkable across the
+	// tile borders. Returns the number of queries which reached their end.
+	static int checkTiledWorld(const char* what, const std::vector<uint8_t>& elevation, int tileSize, int numTiles,
+		const std::vector<std::pair<Point, Point>>& queries)
+	{
+		int size = tileSize * numTiles;
+
+		RefPtr<Hierarchy> hierarchy;
+		hierarchy.setNew(new Hierarchy(size, size, elevation.data()));
+
+		RefPtr<TiledWorld> world;
+		world.setNew(new TiledWorld(tileSize, numTiles, numTiles));
+		std::vector<uint8_t> tileElevation(tileSize * tileSize);
+		for(int tileY = 0; tileY < numTiles; tileY++)
+		{
+			for(int tileX = 0; tileX < numTiles; tileX++)
+			{
+				for(int y = 0; y < tileSize; y++)
+				{
+					memcpy(tileElevation.data() + y * tileSize,
+						elevation.data() + (tileY * tileSize + y) * size + tileX * tileSize, tileSize);
+				}
+
+				RefPtr<Hierarchy> tile;
+				tile.setNew(new Hierarchy(tileSize, tileSize, tileElevation.data()));
+				world->setTile(tileX, tileY, tile);
+			}
+		}
+
+		world->buildPortals(2);
+
+		TiledPathFinder pathFinder(world);
+		ReferencePathFinder referencePathFinder(hierarchy);
+		std::vector<WorldPoint> worldWaypoints;
+		std::vector<Point> waypoints;
+		int numReached = 0;
+		for(const std::pair<Point, Point>& query : queries)
+		{
+			Point startPoint = query.first;
+			Point endPoint = query.second;
+
+			PathFinder::IterationRes res = pathFinder.findPath(WorldPoint(startPoint.mX, startPoint.mY), WorldPoint(endPoint.mX, endPoint.mY));
+			PathFinder::IterationRes referenceRes = referencePathFinder.findPath(startPoint, endPoint);
+			if(res != referenceRes ||
+				(res == PathFinder::IterationRes::END_REACHED && pathFinder.endCost() < referencePathFinder.endCost()))
+			{
+				fail("%s: query from (%d, %d) to (%d, %d) differs from the whole map", what,
+					startPoint.mX, startPoint.mY, endPoint.mX, endPoint.mY);
+				continue;
+			}
+
+			if(res != PathFinder::IterationRes::END_REACHED)
+				continue;
+
+			numReached++;
+
+			worldWaypoints.resize(pathFinder.path(nullptr, 0));
+			pathFinder.path(worldWaypoints.data(), (int)worldWaypoints.size());
+			waypoints.clear();
+			for(WorldPoint pt : worldWaypoints)
+				waypoints.push_back(Point((int16_t)pt.mX, (int16_t)pt.mY));
+
+			if(!validPath(*hierarchy, waypoints, startPoint, endPoint, pathFinder.endCost()))
+			{
+				fail("%s: path from (%d, %d) to (%d, %d) is invalid", what,
+					startPoint.mX, startPoint.mY, endPoint.mX, endPoint.mY);
+			}
+		}
+
+		return numReached;
+	}
+
+	static void testTiledWorld()
+	{
+		static const int NUM_QUERIES = 50;
+
+		struct TiledMap
+		{
+			const char* mName;
+			MapKind mKind;
+			int mTileSize;
+			int mNumTiles;
+		};
+
+		static const TiledMap TILED_MAPS[] =
+		{
+			{ "tiled caves", MapKind::CAVES, 32, 3 },
+			{ "tiled rooms", MapKind::ROOMS, 32, 3 },
+			{ "tiled maze", MapKind::MAZE, 40, 2 },
+			{ "tiled open field", MapKind::OPEN_FIELD, 40, 2 },
+			{ "tiled noise", MapKind::RANDOM_BLOCKS, 33, 3 },
+		};
+
+		for(const TiledMap& tiledMap : TILED_MAPS)
+		{
+			MapOptions options;
+			options.mKind = tiledMap.mKind;
+			options.mWidth = tiledMap.mTileSize * tiledMap.mNumTiles;
+			options.mHeight = options.mWidth;
+			options.mSeed = 1;
+			options.mDensity = 0.3f;
+			options.mFeatureSize = 2;
+
+			std::vector<uint8_t> elevation;
+			generateMap(options, elevation);
+
+			std::vector<Point> walkablePoints;
+			for(int y = 0; y < options.mHeight; y++)
+			{
+				for(int x = 0; x < options.mWidth; x++)
+				{
+					if(elevation[y * options.mWidth + x] != 0)
+						walkablePoints.push_back(Point((int16_t)x, (int16_t)y));
+				}
+			}
+
+			if(walkablePoints.empty())
+				continue;
+
+			std::mt19937 random(1);
+			std::vector<std::pair<Point, Point>> queries;
+			for(int i = 0; i < NUM_QUERIES; i++)
+			{
+				Point startPoint = walkablePoints[random() % walkablePoints.size()];
+				Point endPoint = walkablePoints[random() % walkablePoints.size()];
+				queries.emplace_back(startPoint, endPoint);
+			}
+
+			if(checkTiledWorld(tiledMap.mName, elevation, tiledMap.mTileSize, tiledMap.mNumTiles, queries) == 0)
+				fail("%s: no query reached its end", tiledMap.mName);
+		}
+
+		// A diagonal line, which only goes from one tile to the next through
+		// the corners the tiles share.
+		static const int DIAGONAL_TILE_SIZE = 8;
+		static const int DIAGONAL_NUM_TILES = 3;
+		int size = DIAGONAL_TILE_SIZE * DIAGONAL_NUM_TILES;
+		std::vector<uint8_t> elevation(size * size, 0);
+		for(int i = 0; i < size; i++)
+			elevation[i * size + i] = 255;
+
+		std::vector<std::pair<Point, Point>> queries;
+		queries.emplace_back(Point(0, 0), Point((int16_t)(size - 1), (int16_t)(size - 1)));
+		queries.emplace_back(Point(20, 20), Point(3, 3));
+		if(checkTiledWorld("tiled diagonal", elevation, DIAGONAL_TILE_SIZE, DIAGONAL_NUM_TILES, queries) != (int)queries.size())
+			fail("tiled diagonal: the line isn't crossed through the tile corners");
+	}
+
+	struct Test
+	{
+		const char* mName;
+		void (*mFunc)();
+	};
+
+	static const Test tests[] =
+	{
+		{ "BuildOptions", testBuildOptions },
+		{ "UpdateRegion", testUpdateRegion },
+		{ "UpdateRegionLocal", testUpdateRegionLocal },
+		{ "SaveLoad", testSaveLoad },
+		{ "LoadInvalidFile", testLoadInvalidFile },
+		{ "TopLevelLookup", testTopLevelLookup },
+		{ "PathFinderOptimal", testPathFinderOptimal },
+		{ "TiledWorld", testTiledWorld },
+	};
+}
+
+int main(int argc, char* argv[])
+{
+	using namespace Hierarchy;
+
+	bool found = false;
+	for(const Test& test : tests)
+	{
+		if(argc > 1 && strcmp(argv[1], test.mName) != 0)
+			continue;
+
+		found = true;
+		int prevNumFailures = numFailures;
+		test.mFunc();
+		printf("%s: %s\n", test.mName, numFailures == prevNumFailures ? "passed" : "failed");
+	}
+
+	if(!found)
+	{
+		fprintf(stderr, "Unknown test %s\n", argv[1]);
+		return 1;
+	}
+
+	return numFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,569 @@
+#include "TiledWorld.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace Hierarchy
+{
+	static Cost worldDistance(WorldPoint a, WorldPoint b)
+	{
+		int xDiff = std::abs(a.mX - b.mX);
+		int yDiff = std::abs(a.mY - b.mY);
+		if(xDiff < yDiff)
+			return Cost(yDiff - xDiff, xDiff);
+		else
+			return Cost(xDiff - yDiff, yDiff);
+	}
+
+	static PathFinder::IterationRes runPathFinder(PathFinder& pathFinder, Point from, Point to)
+	{
+		PathFinder::IterationRes res = pathFinder.begin(from, to, nullptr);
+		while(res == PathFinder::IterationRes::IN_PROGRESS)
+			res = pathFinder.iteration(nullptr);
+
+		return res;
+	}
+
+	TiledWorld::TiledWorld(int tileSize, int numTilesX, int numTilesY)
+		: mTileSize(tileSize),
+		mNumTilesX(numTilesX),
+		mNumTilesY(numTilesY),
+		mTiles(numTilesX * numTilesY)
+	{
+		DIDA_ASSERT(tileSize > 0 && tileSize <= INT16_MAX);
+		DIDA_ASSERT(numTilesX > 0 && numTilesY > 0);
+
+		mTileNodeOffsets.assign(mTiles.size() + 1, 0);
+		mEdgeOffsets.assign(1, 0);
+	}
+
+	void TiledWorld::setTile(int tileX, int tileY, const Hierarchy* hierarchy)
+	{
+		DIDA_ASSERT(tileX >= 0 && tileX < mNumTilesX && tileY >= 0 && tileY < mNumTilesY);
+		DIDA_ASSERT(!hierarchy || (hierarchy->width() == mTileSize && hierarchy->height() == mTileSize));
+
+		mTiles[tileY * mNumTilesX + tileX] = hierarchy;
+	}
+
+	bool TiledWorld::walkable(WorldPoint pt) const
+	{
+		const Hierarchy* hierarchy = mTiles[tileIndexOf(pt)];
+		return hierarchy && isFullCell(hierarchy->cellAt(CellKey(localPoint(pt), 0)));
+	}
+
+	uint32_t TiledWorld::tileIndexOf(WorldPoint pt) const
+	{
+		return (uint32_t)((pt.mY / mTileSize) * mNumTilesX + pt.mX / mTileSize);
+	}
+
+	Point TiledWorld::localPoint(WorldPoint pt) const
+	{
+		return Point(pt.mX % mTileSize, pt.mY % mTileSize);
+	}
+
+	void TiledWorld::addBorderCrossings(int tileX, int tileY, Axis2 axis, std::vector<Crossing>& crossings) const
+	{
+		// The border between the tile and its neighbor along axis. a(i) is
+		// the i-th pixel along the border on the tile's side, b(i) the one on
+		// the neighbor's side.
+		WorldPoint base(tileX * mTileSize, tileY * mTileSize);
+		auto a = [&](int i)
+		{
+			return axis == Axis2::X ?
+				WorldPoint(base.mX + mTileSize - 1, base.mY + i) :
+				WorldPoint(base.mX + i, base.mY + mTileSize - 1);
+		};
+
+		auto b = [&](int i)
+		{
+			return axis == Axis2::X ?
+				WorldPoint(base.mX + mTileSize, base.mY + i) :
+				WorldPoint(base.mX + i, base.mY + mTileSize);
+		};
+
+		std::vector<bool> aWalkable(mTileSize);
+		std::vector<bool> bWalkable(mTileSize);
+		for(int i = 0; i < mTileSize; i++)
+		{
+			aWalkable[i] = walkable(a(i));
+			bWalkable[i] = walkable(b(i));
+		}
+
+		auto straight = [&](int i)
+		{
+			return i >= 0 && i < mTileSize && aWalkable[i] && bWalkable[i];
+		};
+
+		int runBegin = -1;
+		for(int i = 0; i <= mTileSize; i++)
+		{
+			if(straight(i))
+			{
+				if(runBegin == -1)
+					runBegin = i;
+
+				continue;
+			}
+
+			if(runBegin != -1)
+			{
+				int runEnd = i;
+				if(runEnd - runBegin >= LONG_RUN_LENGTH)
+				{
+					crossings.push_back({ a(runBegin), b(runBegin) });
+					crossings.push_back({ a(runEnd - 1), b(runEnd - 1) });
+				}
+				else
+				{
+					int mid = (runBegin + runEnd) / 2;
+					crossings.push_back({ a(mid), b(mid) });
+				}
+
+				runBegin = -1;
+			}
+
+			// Diagonal steps across the border only need a portal of their
+			// own where neither end is part of a straight crossing.
+			if(i + 1 < mTileSize && !straight(i + 1))
+			{
+				if(aWalkable[i] && bWalkable[i + 1])
+					crossings.push_back({ a(i), b(i + 1) });
+
+				if(aWalkable[i + 1] && bWalkable[i])
+					crossings.push_back({ a(i + 1), b(i) });
+			}
+		}
+	}
+
+	void TiledWorld::addCornerCrossings(int tileX, int tileY, std::vector<Crossing>& crossings) const
+	{
+		// The diagonal steps through the corner shared by the tile and its
+		// neighbors in the positive x and y direction.
+		int x = (tileX + 1) * mTileSize;
+		int y = (tileY + 1) * mTileSize;
+
+		WorldPoint minXMinY(x - 1, y - 1);
+		WorldPoint maxXMaxY(x, y);
+		if(walkable(minXMinY) && walkable(maxXMaxY))
+			crossings.push_back({ minXMinY, maxXMaxY });
+
+		WorldPoint maxXMinY(x, y - 1);
+		WorldPoint minXMaxY(x - 1, y);
+		if(walkable(maxXMinY) && walkable(minXMaxY))
+			crossings.push_back({ maxXMinY, minXMaxY });
+	}
+
+	void TiledWorld::buildPortals(int numThreads)
+	{
+		DIDA_ASSERT(numThreads >= 1);
+
+		std::vector<Crossing> crossings;
+		for(int tileY = 0; tileY < mNumTilesY; tileY++)
+		{
+			for(int tileX = 0; tileX < mNumTilesX; tileX++)
+			{
+				if(tileX + 1 < mNumTilesX)
+					addBorderCrossings(tileX, tileY, Axis2::X, crossings);
+
+				if(tileY + 1 < mNumTilesY)
+					addBorderCrossings(tileX, tileY, Axis2::Y, crossings);
+
+				if(tileX + 1 < mNumTilesX && tileY + 1 < mNumTilesY)
+					addCornerCrossings(tileX, tileY, crossings);
+			}
+		}
+
+		// Every crossing has a node on either side, ordered by tile.
+		mTileNodeOffsets.assign(mTiles.size() + 1, 0);
+		for(const Crossing& crossing : crossings)
+		{
+			mTileNodeOffsets[tileIndexOf(crossing.mA) + 1]++;
+			mTileNodeOffsets[tileIndexOf(crossing.mB) + 1]++;
+		}
+
+		for(size_t i = 1; i < mTileNodeOffsets.size(); i++)
+			mTileNodeOffsets[i] += mTileNodeOffsets[i - 1];
+
+		std::vector<uint32_t> tileFill(mTileNodeOffsets.begin(), mTileNodeOffsets.end() - 1);
+		mNodes.resize(2 * crossings.size());
+
+		struct EdgeEntry
+		{
+			uint32_t mFrom;
+			TiledWorld::PortalEdge mEdge;
+		};
+
+		std::vector<EdgeEntry> crossingEdges;
+		for(const Crossing& crossing : crossings)
+		{
+			uint32_t aTile = tileIndexOf(crossing.mA);
+			uint32_t bTile = tileIndexOf(crossing.mB);
+			uint32_t aNode = tileFill[aTile]++;
+			uint32_t bNode = tileFill[bTile]++;
+			mNodes[aNode] = { crossing.mA, aTile };
+			mNodes[bNode] = { crossing.mB, bTile };
+
+			Cost cost = worldDistance(crossing.mA, crossing.mB);
+			crossingEdges.push_back({ aNode, { bNode, cost } });
+			crossingEdges.push_back({ bNode, { aNode, cost } });
+		}
+
+		// The tile local edges, found on numThreads threads which claim tiles
+		// from a shared counter.
+		std::vector<std::vector<EdgeEntry>> tileEdges(mTiles.size());
+		std::atomic<uint32_t> nextTile(0);
+		auto connectTiles = [&]()
+		{
+			while(true)
+			{
+				uint32_t tileIndex = nextTile++;
+				if(tileIndex >= mTiles.size())
+					break;
+
+				uint32_t nodesBegin = mTileNodeOffsets[tileIndex];
+				uint32_t nodesEnd = mTileNodeOffsets[tileIndex + 1];
+				if(nodesEnd - nodesBegin < 2)
+					continue;
+
+				const Hierarchy* hierarchy = mTiles[tileIndex];
+				PathFinder pathFinder(hierarchy);
+
+				std::vector<uint32_t> components(nodesEnd - nodesBegin);
+				for(uint32_t i = nodesBegin; i < nodesEnd; i++)
+				{
+					CellKey cellKey = hierarchy->topLevelCellContainingPoint(localPoint(mNodes[i].mPoint));
+					components[i - nodesBegin] = hierarchy->componentOf(cellKey);
+				}
+
+				std::vector<EdgeEntry>& edges = tileEdges[tileIndex];
+				for(uint32_t i = nodesBegin; i < nodesEnd; i++)
+				{
+					for(uint32_t j = i + 1; j < nodesEnd; j++)
+					{
+						if(components[i - nodesBegin] != components[j - nodesBegin])
+							continue;
+
+						Point from = localPoint(mNodes[i].mPoint);
+						Point to = localPoint(mNodes[j].mPoint);
+
+						Cost cost(0, 0);
+						if(from != to)
+						{
+							if(runPathFinder(pathFinder, from, to) != PathFinder::IterationRes::END_REACHED)
+								continue;
+
+							cost = pathFinder.endCost();
+						}
+
+						edges.push_back({ i, { j, cost } });
+						edges.push_back({ j, { i, cost } });
+					}
+				}
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for(int i = 1; i < numThreads; i++)
+			threads.emplace_back(connectTiles);
+
+		connectTiles();
+
+		for(std::thread& thread : threads)
+			thread.join();
+
+		// Gather all edges in one array, ordered by node.
+		mEdgeOffsets.assign(mNodes.size() + 1, 0);
+		auto countEdges = [&](const std::vector<EdgeEntry>& edges)
+		{
+			for(const EdgeEntry& entry : edges)
+				mEdgeOffsets[entry.mFrom + 1]++;
+		};
+
+		countEdges(crossingEdges);
+		for(const std::vector<EdgeEntry>& edges : tileEdges)
+			countEdges(edges);
+
+		for(size_t i = 1; i < mEdgeOffsets.size(); i++)
+			mEdgeOffsets[i] += mEdgeOffsets[i - 1];
+
+		std::vector<uint32_t> edgeFill(mEdgeOffsets.begin(), mEdgeOffsets.end() - 1);
+		mEdges.resize(mEdgeOffsets.back());
+		auto fillEdges = [&](const std::vector<EdgeEntry>& edges)
+		{
+			for(const EdgeEntry& entry : edges)
+				mEdges[edgeFill[entry.mFrom]++] = entry.mEdge;
+		};
+
+		fillEdges(crossingEdges);
+		for(const std::vector<EdgeEntry>& edges : tileEdges)
+			fillEdges(edges);
+	}
+
+	TiledPathFinder::TiledPathFinder(const TiledWorld* world)
+		: mWorld(world),
+		mUseCounter(0),
+		mGeneration(0)
+	{
+	}
+
+	PathFinder& TiledPathFinder::tilePathFinder(uint32_t tileIndex)
+	{
+		mUseCounter++;
+
+		TilePathFinder* leastRecent = nullptr;
+		for(TilePathFinder& tilePathFinder : mTilePathFinders)
+		{
+			if(tilePathFinder.mTileIndex == tileIndex)
+			{
+				tilePathFinder.mLastUse = mUseCounter;
+				return *tilePathFinder.mPathFinder;
+			}
+
+			if(!leastRecent || tilePathFinder.mLastUse < leastRecent->mLastUse)
+				leastRecent = &tilePathFinder;
+		}
+
+		if(mTilePathFinders.size() < MAX_TILE_PATH_FINDERS)
+		{
+			mTilePathFinders.emplace_back();
+			leastRecent = &mTilePathFinders.back();
+		}
+
+		leastRecent->mTileIndex = tileIndex;
+		leastRecent->mLastUse = mUseCounter;
+		leastRecent->mPathFinder.reset(new PathFinder(mWorld->mTiles[tileIndex]));
+		return *leastRecent->mPathFinder;
+	}
+
+	bool TiledPathFinder::localCost(uint32_t tileIndex, WorldPoint from, WorldPoint to, Cost& cost)
+	{
+		if(from == to)
+		{
+			cost = Cost(0, 0);
+			return true;
+		}
+
+		PathFinder& pathFinder = tilePathFinder(tileIndex);
+		if(runPathFinder(pathFinder, mWorld->localPoint(from), mWorld->localPoint(to)) != PathFinder::IterationRes::END_REACHED)
+			return false;
+
+		cost = pathFinder.endCost();
+		return true;
+	}
+
+	void TiledPathFinder::appendLocalPath(uint32_t tileIndex, WorldPoint from, WorldPoint to, bool reversed)
+	{
+		if(from == to)
+			return;
+
+		// The path is searched in the same direction as when its cost was
+		// computed, so it has that exact cost.
+		Point localFrom = mWorld->localPoint(from);
+		Point localTo = mWorld->localPoint(to);
+		if(reversed)
+			std::swap(localFrom, localTo);
+
+		PathFinder& pathFinder = tilePathFinder(tileIndex);
+		DIDA_ON_DEBUG(PathFinder::IterationRes res =) runPathFinder(pathFinder, localFrom, localTo);
+		DIDA_ASSERT(res == PathFinder::IterationRes::END_REACHED);
+
+		mLocalWaypoints.resize(pathFinder.path(nullptr, 0));
+		pathFinder.path(mLocalWaypoints.data(), (int)mLocalWaypoints.size());
+		if(reversed)
+			std::reverse(mLocalWaypoints.begin(), mLocalWaypoints.end());
+
+		WorldPoint tileOrigin(from.mX - mLocalWaypoints[0].mX, from.mY - mLocalWaypoints[0].mY);
+		for(size_t i = 1; i < mLocalWaypoints.size(); i++)
+			appendWaypoint(WorldPoint(tileOrigin.mX + mLocalWaypoints[i].mX, tileOrigin.mY + mLocalWaypoints[i].mY));
+	}
+
+	void TiledPathFinder::appendWaypoint(WorldPoint pt)
+	{
+		size_t size = mWaypoints.size();
+		if(size >= 1 && mWaypoints[size - 1] == pt)
+			return;
+
+		// Drop the last waypoint if it lies on the line from the one before
+		// it to pt. All segments are straight or diagonal, so that's the case
+		// if both segments go in the same direction.
+		if(size >= 2)
+		{
+			auto sign = [](int32_t i) { return (i > 0) - (i < 0); };
+
+			WorldPoint prev = mWaypoints[size - 2];
+			WorldPoint last = mWaypoints[size - 1];
+			if(sign(last.mX - prev.mX) == sign(pt.mX - last.mX) &&
+				sign(last.mY - prev.mY) == sign(pt.mY - last.mY))
+			{
+				mWaypoints[size - 1] = pt;
+				return;
+			}
+		}
+
+		mWaypoints.push_back(pt);
+	}
+
+	void TiledPathFinder::visit(uint32_t node, uint32_t parent, Cost cost)
+	{
+		NodeState& state = mNodeStates[node];
+		if(state.mGeneration == mGeneration)
+		{
+			if(state.mClosed || cost.toFixedPoint() >= state.mCost.toFixedPoint())
+				return;
+		}
+		else
+		{
+			state.mGeneration = mGeneration;
+			state.mClosed = false;
+		}
+
+		state.mParent = parent;
+		state.mCost = cost;
+
+		WorldPoint pt = node < mWorld->mNodes.size() ? mWorld->mNodes[node].mPoint : mEndPoint;
+		mOpenSet.push((cost + worldDistance(pt, mEndPoint)).toFixedPoint(), node);
+	}
+
+	PathFinder::IterationRes TiledPathFinder::findPath(WorldPoint startPoint, WorldPoint endPoint)
+	{
+		mWaypoints.clear();
+
+		const TiledWorld& world = *mWorld;
+		if(startPoint.mX < 0 || startPoint.mY < 0 || startPoint.mX >= world.width() || startPoint.mY >= world.height() ||
+			endPoint.mX < 0 || endPoint.mY < 0 || endPoint.mX >= world.width() || endPoint.mY >= world.height() ||
+			!world.walkable(startPoint) || !world.walkable(endPoint))
+		{
+			return PathFinder::IterationRes::UNREACHABLE;
+		}
+
+		// The start and end point are the last two nodes of the graph.
+		uint32_t numPortalNodes = (uint32_t)world.mNodes.size();
+		uint32_t startNode = numPortalNodes;
+		uint32_t endNode = numPortalNodes + 1;
+
+		if(mNodeStates.size() != numPortalNodes + 2)
+		{
+			mNodeStates.assign(numPortalNodes + 2, NodeState());
+			for(NodeState& state : mNodeStates)
+			{
+				state.mGeneration = 0;
+				state.mEndGeneration = 0;
+			}
+
+			mGeneration = 0;
+		}
+
+		mGeneration++;
+		mEndPoint = endPoint;
+		mOpenSet.clear();
+
+		uint32_t startTile = world.tileIndexOf(startPoint);
+		uint32_t endTile = world.tileIndexOf(endPoint);
+
+		mStartEdges.clear();
+		for(uint32_t i = world.mTileNodeOffsets[startTile]; i < world.mTileNodeOffsets[startTile + 1]; i++)
+		{
+			Cost cost;
+			if(localCost(startTile, startPoint, world.mNodes[i].mPoint, cost))
+				mStartEdges.push_back({ i, cost });
+		}
+
+		if(startTile == endTile)
+		{
+			Cost cost;
+			if(localCost(startTile, startPoint, endPoint, cost))
+				mStartEdges.push_back({ endNode, cost });
+		}
+
+		for(uint32_t i = world.mTileNodeOffsets[endTile]; i < world.mTileNodeOffsets[endTile + 1]; i++)
+		{
+			NodeState& state = mNodeStates[i];
+			if(localCost(endTile, world.mNodes[i].mPoint, endPoint, state.mEndCost))
+				state.mEndGeneration = mGeneration;
+		}
+
+		visit(startNode, startNode, Cost(0, 0));
+
+		bool endReached = false;
+		while(!mOpenSet.empty())
+		{
+			uint32_t node = mOpenSet.pop();
+			NodeState& state = mNodeStates[node];
+			if(state.mClosed)
+				continue;
+
+			state.mClosed = true;
+			if(node == endNode)
+			{
+				endReached = true;
+				break;
+			}
+
+			Cost cost = state.mCost;
+			if(node == startNode)
+			{
+				for(const TiledWorld::PortalEdge& edge : mStartEdges)
+					visit(edge.mTo, node, cost + edge.mCost);
+
+				continue;
+			}
+
+			for(uint32_t i = world.mEdgeOffsets[node]; i < world.mEdgeOffsets[node + 1]; i++)
+			{
+				const TiledWorld::PortalEdge& edge = world.mEdges[i];
+				visit(edge.mTo, node, cost + edge.mCost);
+			}
+
+			if(state.mEndGeneration == mGeneration)
+				visit(endNode, node, cost + state.mEndCost);
+		}
+
+		if(!endReached)
+			return PathFinder::IterationRes::UNREACHABLE;
+
+		mEndCost = mNodeStates[endNode].mCost;
+
+		std::vector<uint32_t> nodes;
+		for(uint32_t node = endNode; node != startNode; node = mNodeStates[node].mParent)
+			nodes.push_back(node);
+
+		std::reverse(nodes.begin(), nodes.end());
+
+		// Consecutive nodes in the same tile are connected by a tile local
+		// path, the others by a single step across a border.
+		mWaypoints.push_back(startPoint);
+		uint32_t prevNode = startNode;
+		WorldPoint prevPoint = startPoint;
+		uint32_t prevTile = startTile;
+		for(uint32_t node : nodes)
+		{
+			WorldPoint point = node == endNode ? endPoint : world.mNodes[node].mPoint;
+			uint32_t tile = node == endNode ? endTile : world.mNodes[node].mTileIndex;
+			if(tile == prevTile)
+			{
+				// The costs between portal nodes were computed from the lower
+				// node index to the higher one, the others from the start
+				// point or towards the end point.
+				appendLocalPath(tile, prevPoint, point, prevNode < numPortalNodes && node < prevNode);
+			}
+			else
+			{
+				appendWaypoint(point);
+			}
+
+			prevNode = node;
+			prevPoint = point;
+			prevTile = tile;
+		}
+
+		return PathFinder::IterationRes::END_REACHED;
+	}
+
+	int TiledPathFinder::path(WorldPoint* waypoints, int capacity) const
+	{
+		int numWaypoints = (int)mWaypoints.size();
+		std::copy(mWaypoints.begin(), mWaypoints.begin() + std::min(numWaypoints, capacity), waypoints);
+		return numWaypoints;
+	}
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "Obj.h"
+#include "Hierarchy.h"
+#include "HierarchyPathFinder.h"
+#include "RadixHeap.h"
+
+namespace Hierarchy
+{
+	// A point in a TiledWorld. Points within a tile are 16 bit, points in the
+	// world aren't.
+	struct WorldPoint
+	{
+		int32_t mX;
+		int32_t mY;
+
+		WorldPoint() { }
+		WorldPoint(int32_t x, int32_t y)
+			: mX(x),
+			mY(y)
+		{
+		}
+
+		bool operator == (WorldPoint b) const
+		{
+			return mX == b.mX && mY == b.mY;
+		}
+
+		bool operator != (WorldPoint b) const
+		{
+			return mX != b.mX || mY != b.mY;
+		}
+	};
+
+	// A grid of independent Hierarchy tiles, for worlds larger than the 16 bit
+	// coordinates of a single Hierarchy allow. Paths between tiles go through
+	// portals, pairs of neighboring full pixels on either side of a tile
+	// border. The portals of a tile are connected by the costs of the tile
+	// local paths between them, which makes up the graph TiledPathFinder
+	// searches.
+	class TiledWorld : public Obj
+	{
+		friend class TiledPathFinder;
+
+	public:
+		TiledWorld(int tileSize, int numTilesX, int numTilesY);
+
+		int tileSize() const { return mTileSize; }
+		int numTilesX() const { return mNumTilesX; }
+		int numTilesY() const { return mNumTilesY; }
+
+		int64_t width() const { return (int64_t)mTileSize * mNumTilesX; }
+		int64_t height() const { return (int64_t)mTileSize * mNumTilesY; }
+
+		// Sets the hierarchy of a tile, which must be tileSize x tileSize.
+		// Tiles without a hierarchy are blocked. buildPortals has to be called
+		// again after tiles are set.
+		void setTile(int tileX, int tileY, const Hierarchy* hierarchy);
+
+		const Hierarchy* tile(int tileX, int tileY) const
+		{
+			return mTiles[tileY * mNumTilesX + tileX];
+		}
+
+		// Finds the portals along all tile borders, and the costs of the paths
+		// between the portals of each tile. The tiles are distributed over
+		// numThreads threads.
+		void buildPortals(int numThreads);
+
+		int numPortalNodes() const { return (int)mNodes.size(); }
+
+	private:
+		// Runs of this many border pixel pairs or more get a portal at each
+		// end instead of one in the middle, so paths along a wide opening
+		// don't have to detour through its center.
+		static const int LONG_RUN_LENGTH = 8;
+
+		// One side of a portal.
+		struct PortalNode
+		{
+			WorldPoint mPoint;
+			uint32_t mTileIndex;
+		};
+
+		struct PortalEdge
+		{
+			uint32_t mTo;
+			Cost mCost;
+		};
+
+		struct Crossing
+		{
+			WorldPoint mA;
+			WorldPoint mB;
+		};
+
+		bool walkable(WorldPoint pt) const;
+		uint32_t tileIndexOf(WorldPoint pt) const;
+		Point localPoint(WorldPoint pt) const;
+
+		void addBorderCrossings(int tileX, int tileY, Axis2 axis, std::vector<Crossing>& crossings) const;
+		void addCornerCrossings(int tileX, int tileY, std::vector<Crossing>& crossings) const;
+
+		int mTileSize;
+		int mNumTilesX;
+		int mNumTilesY;
+		std::vector<RefPtr<const Hierarchy>> mTiles;
+
+		// The nodes ordered by tile, the nodes of tile i are
+		// mNodes[mTileNodeOffsets[i]] up to the next offset. The edges of node
+		// i are mEdges[mEdgeOffsets[i]] up to the next offset.
+		std::vector<PortalNode> mNodes;
+		std::vector<uint32_t> mTileNodeOffsets;
+		std::vector<uint32_t> mEdgeOffsets;
+		std::vector<PortalEdge> mEdges;
+	};
+
+	// Finds paths in a TiledWorld, by searching the portal graph from the
+	// start point to the end point, and then refining every stretch of the
+	// path within a tile with a tile local PathFinder.
+	class TiledPathFinder
+	{
+	public:
+		TiledPathFinder(const TiledWorld* world);
+
+		TiledPathFinder(const TiledPathFinder&) = delete;
+		TiledPathFinder& operator = (const TiledPathFinder&) = delete;
+
+		// Returns END_REACHED or UNREACHABLE.
+		PathFinder::IterationRes findPath(WorldPoint startPoint, WorldPoint endPoint);
+
+		// Only valid after findPath returned END_REACHED.
+		Cost endCost() const { return mEndCost; }
+
+		// Writes the waypoints of the path found by findPath, with the same
+		// conventions as PathFinder::path.
+		int path(WorldPoint* waypoints, int capacity) const;
+
+	private:
+		// The number of tiles for which a PathFinder is kept around.
+		static const int MAX_TILE_PATH_FINDERS = 8;
+
+		PathFinder& tilePathFinder(uint32_t tileIndex);
+		bool localCost(uint32_t tileIndex, WorldPoint from, WorldPoint to, Cost& cost);
+		void appendLocalPath(uint32_t tileIndex, WorldPoint from, WorldPoint to, bool reversed);
+		void appendWaypoint(WorldPoint pt);
+
+		void visit(uint32_t node, uint32_t parent, Cost cost);
+
+		RefPtr<const TiledWorld> mWorld;
+
+		struct TilePathFinder
+		{
+			uint32_t mTileIndex;
+			uint32_t mLastUse;
+			std::unique_ptr<PathFinder> mPathFinder;
+		};
+
+		std::vector<TilePathFinder> mTilePathFinders;
+		uint32_t mUseCounter;
+
+		// The search state of the portal nodes, followed by the start and end
+		// point. Entries stamped with an older generation are unvisited.
+		struct NodeState
+		{
+			uint32_t mGeneration;
+			bool mClosed;
+			uint32_t mParent;
+			Cost mCost;
+
+			// The cost of the tile local path to the end point, if
+			// mEndGeneration is the current generation.
+			uint32_t mEndGeneration;
+			Cost mEndCost;
+		};
+
+		std::vector<NodeState> mNodeStates;
+		uint32_t mGeneration;
+
+		std::vector<TiledWorld::PortalEdge> mStartEdges;
+		RadixHeap mOpenSet;
+
+		WorldPoint mEndPoint;
+		Cost mEndCost;
+		std::vector<WorldPoint> mWaypoints;
+		std::vector<Point> mLocalWaypoints;
+	};
+}
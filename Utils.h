@@ -2,6 +2,16 @@
 
 #include <cmath>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define DIDA_DEBUG_BREAK() __debugbreak()
+#else
+#define DIDA_DEBUG_BREAK() __builtin_trap()
+#endif
 
 #ifdef NDEBUG
 #define DIDA_ASSERT(cond)
@@ -12,7 +22,7 @@
 #define DIDA_ASSERT(cond) if(!(cond)) \
 	{ \
 		printf("Assertion failure: %s\n", #cond); \
-		__debugbreak(); \
+		DIDA_DEBUG_BREAK(); \
 	}
 
 #define DIDA_ON_DEBUG(s) s
@@ -132,6 +142,13 @@ public:
 			mDiag + b.mDiag);
 	}
 
+	Cost operator - (Cost b) const
+	{
+		return Cost(
+			mStraight - b.mStraight,
+			mDiag - b.mDiag);
+	}
+
 	Cost& operator += (Cost b)
 	{
 		mStraight += b.mStraight;
@@ -227,6 +244,23 @@ public:
 		return Cost(INT_MAX, INT_MAX);
 	}
 
+	// mStraight + SQRT_2 * mDiag in 32.32 fixed point. The conversion is
+	// linear, so the fixed point value of a sum of costs is the sum of their
+	// fixed point values, and comparing them needs no floating point math.
+	//
+	// Two different costs a + b * sqrt(2) whose counts differ by at most n
+	// differ by at least 1 / (2.5 * n), while the rounding of FIXED_POINT_DIAG
+	// is off by 1.2e-11 per diagonal, so costs with up to 2^17 straight and
+	// diagonal steps are ordered exactly.
+	uint64_t toFixedPoint() const
+	{
+		DIDA_ASSERT(mStraight >= 0 && mDiag >= 0);
+		return (uint64_t)mStraight * FIXED_POINT_STRAIGHT + (uint64_t)mDiag * FIXED_POINT_DIAG;
+	}
+
+	static const uint64_t FIXED_POINT_STRAIGHT = 1ull << 32;
+	static const uint64_t FIXED_POINT_DIAG = 6074001000ull; // round(SQRT_2 * (1ull << 32))
+
 private:
 	int mStraight;
 	int mDiag;
@@ -248,3 +282,15 @@ static inline bool isPow2(int i)
 {
 	return (i & (i - 1)) == 0;
 }
+
+// Index of the highest set bit of i, which must be non-zero.
+static inline int highestSetBit(uint64_t i)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, i);
+	return (int)index;
+#else
+	return 63 - __builtin_clzll(i);
+#endif
+}
\ No newline at end of file